@@ -1,229 +1,6248 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <memory>   // For smart pointers
-#include <map>      // For fast lookups
+#include <unordered_map> // For the token index
+#include <unordered_set>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <limits>   // For numeric_limits in clearInput
 #include <fstream>  // For File I/O
-#include <sstream>  // For string parsing
-#include <iomanip>
+#include <cstdio>   // For rename/remove
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <deque>
+#include <charconv> // For from_chars/to_chars
+#include <variant>
+#include <optional>
+#include <type_traits>
+#include <utility>  // For exchange
+#include <random>   // For random_device (generation tags)
+#include <future>   // For flush()/saveAsync() results
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LIBRARY_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define LIBRARY_POSIX 0
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LIBRARY_AVX2 1 // Compiled per function and picked at run time
+#include <immintrin.h>
+#else
+#define LIBRARY_AVX2 0
+#endif
+
+#if defined(__ARM_NEON)
+#define LIBRARY_NEON 1
+#include <arm_neon.h>
+#else
+#define LIBRARY_NEON 0
+#endif
+
+#if defined(__linux__)
+#define LIBRARY_EPOLL 1
+#include <csignal>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#else
+#define LIBRARY_EPOLL 0
+#endif
 
 using namespace std;
 
-// ==========================================
-// 1. Abstract Base Class (Polymorphism)
-// ==========================================
-class LibraryItem {
-protected:
-    int id;
-    string title;
-    bool isBorrowed;
+// ==========================================
+// 1. Item Base Class
+// ==========================================
+// The kinds of item are a closed set: Book and Journal, combined in
+// CatalogItem (section 2). Nothing dispatches through a vtable; code that
+// needs the concrete kind uses std::visit or switches on the tag.
+enum class ItemType : uint8_t { Book, Journal };
+
+// CSV quoting: fields containing a delimiter, quote or line break are
+// wrapped in quotes with inner quotes doubled
+void appendCsvField(string& out, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(field.data(), field.size());
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+string csvField(string_view field) {
+    string out;
+    appendCsvField(out, field);
+    return out;
+}
+
+class LibraryItem {
+protected:
+    int id;
+    string title;
+    bool isBorrowed;
+
+    // Only constructed and destroyed as part of a Book or Journal
+    LibraryItem(int id, string title) : id(id), title(move(title)), isBorrowed(false) {}
+    ~LibraryItem() = default;
+
+    // Serialization helper (for File I/O): the fields shared by every kind
+    string csvCommon() const {
+        return to_string(id) + "," + csvField(title) + "," + (isBorrowed ? "1" : "0");
+    }
+
+public:
+    // Getters and Setters
+    int getId() const { return id; }
+    string_view getTitle() const { return title; }
+    bool getStatus() const { return isBorrowed; }
+
+    void setBorrowed(bool status) { isBorrowed = status; }
+};
+
+// ==========================================
+// 2. Derived Classes
+// ==========================================
+// Line formats shared by the item classes and the columnar inventory.
+// Each line is built first and written with a single insertion, so lines
+// printed by concurrent readers never interleave or share stream state.
+void appendPadded(string& out, string_view text, size_t width) {
+    out.append(text.data(), text.size());
+    if (text.size() < width) out.append(width - text.size(), ' ');
+}
+
+void printBookLine(int id, string_view title, string_view author, bool borrowed) {
+    string line = "[Book] ID: " + to_string(id) + " | Title: ";
+    appendPadded(line, title, 20);
+    line += " | Author: ";
+    appendPadded(line, author, 15);
+    line += borrowed ? " | Status: Borrowed\n" : " | Status: Available\n";
+    cout << line;
+}
+
+void printJournalLine(int id, string_view title, string_view publisher, int volume, bool borrowed) {
+    string line = "[Journal] ID: " + to_string(id) + " | Title: ";
+    appendPadded(line, title, 20);
+    line += " | Publisher: ";
+    appendPadded(line, publisher, 15);
+    line += " | Vol: " + to_string(volume);
+    line += borrowed ? " | Status: Borrowed\n" : " | Status: Available\n";
+    cout << line;
+}
+
+class Book : public LibraryItem {
+private:
+    string author;
+    int pages;
+
+public:
+    static constexpr ItemType TYPE = ItemType::Book;
+
+    Book(int id, string title, string author, int pages)
+        : LibraryItem(id, move(title)), author(move(author)), pages(pages) {}
+
+    void display() const {
+        printBookLine(id, title, author, isBorrowed);
+    }
+
+    string_view getAuthor() const { return author; }
+    int getPages() const { return pages; }
+
+    static constexpr string_view getType() { return "BOOK"; }
+
+    string toCSV() const {
+        return "BOOK," + csvCommon() + "," + csvField(author) + "," + to_string(pages);
+    }
+};
+
+class Journal : public LibraryItem {
+private:
+    string publisher;
+    int volume;
+
+public:
+    static constexpr ItemType TYPE = ItemType::Journal;
+
+    Journal(int id, string title, string publisher, int volume)
+        : LibraryItem(id, move(title)), publisher(move(publisher)), volume(volume) {}
+
+    void display() const {
+        printJournalLine(id, title, publisher, volume, isBorrowed);
+    }
+
+    string_view getPublisher() const { return publisher; }
+    int getVolume() const { return volume; }
+
+    static constexpr string_view getType() { return "JOURNAL"; }
+
+    string toCSV() const {
+        return "JOURNAL," + csvCommon() + "," + csvField(publisher) + "," + to_string(volume);
+    }
+};
+
+// Any catalog item, by value. std::visit resolves to the concrete
+// member functions at compile time, so there are no indirect calls.
+using CatalogItem = variant<Book, Journal>;
+
+// Fields stored by the inventory under one name for both kinds
+template <typename Item>
+string_view creatorOf(const Item& item) {
+    if constexpr (is_same_v<Item, Book>) return item.getAuthor();
+    else return item.getPublisher();
+}
+
+template <typename Item>
+int numberOf(const Item& item) {
+    if constexpr (is_same_v<Item, Book>) return item.getPages();
+    else return item.getVolume();
+}
+
+int itemId(const CatalogItem& item) {
+    return visit([](const auto& concrete) { return concrete.getId(); }, item);
+}
+
+string_view itemTitle(const CatalogItem& item) {
+    return visit([](const auto& concrete) { return concrete.getTitle(); }, item);
+}
+
+void display(const CatalogItem& item) {
+    visit([](const auto& concrete) { concrete.display(); }, item);
+}
+
+string toCSV(const CatalogItem& item) {
+    return visit([](const auto& concrete) { return concrete.toCSV(); }, item);
+}
+
+// ==========================================
+// 3. Inverted Title Index (Keyword Search)
+// ==========================================
+// Maps each lowercase alphanumeric token of a title to a sorted posting
+// list of item IDs. A keyword query intersects the posting lists of its
+// tokens, so the cost depends on the number of matches, not catalog size.
+// Intersects sorted posting lists, smallest first to keep intermediate
+// results short. Shared by the keyword and substring indexes.
+vector<int> intersectPostings(vector<const vector<int>*> lists) {
+    if (lists.empty()) return {};
+    sort(lists.begin(), lists.end(),
+         [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+
+    vector<int> result = *lists[0];
+    vector<int> scratch;
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+        scratch.clear();
+        set_intersection(result.begin(), result.end(),
+                         lists[i]->begin(), lists[i]->end(),
+                         back_inserter(scratch));
+        result.swap(scratch);
+    }
+    return result;
+}
+
+// Approximate heap footprint of a key -> posting list map: the bucket
+// array, one node per key and the list storage (long string keys not counted)
+template <typename Map>
+size_t postingMapBytes(const Map& postings) {
+    size_t bytes = postings.bucket_count() * sizeof(void*) +
+                   postings.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+    for (const auto& entry : postings) bytes += entry.second.capacity() * sizeof(int);
+    return bytes;
+}
+
+class TitleIndex {
+private:
+    unordered_map<string, vector<int>> postings;
+
+public:
+    static vector<string> tokenize(string_view text) {
+        vector<string> tokens;
+        string current;
+        for (char c : text) {
+            unsigned char uc = static_cast<unsigned char>(c);
+            if (isalnum(uc)) {
+                current += static_cast<char>(tolower(uc));
+            } else if (!current.empty()) {
+                tokens.push_back(move(current));
+                current.clear();
+            }
+        }
+        if (!current.empty()) tokens.push_back(move(current));
+
+        // A title mentioning a word twice still gets one posting
+        sort(tokens.begin(), tokens.end());
+        tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+        return tokens;
+    }
+
+    void add(int id, string_view title) {
+        for (const string& token : tokenize(title)) {
+            vector<int>& list = postings[token];
+            // IDs usually arrive in ascending order (file load, new items)
+            if (list.empty() || list.back() < id) {
+                list.push_back(id);
+                continue;
+            }
+            auto pos = lower_bound(list.begin(), list.end(), id);
+            if (pos == list.end() || *pos != id) list.insert(pos, id);
+        }
+    }
+
+    void remove(int id, string_view title) {
+        for (const string& token : tokenize(title)) {
+            auto it = postings.find(token);
+            if (it == postings.end()) continue;
+            vector<int>& list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), id);
+            if (pos != list.end() && *pos == id) list.erase(pos);
+            if (list.empty()) postings.erase(it);
+        }
+    }
+
+    void clear() { postings.clear(); }
+    size_t memoryBytes() const { return postingMapBytes(postings); }
+
+    // Bulk path: caller feeds titles in ascending ID order, so every
+    // posting list is built by push_back alone.
+    void appendSorted(int id, string_view title) {
+        for (const string& token : tokenize(title)) {
+            postings[token].push_back(id);
+        }
+    }
+
+    // Returns the sorted IDs whose titles contain every token of the query
+    vector<int> search(const string& query) const {
+        vector<const vector<int>*> lists;
+        for (const string& token : tokenize(query)) {
+            auto it = postings.find(token);
+            if (it == postings.end()) return {};
+            lists.push_back(&it->second);
+        }
+        return intersectPostings(lists);
+    }
+};
+
+// ==========================================
+// 4. Trigram Index (Substring Search)
+// ==========================================
+// Maps every 3-byte sequence of a title to a sorted posting list of item
+// IDs. Any substring of length >= 3 must contain all of its trigrams, so
+// intersecting their lists yields a small candidate set that is then
+// verified. Matching is byte-exact, like searchItem's default mode.
+class TrigramIndex {
+private:
+    unordered_map<uint32_t, vector<int>> postings;
+
+    static vector<uint32_t> trigramsOf(string_view text) {
+        vector<uint32_t> grams;
+        if (text.size() < 3) return grams;
+        grams.reserve(text.size() - 2);
+        for (size_t i = 0; i + 3 <= text.size(); ++i) {
+            grams.push_back((uint32_t(uint8_t(text[i])) << 16) |
+                            (uint32_t(uint8_t(text[i + 1])) << 8) |
+                             uint32_t(uint8_t(text[i + 2])));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+public:
+    static constexpr size_t MIN_QUERY = 3;
+
+    void add(int id, string_view title) {
+        for (uint32_t gram : trigramsOf(title)) {
+            vector<int>& list = postings[gram];
+            if (list.empty() || list.back() < id) {
+                list.push_back(id);
+                continue;
+            }
+            auto pos = lower_bound(list.begin(), list.end(), id);
+            if (pos == list.end() || *pos != id) list.insert(pos, id);
+        }
+    }
+
+    void remove(int id, string_view title) {
+        for (uint32_t gram : trigramsOf(title)) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) continue;
+            vector<int>& list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), id);
+            if (pos != list.end() && *pos == id) list.erase(pos);
+            if (list.empty()) postings.erase(it);
+        }
+    }
+
+    void clear() { postings.clear(); }
+    size_t memoryBytes() const { return postingMapBytes(postings); }
+
+    // Bulk path, see TitleIndex::appendSorted
+    void appendSorted(int id, string_view title) {
+        for (uint32_t gram : trigramsOf(title)) {
+            postings[gram].push_back(id);
+        }
+    }
+
+    // Sorted IDs of titles that *may* contain the keyword. Callers must
+    // verify each candidate; keyword must be at least MIN_QUERY bytes.
+    vector<int> candidates(string_view keyword) const {
+        vector<const vector<int>*> lists;
+        for (uint32_t gram : trigramsOf(keyword)) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) return {};
+            lists.push_back(&it->second);
+        }
+        return intersectPostings(lists);
+    }
+};
+
+// --- Bit helpers (scan kernels, bitmaps and histograms below) ---
+inline int popcount64(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(word);
+#else
+    int bits = 0;
+    for (; word; word &= word - 1) ++bits;
+    return bits;
+#endif
+}
+
+// Index of the most significant set bit; word must be nonzero
+inline int highestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(word);
+#else
+    int bit = 0;
+    while (word >>= 1) ++bit;
+    return bit;
+#endif
+}
+
+inline int lowestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) word >>= 1, ++bit;
+    return bit;
+#endif
+}
+
+// --- Scan kernel ---
+// Finds a substring in a large buffer (the whole title heap) with the
+// first/last byte filter: one vector compare selects the positions where
+// both the needle's first and last byte line up, and only those are
+// verified byte by byte. Case-insensitive matching folds ASCII A-Z to
+// lowercase on the fly; other bytes must match exactly.
+inline char foldAscii(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+class SubstringScanner {
+private:
+    string needle;   // Already folded when ignoring case
+    bool ignoreCase;
+
+    bool matchesAt(const char* text) const {
+        if (!ignoreCase) return memcmp(text, needle.data(), needle.size()) == 0;
+        for (size_t i = 0; i < needle.size(); ++i) {
+            if (foldAscii(text[i]) != needle[i]) return false;
+        }
+        return true;
+    }
+
+    const char* findScalar(const char* data, size_t size) const {
+        if (needle.size() > size) return nullptr;
+        if (!ignoreCase) {
+            size_t pos = string_view(data, size).find(needle);
+            return pos == string_view::npos ? nullptr : data + pos;
+        }
+        const char* last = data + (size - needle.size());
+        for (const char* p = data; p <= last; ++p) {
+            if (foldAscii(*p) == needle[0] && matchesAt(p)) return p;
+        }
+        return nullptr;
+    }
+
+#if LIBRARY_AVX2
+    __attribute__((target("avx2"))) static __m256i foldAvx2(__m256i bytes) {
+        // Shift 'A'..'Z' onto -128..-103 so one signed compare finds them
+        __m256i shifted = _mm256_add_epi8(bytes, _mm256_set1_epi8(char(0x80 - 'A')));
+        __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(char(-128 + 26)), shifted);
+        return _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    }
+
+    __attribute__((target("avx2"))) const char* findAvx2(const char* data, size_t size) const {
+        const size_t span = needle.size() - 1;
+        const __m256i first = _mm256_set1_epi8(needle.front());
+        const __m256i last = _mm256_set1_epi8(needle.back());
+        size_t i = 0;
+        for (; i + span + 32 <= size; i += 32) {
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + span));
+            if (ignoreCase) {
+                head = foldAvx2(head);
+                tail = foldAvx2(tail);
+            }
+            __m256i hits = _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last));
+            for (uint32_t mask = uint32_t(_mm256_movemask_epi8(hits)); mask; mask &= mask - 1) {
+                const char* candidate = data + i + size_t(lowestBit(mask));
+                if (matchesAt(candidate)) return candidate;
+            }
+        }
+        return findScalar(data + i, size - i);
+    }
+
+    static bool hasAvx2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#endif
+
+#if LIBRARY_NEON
+    static uint8x16_t foldNeon(uint8x16_t bytes) {
+        uint8x16_t upper = vcltq_u8(vsubq_u8(bytes, vdupq_n_u8('A')), vdupq_n_u8(26));
+        return vaddq_u8(bytes, vandq_u8(upper, vdupq_n_u8(0x20)));
+    }
+
+    const char* findNeon(const char* data, size_t size) const {
+        const size_t span = needle.size() - 1;
+        const uint8x16_t first = vdupq_n_u8(uint8_t(needle.front()));
+        const uint8x16_t last = vdupq_n_u8(uint8_t(needle.back()));
+        size_t i = 0;
+        for (; i + span + 16 <= size; i += 16) {
+            uint8x16_t head = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+            uint8x16_t tail = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i + span));
+            if (ignoreCase) {
+                head = foldNeon(head);
+                tail = foldNeon(tail);
+            }
+            uint8x16_t hits = vandq_u8(vceqq_u8(head, first), vceqq_u8(tail, last));
+            // Narrow each byte of the compare result to 4 bits of a 64-bit mask
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+            for (; mask; mask &= ~(uint64_t(0xF) << (lowestBit(mask) & ~3))) {
+                const char* candidate = data + i + size_t(lowestBit(mask) >> 2);
+                if (matchesAt(candidate)) return candidate;
+            }
+        }
+        return findScalar(data + i, size - i);
+    }
+#endif
+
+public:
+    SubstringScanner(string_view pattern, bool ignoreCase) : needle(pattern), ignoreCase(ignoreCase) {
+        if (ignoreCase) {
+            for (char& c : needle) c = foldAscii(c);
+        }
+    }
+
+    size_t size() const { return needle.size(); }
+
+    // First match in data[0, size), or nullptr; an empty needle matches at data
+    const char* find(const char* data, size_t size) const {
+        if (needle.empty()) return data;
+        if (needle.size() > size) return nullptr;
+#if LIBRARY_AVX2
+        if (hasAvx2()) return findAvx2(data, size);
+#elif LIBRARY_NEON
+        return findNeon(data, size);
+#endif
+        return findScalar(data, size);
+    }
+
+    bool matches(string_view text) const { return find(text.data(), text.size()) != nullptr; }
+};
+
+// ==========================================
+// 5. Flat Inventory Storage (Struct of Arrays)
+// ==========================================
+// Shared by borrow/return, exclusive while a StatusCut is taken. A cut
+// is brief but would starve behind a steady stream of borrows (the
+// shared_mutex prefers readers), so sharers step aside while one waits.
+class CutGate {
+private:
+    shared_mutex gate;
+    atomic<int> waiting{0};
+
+public:
+    void lock_shared() {
+        while (waiting.load(memory_order_acquire) != 0) this_thread::yield();
+        gate.lock_shared();
+    }
+    void unlock_shared() { gate.unlock_shared(); }
+    void lock() {
+        waiting.fetch_add(1, memory_order_acq_rel);
+        gate.lock();
+        waiting.fetch_sub(1, memory_order_acq_rel);
+    }
+    void unlock() { gate.unlock(); }
+};
+
+// Locking policies of BasicLibraryManager (section 13): the types it locks
+// with and keeps its flags in. The storage below takes the same policy,
+// for the status column, its change tracking and the journal. THREADED =
+// false also keeps the manager off other threads: scans and CSV imports
+// run on the caller, and the journal starts no background writer, so
+// saveAsync() saves on the spot and partial groups of records are written
+// by flush(), saves and the destructor.
+struct SharedLocking {
+    static constexpr bool THREADED = true;
+    using CatalogMutex = shared_mutex;
+    using Gate = CutGate;
+    using Mutex = mutex;
+    using Condition = condition_variable;
+    template <typename T>
+    using Flag = atomic<T>;
+};
+
+// Meets the lockable and shared lockable requirements, and does nothing
+struct NullMutex {
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+    void lock_shared() {}
+    void unlock_shared() {}
+};
+
+// Never waits: only a background thread would, and there is none
+struct NullCondition {
+    void notify_one() {}
+    void notify_all() {}
+    template <typename Lock, typename Duration>
+    cv_status wait_for(Lock&, const Duration&) { return cv_status::timeout; }
+};
+
+// The subset of atomic<T> the engine uses, over a plain member
+template <typename T>
+class PlainFlag {
+private:
+    T value;
+
+public:
+    PlainFlag(T value = T()) : value(value) {}
+    T load(memory_order = memory_order_seq_cst) const { return value; }
+    void store(T next, memory_order = memory_order_seq_cst) { value = next; }
+    operator T() const { return value; }
+    PlainFlag& operator=(T next) {
+        value = next;
+        return *this;
+    }
+    // Each returns the value before
+    T fetch_or(T bits, memory_order = memory_order_seq_cst) { return exchange(value, value | bits); }
+    T fetch_and(T bits, memory_order = memory_order_seq_cst) { return exchange(value, value & bits); }
+    T fetch_add(T amount, memory_order = memory_order_seq_cst) { return exchange(value, value + amount); }
+};
+
+struct SingleThreaded {
+    static constexpr bool THREADED = false;
+    using CatalogMutex = NullMutex;
+    using Gate = NullMutex;
+    using Mutex = NullMutex;
+    using Condition = NullCondition;
+    template <typename T>
+    using Flag = PlainFlag<T>;
+};
+
+// A plain value (a column element, possibly in a mapped snapshot) used in
+// place as a Locking::Flag, so threads can update it concurrently
+template <typename Locking, typename T>
+typename Locking::template Flag<T>& flagAt(const T& value) {
+    using F = typename Locking::template Flag<T>;
+    static_assert(sizeof(F) == sizeof(T) && alignof(F) == alignof(T), "flags are accessed in place");
+    static_assert(!Locking::THREADED || atomic<T>::is_always_lock_free, "in-place atomics must be lock-free");
+    return *reinterpret_cast<F*>(const_cast<T*>(&value));
+}
+
+// A flat array that either owns its elements or points into a mapped
+// snapshot. Reads and in-place writes work on both (snapshots are mapped
+// copy-on-write); anything that grows the column copies it into owned
+// memory first, once.
+template <typename T>
+class Column {
+private:
+    vector<T> owned;
+    T* ptr = nullptr;
+    size_t count = 0;
+    bool mapped = false;
+
+    void sync() {
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    void own() {
+        if (!mapped) return;
+        owned.assign(ptr, ptr + count);
+        mapped = false;
+        sync();
+    }
+
+public:
+    size_t size() const { return count; }
+    const T* data() const { return ptr; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    T& operator[](size_t i) { return ptr[i]; }
+    const T& back() const { return ptr[count - 1]; }
+    // Mapped columns live in the page cache and count as 0
+    size_t memoryBytes() const { return mapped ? 0 : owned.capacity() * sizeof(T); }
+
+    void attach(T* mappedData, size_t n) {
+        vector<T>().swap(owned);
+        ptr = mappedData;
+        count = n;
+        mapped = true;
+    }
+
+    void push_back(const T& value) { own(); owned.push_back(value); sync(); }
+    void append(const T* values, size_t n) { own(); owned.insert(owned.end(), values, values + n); sync(); }
+    void reserve(size_t n) { own(); owned.reserve(n); sync(); }
+    void assign(size_t n, const T& value) { mapped = false; owned.assign(n, value); sync(); }
+    void replace(vector<T>& values) { mapped = false; owned.swap(values); sync(); }
+    void pop_back() {
+        if (mapped) --count; // Shrinking a mapped view needs no copy
+        else { owned.pop_back(); sync(); }
+    }
+};
+
+// Dictionary of the strings many items share (authors, publishers).
+// Every distinct string gets a dense 32-bit code, 0 being the empty
+// string, and items store only the code. The text is one contiguous heap
+// and spans[code] = (offset << 32 | length), so both are written to disk
+// as-is and mapped back; the hash from text to code is rebuilt from the
+// spans by the first intern after mapping.
+class StringDictionary {
+private:
+    Column<char> heap;
+    Column<uint64_t> spans;
+    vector<uint32_t> buckets;  // Code, 0 = empty bucket; load factor <= 1/2
+    size_t indexedCodes = 1;   // Codes entered in buckets (0 never is)
+
+    static size_t hashOf(string_view text) { return hash<string_view>()(text); }
+
+    // Slot of text in buckets: its code, or the empty bucket to put it in
+    size_t probe(string_view text) const {
+        size_t mask = buckets.size() - 1;
+        size_t i = hashOf(text) & mask;
+        while (buckets[i] != 0 && view(buckets[i]) != text) i = (i + 1) & mask;
+        return i;
+    }
+
+    // Makes room for one more code, entering any mapped ones first
+    void prepareInsert() {
+        size_t needed = (spans.size() + 1) * 2;
+        if (indexedCodes == spans.size() && needed <= buckets.size()) return;
+        size_t capacity = max<size_t>(64, buckets.size());
+        while (capacity < needed) capacity *= 2;
+        buckets.assign(capacity, 0);
+        for (size_t code = 1; code < spans.size(); ++code) buckets[probe(view(uint32_t(code)))] = uint32_t(code);
+        indexedCodes = spans.size();
+    }
+
+    uint32_t add(uint64_t span, size_t bucket) {
+        uint32_t code = uint32_t(spans.size());
+        spans.push_back(span);
+        buckets[bucket] = code;
+        ++indexedCodes;
+        return code;
+    }
+
+public:
+    StringDictionary() { spans.push_back(0); }
+
+    string_view view(uint32_t code) const {
+        uint64_t span = spans[code];
+        return string_view(heap.data() + (span >> 32), uint32_t(span));
+    }
+
+    // Code of the existing copy, or of a new one appended to the heap
+    uint32_t intern(string_view text) {
+        if (text.empty()) return 0;
+        prepareInsert();
+        size_t i = probe(text);
+        if (buckets[i] != 0) return buckets[i];
+        uint64_t span = (uint64_t(heap.size()) << 32) | text.size();
+        heap.append(text.data(), text.size());
+        return add(span, i);
+    }
+
+    // Code for a string already in the heap (snapshots before version 3
+    // referenced the heap directly)
+    uint32_t adopt(uint32_t offset, uint32_t length) {
+        if (length == 0) return 0;
+        prepareInsert();
+        size_t i = probe(string_view(heap.data() + offset, length));
+        return buckets[i] != 0 ? buckets[i] : add((uint64_t(offset) << 32) | length, i);
+    }
+
+    size_t size() const { return spans.size(); } // Codes, counting the empty string
+    size_t byteSize() const { return heap.size(); }
+    const char* bytes() const { return heap.data(); }
+    const uint64_t* spanData() const { return spans.data(); }
+    size_t memoryBytes() const {
+        return heap.memoryBytes() + spans.memoryBytes() + buckets.capacity() * sizeof(uint32_t);
+    }
+
+    // codes = 0: the spans are not in the file; adopt() rebuilds them
+    void attach(char* heapData, size_t heapBytes, uint64_t* spanData, size_t codes) {
+        heap.attach(heapData, heapBytes);
+        if (codes > 0) spans.attach(spanData, codes);
+        else spans.assign(1, 0);
+        vector<uint32_t>().swap(buckets);
+        indexedCodes = 1;
+    }
+};
+
+// Read-only view of a whole file, mapped copy-on-write where supported:
+// pages are shared with the page cache until something writes to them.
+class MappedFile {
+private:
+    char* base = nullptr;
+    size_t length = 0;
+#if !LIBRARY_POSIX
+    vector<char> buffer;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if LIBRARY_POSIX
+        if (base) munmap(base, length);
+#endif
+    }
+
+    bool open(const string& path) {
+#if LIBRARY_POSIX
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps the file alive
+        if (addr == MAP_FAILED) return false;
+        base = static_cast<char*>(addr);
+        length = size_t(info.st_size);
+        return true;
+#else
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in) return false;
+        buffer.resize(size_t(in.tellg()));
+        in.seekg(0);
+        if (!in.read(buffer.data(), buffer.size())) return false;
+        base = buffer.data();
+        length = buffer.size();
+        return true;
+#endif
+    }
+
+    char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// Moves a fully written temporary file over path. With sync, the data
+// is flushed to disk before the rename and the directory entry after
+// it, so after a power loss path holds either the old file or the whole
+// new one; callers may then drop what the old file was needed for.
+inline bool replaceFile(const string& tmpPath, const string& path, bool sync) {
+#if LIBRARY_POSIX
+    if (sync) {
+        int fd = ::open(tmpPath.c_str(), O_RDONLY);
+        bool synced = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (!synced) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+    }
+#endif
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) return false;
+#if LIBRARY_POSIX
+    if (sync) {
+        string dir = filesystem::path(path).parent_path().string();
+        int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+        bool synced = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        return synced;
+    }
+#endif
+    return true;
+}
+
+// --- Binary snapshot format (version 4) ---
+// Header and SnapshotChecks, then 8-byte aligned sections in this order:
+//   ids[int32 n] | types[u8 n] | borrowed[u64 ceil(n/64)]
+//   titleOffsets[u32 n] | titleLengths[u32 n]
+//   creatorCodes[u32 n] | numbers[int32 n]
+//   idTable[int32 tableSize] | titleHeap | creatorHeap | borrowCounts[u32 n]
+//   creatorSpans[u64 creatorCodes]
+// Slots are written in ascending ID order and the ID table is stored
+// prebuilt, so a mapped snapshot is usable without any parsing. Creators
+// are StringDictionary codes; the dictionary's heap and spans are stored
+// as they are in memory.
+// Every offset, code and table entry is checked against the section it
+// points into before the file is used, so a damaged file is rejected (and
+// the CSV read instead) rather than read out of bounds.
+// Older files are still read: version 3 has no SnapshotChecks, version 2
+// also has creatorOffsets[u32 n] and creatorLengths[u32 n] into the heap
+// instead of codes (converted on load), and version 1 also lacks
+// borrowCounts (counts start at 0).
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;    // 0x01020304 in the writer's byte order
+    uint64_t itemCount;
+    uint64_t tableSize;
+    uint64_t titleBytes;
+    uint64_t creatorBytes;
+    uint64_t generation;   // Random tag the status delta and journal refer to (0 in old files)
+    uint64_t creatorCodes; // Dictionary size, counting the empty string (0 before version 3)
+};
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header must stay 64 bytes");
+
+constexpr char SNAPSHOT_MAGIC[8] = {'L', 'I', 'B', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 4;
+
+// Where the journal continuing a saved state picks up: the generation of
+// the log it was written beside, and the file offset in that log of the
+// first record the state does not hold. If a checkpoint dies after
+// publishing the state but before resetting the log, startup replays the
+// old log from there. A zero generation means none.
+struct JournalResume {
+    uint64_t generation = 0;
+    uint64_t offset = 0;
+};
+
+// Follows the header from version 4 on
+struct SnapshotChecks {
+    uint64_t checksum;          // SnapshotChecksum of everything but this field
+    uint64_t journalGeneration; // See JournalResume
+    uint64_t journalOffset;
+    uint64_t reserved;
+};
+static_assert(sizeof(SnapshotChecks) == 32, "snapshot checks must stay 32 bytes");
+constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+struct SnapshotLayout {
+    size_t ids, types, borrowed, titleOffsets, titleLengths;
+    size_t creatorCodes, creatorLengths, numbers, table, titles, creators, borrowCounts, creatorSpans, total;
+
+    explicit SnapshotLayout(const SnapshotHeader& h) {
+        auto align = [](size_t pos) { return (pos + 7) & ~size_t(7); };
+        size_t n = size_t(h.itemCount);
+        ids = sizeof(SnapshotHeader) + (h.version >= 4 ? sizeof(SnapshotChecks) : 0);
+        types = align(ids + n * sizeof(int32_t));
+        borrowed = align(types + n);
+        titleOffsets = align(borrowed + (n + 63) / 64 * sizeof(uint64_t));
+        titleLengths = align(titleOffsets + n * sizeof(uint32_t));
+        creatorCodes = align(titleLengths + n * sizeof(uint32_t));   // Heap offsets before version 3
+        creatorLengths = align(creatorCodes + n * sizeof(uint32_t)); // Before version 3 only
+        numbers = h.version >= 3 ? creatorLengths : align(creatorLengths + n * sizeof(uint32_t));
+        table = align(numbers + n * sizeof(int32_t));
+        titles = align(table + size_t(h.tableSize) * sizeof(int32_t));
+        creators = titles + size_t(h.titleBytes);
+        borrowCounts = align(creators + size_t(h.creatorBytes));
+        creatorSpans = align(borrowCounts + n * sizeof(uint32_t));
+        if (h.version >= 3) total = creatorSpans + size_t(h.creatorCodes) * sizeof(uint64_t);
+        else total = h.version >= 2 ? borrowCounts + n * sizeof(uint32_t) : creators + size_t(h.creatorBytes);
+    }
+};
+
+// 32-bit FNV-1a; checksums the journal records and the status delta
+// Pass the previous result as h to continue over another piece
+inline uint32_t fnv1a(const char* data, size_t size, uint32_t h = 2166136261u) {
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ uint8_t(data[i])) * 16777619u;
+    }
+    return h;
+}
+
+// 64-bit checksum of snapshot files, fed in pieces of any size. Four
+// independent multiply-rotate lanes over 8-byte words keep it close to
+// memory speed, which matters for files of hundreds of megabytes.
+class SnapshotChecksum {
+private:
+    static constexpr uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t lanes[4] = {P1 + P2, P2, 0, 0 - P1};
+    char tail[32];
+    size_t tailBytes = 0;
+    uint64_t total = 0;
+
+    static uint64_t mix(uint64_t lane, uint64_t word) {
+        lane += word * P2;
+        lane = (lane << 31) | (lane >> 33);
+        return lane * P1;
+    }
+
+    void block(const char* data) {
+        for (int i = 0; i < 4; ++i) {
+            uint64_t word;
+            memcpy(&word, data + i * 8, 8);
+            lanes[i] = mix(lanes[i], word);
+        }
+    }
+
+public:
+    void update(const void* data, size_t size) {
+        if (size == 0) return;
+        const char* p = static_cast<const char*>(data);
+        total += size;
+        if (tailBytes > 0) {
+            size_t take = min(size, sizeof(tail) - tailBytes);
+            memcpy(tail + tailBytes, p, take);
+            tailBytes += take;
+            p += take;
+            size -= take;
+            if (tailBytes < sizeof(tail)) return;
+            block(tail);
+            tailBytes = 0;
+        }
+        for (; size >= sizeof(tail); p += sizeof(tail), size -= sizeof(tail)) block(p);
+        memcpy(tail, p, size);
+        tailBytes = size;
+    }
+
+    uint64_t digest() const {
+        uint64_t h = total * P1;
+        for (uint64_t lane : lanes) h = mix(h ^ mix(0, lane), P1);
+        for (size_t i = 0; i < tailBytes; ++i) h = mix(h, uint8_t(tail[i]));
+        h ^= h >> 33;
+        h *= P2;
+        return h ^ (h >> 29);
+    }
+};
+
+// Fresh random tag for a snapshot, status delta or journal generation
+inline uint64_t newGeneration() {
+    static atomic<uint64_t> sequence{0};
+    random_device entropy;
+    uint64_t tag = (uint64_t(entropy()) << 32) ^ entropy() ^
+                   uint64_t(chrono::steady_clock::now().time_since_epoch().count()) ^ (sequence++ << 48);
+    return tag ? tag : 1;
+}
+
+// Status delta: borrowed flags and borrow counts that changed since the
+// snapshot it names, so a checkpoint after a session of checkouts writes
+// a few kilobytes instead of the whole catalog. Absolute values, keyed by
+// snapshot position; the file is replaced whole (write + rename).
+//   StatusDeltaHeader | entryCount x (u32 position, u32 count | borrowed << 31)
+struct StatusDeltaHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t baseGeneration; // Snapshot this applies to
+    uint64_t generation;     // State after applying it
+    uint64_t itemCount;      // Must match the snapshot
+    uint64_t entryCount;
+    uint32_t checksum;       // fnv1a of the journal fields (version 2) and the entries
+    uint32_t reserved;
+    uint64_t journalGeneration; // From version 2 on, see JournalResume
+    uint64_t journalOffset;
+};
+static_assert(sizeof(StatusDeltaHeader) == 72, "status delta header layout");
+
+constexpr char STATUS_DELTA_MAGIC[8] = {'L', 'I', 'B', 'D', 'E', 'L', 'T', '\0'};
+constexpr uint32_t STATUS_DELTA_VERSION = 2;
+constexpr size_t STATUS_DELTA_V1_HEADER_SIZE = 56; // Without the journal fields
+
+// Which status words (64 slots each) changed since a baseline file was
+// written, one bit per word. Borrow/return mark words concurrently under
+// the shared catalog lock; inserts and removals move slots, which makes
+// the baseline unusable (stale) until the next full write. Everything
+// but mark() runs while nothing marks.
+class DirtyWords {
+private:
+    vector<uint64_t> bits;
+    size_t marked = 0;
+    bool stale = true;  // No baseline yet, or slots moved since
+
+public:
+    void reset(size_t words) {
+        bits.assign((words + 63) / 64, 0);
+        marked = 0;
+        stale = false;
+    }
+
+    void invalidate() {
+        vector<uint64_t>().swap(bits);
+        stale = true;
+    }
+
+    bool isStale() const { return stale; }
+    size_t count() const { return marked; }
+
+    // Safe from several threads at once if Locking is THREADED; a word
+    // already marked costs one load
+    template <typename Locking>
+    void mark(size_t word) {
+        if (stale || (word >> 6) >= bits.size()) return;
+        auto& cell = flagAt<Locking>(bits[word >> 6]);
+        uint64_t bit = uint64_t(1) << (word & 63);
+        if (cell.load(memory_order_relaxed) & bit) return;
+        if (!(cell.fetch_or(bit, memory_order_relaxed) & bit)) {
+            flagAt<Locking>(marked).fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    // Adds the marks of an earlier tracker of the same words; nothing may
+    // mark concurrently
+    void merge(const DirtyWords& earlier) {
+        if (stale) return;
+        if (earlier.stale || earlier.bits.size() != bits.size()) {
+            invalidate();
+            return;
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < bits.size(); ++i) {
+            bits[i] |= earlier.bits[i];
+            total += size_t(popcount64(bits[i]));
+        }
+        marked = total;
+    }
+
+    template <typename Visit>
+    void forEach(Visit&& visit) const {
+        for (size_t i = 0; i < bits.size(); ++i) {
+            for (uint64_t word = bits[i]; word; word &= word - 1) visit(i * 64 + size_t(lowestBit(word)));
+        }
+    }
+};
+
+// Baselines a DirtyWords tracks: the snapshot on disk and the CSV export
+enum class Baseline : uint8_t { Snapshot, Csv };
+
+// Borrowed flags (and optionally borrow counts) of every slot at one
+// instant, copied while borrow/return are held off. Long reads and saves
+// work from a cut, so they see one consistent version of the catalog
+// while borrowing goes on in the live columns. A cut taken for a save
+// also carries the changes marked up to it (FlatInventory::takeChanges).
+struct StatusCut {
+    vector<uint64_t> bits;
+    vector<uint32_t> counts;
+    DirtyWords changes[2]; // By Baseline; stale unless taken
+
+    bool borrowed(int slot) const { return (bits[size_t(slot) >> 6] >> (slot & 63)) & 1; }
+    uint32_t count(int slot) const { return counts[size_t(slot)]; }
+    size_t borrowedCount() const {
+        size_t total = 0;
+        for (uint64_t word : bits) total += size_t(popcount64(word));
+        return total;
+    }
+    const DirtyWords& changesSince(Baseline baseline) const { return changes[size_t(baseline)]; }
+};
+
+// Items live in dense parallel columns indexed by slot. Titles share one
+// contiguous heap, and an open-addressing table maps ID -> slot. Removal
+// moves the last slot into the hole, so slots stay dense but unordered;
+// inIdOrder() provides the ascending-ID view used for display and export.
+// Locking (see SharedLocking) decides whether status updates and the lazy
+// views are safe from several threads.
+template <typename Locking>
+class BasicFlatInventory {
+public:
+    static constexpr int NPOS = -1;
+
+private:
+    template <typename T>
+    using Flag = typename Locking::template Flag<T>;
+    using Mutex = typename Locking::Mutex;
+
+    // --- Columns (one entry per slot) ---
+    Column<int32_t> ids;
+    Column<ItemType> types;
+    Column<uint32_t> titleOffsets;
+    Column<uint32_t> titleLengths;
+    Column<uint32_t> creatorCodes;   // Author (Book) or publisher (Journal), in creatorNames
+    Column<int32_t> numbers;         // Pages (Book) or volume (Journal)
+    Column<uint64_t> borrowedBits;
+    Column<uint32_t> borrowCounts;   // Successful checkouts, for ranking
+
+    Column<char> titleHeap;
+    size_t deadTitleBytes = 0;
+    StringDictionary creatorNames;
+
+    // --- ID index: linear probing, load factor <= 1/2 ---
+    Column<int32_t> table;           // Slot number or NPOS
+    int tableShift = 64;
+
+    // --- Ascending-ID view, rebuilt lazily (readers may race to build it) ---
+    mutable vector<int> orderCache;
+    mutable Flag<bool> orderValid{true};
+    mutable Flag<bool> orderIsIdentity{false}; // Snapshot slots are already in ID order
+    mutable Mutex orderMutex;
+
+    // --- Slots by title offset, for scans over the whole heap (same scheme) ---
+    mutable vector<int> heapOrderCache;
+    mutable Flag<bool> heapOrderValid{false};
+
+    unique_ptr<MappedFile> snapshot;
+
+    // --- Status changes since the snapshot / CSV on disk, by Baseline ---
+    DirtyWords dirty[2];
+
+    static size_t homeBucket(int id, int shift) {
+        // Fibonacci hashing spreads sequential IDs across the table
+        return size_t((uint64_t(uint32_t(id)) * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    static int bitsFor(size_t capacity) {
+        int bits = 4;
+        while ((size_t(1) << bits) < capacity) ++bits;
+        return bits;
+    }
+
+    size_t bucketOf(int id) const {
+        size_t mask = table.size() - 1;
+        size_t i = homeBucket(id, tableShift);
+        while (table[i] != NPOS && ids[table[i]] != id) i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        int bits = bitsFor(capacity);
+        table.assign(size_t(1) << bits, NPOS);
+        tableShift = 64 - bits;
+        for (int slot = 0; slot < int(ids.size()); ++slot) {
+            table[bucketOf(ids[slot])] = slot;
+        }
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    void unlinkBucket(size_t hole) {
+        size_t mask = table.size() - 1;
+        size_t next = hole;
+        while (true) {
+            next = (next + 1) & mask;
+            if (table[next] == NPOS) break;
+            size_t home = homeBucket(ids[table[next]], tableShift);
+            bool movable = (hole <= next) ? (home <= hole || home > next)
+                                          : (home <= hole && home > next);
+            if (movable) {
+                table[hole] = table[next];
+                hole = next;
+            }
+        }
+        table[hole] = NPOS;
+    }
+
+    Flag<uint64_t>& statusWord(int slot) const { return flagAt<Locking>(borrowedBits[size_t(slot) >> 6]); }
+    Flag<uint32_t>& countWord(int slot) const { return flagAt<Locking>(borrowCounts[size_t(slot)]); }
+
+    void setBit(int slot, bool value) {
+        uint64_t mask = uint64_t(1) << (slot & 63);
+        if (value) borrowedBits[slot >> 6] |= mask;
+        else borrowedBits[slot >> 6] &= ~mask;
+    }
+
+    void compactTitles() {
+        vector<char> heap;
+        heap.reserve(titleHeap.size() - deadTitleBytes);
+        for (size_t slot = 0; slot < ids.size(); ++slot) {
+            uint32_t offset = uint32_t(heap.size());
+            const char* text = titleHeap.data() + titleOffsets[slot];
+            heap.insert(heap.end(), text, text + titleLengths[slot]);
+            titleOffsets[slot] = offset;
+        }
+        titleHeap.replace(heap);
+        deadTitleBytes = 0;
+        heapOrderValid = false;
+    }
+
+    // Slots sorted by title offset; live titles never overlap, and an
+    // empty one sorts before a title starting at the same offset
+    const vector<int>& inHeapOrder() const {
+        if (heapOrderValid.load(memory_order_acquire)) return heapOrderCache;
+        lock_guard<Mutex> guard(orderMutex);
+        if (!heapOrderValid) {
+            heapOrderCache.resize(ids.size());
+            for (size_t i = 0; i < heapOrderCache.size(); ++i) heapOrderCache[i] = int(i);
+            sort(heapOrderCache.begin(), heapOrderCache.end(), [this](int a, int b) {
+                return titleOffsets[a] != titleOffsets[b] ? titleOffsets[a] < titleOffsets[b]
+                                                          : titleLengths[a] < titleLengths[b];
+            });
+            heapOrderValid.store(true, memory_order_release);
+        }
+        return heapOrderCache;
+    }
+
+public:
+    BasicFlatInventory() { rehash(16); }
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.size() == 0; }
+
+    // Pre-sizes every column so a bulk load does one allocation per column
+    void reserve(size_t items, size_t titleBytes) {
+        ids.reserve(items);
+        types.reserve(items);
+        titleOffsets.reserve(items);
+        titleLengths.reserve(items);
+        creatorCodes.reserve(items);
+        numbers.reserve(items);
+        borrowedBits.reserve(items / 64 + 1);
+        borrowCounts.reserve(items);
+        titleHeap.reserve(titleBytes);
+        if (items * 2 > table.size()) rehash(items * 2);
+    }
+
+    int find(int id) const {
+        return table[bucketOf(id)];
+    }
+
+    // Caller guarantees the ID is not present yet
+    int insert(ItemType type, int id, string_view title, string_view creator, int number, bool borrowed) {
+        if ((ids.size() + 1) * 2 > table.size()) rehash(table.size() * 2);
+        for (DirtyWords& changes : dirty) changes.invalidate();
+        int slot = int(ids.size());
+        if (orderIsIdentity) inIdOrder(); // Stores the identity order (no sort) so it can be extended
+        if (orderValid && !orderCache.empty() && ids[orderCache.back()] > id) orderValid = false;
+        if (orderValid) orderCache.push_back(slot);
+        if (heapOrderValid) heapOrderCache.push_back(slot); // The title goes to the end of the heap
+
+        ids.push_back(id);
+        types.push_back(type);
+        titleOffsets.push_back(uint32_t(titleHeap.size()));
+        titleLengths.push_back(uint32_t(title.size()));
+        titleHeap.append(title.data(), title.size());
+        creatorCodes.push_back(creatorNames.intern(creator));
+        numbers.push_back(number);
+        borrowCounts.push_back(0);
+        if ((slot & 63) == 0) borrowedBits.push_back(0);
+        setBit(slot, borrowed);
+
+        table[bucketOf(id)] = slot;
+        return slot;
+    }
+
+    void erase(int slot) {
+        for (DirtyWords& changes : dirty) changes.invalidate();
+        unlinkBucket(bucketOf(ids[slot]));
+        deadTitleBytes += titleLengths[slot];
+
+        int last = int(ids.size()) - 1;
+        if (slot != last) {
+            ids[slot] = ids[last];
+            types[slot] = types[last];
+            titleOffsets[slot] = titleOffsets[last];
+            titleLengths[slot] = titleLengths[last];
+            creatorCodes[slot] = creatorCodes[last];
+            numbers[slot] = numbers[last];
+            borrowCounts[slot] = borrowCounts[last];
+            setBit(slot, isBorrowed(last));
+            table[bucketOf(ids[slot])] = slot;
+        }
+        ids.pop_back();
+        types.pop_back();
+        titleOffsets.pop_back();
+        titleLengths.pop_back();
+        creatorCodes.pop_back();
+        numbers.pop_back();
+        borrowCounts.pop_back();
+        if ((last & 63) == 0) borrowedBits.pop_back();
+        else setBit(last, false);
+        orderValid = false;
+        orderIsIdentity = false;
+        heapOrderValid = false;
+
+        if (deadTitleBytes > titleHeap.size() / 2) compactTitles();
+    }
+
+    // --- Column accessors ---
+    int id(int slot) const { return ids[slot]; }
+    ItemType type(int slot) const { return types[slot]; }
+    string_view title(int slot) const {
+        return string_view(titleHeap.data() + titleOffsets[slot], titleLengths[slot]);
+    }
+    string_view creator(int slot) const {
+        return creatorNames.view(creatorCodes[slot]);
+    }
+    uint32_t creatorCode(int slot) const { return creatorCodes[slot]; }
+    const StringDictionary& creators() const { return creatorNames; }
+    int number(int slot) const { return numbers[slot]; }
+    uint32_t borrowCount(int slot) const { return countWord(slot).load(memory_order_relaxed); }
+
+    // Status bits are read and written atomically (when Locking is
+    // THREADED), so borrow/return on different items can proceed while
+    // other threads read the column.
+    // Structural changes (insert/erase) still need exclusive access.
+    bool isBorrowed(int slot) const {
+        return (statusWord(slot).load(memory_order_relaxed) >> (slot & 63)) & 1;
+    }
+    // Borrowed flags of slots 64*word .. 64*word+63, one per bit
+    uint64_t statusBits(size_t word) const {
+        return word < borrowedBits.size() ? statusWord(int(word << 6)).load(memory_order_relaxed) : 0;
+    }
+    size_t borrowedCount() const {
+        size_t count = 0;
+        for (size_t w = 0; w < borrowedBits.size(); ++w) count += size_t(popcount64(statusBits(w)));
+        return count;
+    }
+    void setBorrowed(int slot, bool value) {
+        uint64_t mask = uint64_t(1) << (slot & 63);
+        if (value) statusWord(slot).fetch_or(mask, memory_order_relaxed);
+        else statusWord(slot).fetch_and(~mask, memory_order_relaxed);
+        markDirty(slot);
+    }
+    // Moves the bit to value only if it currently holds the opposite, as a
+    // single atomic read-modify-write; false means it was already there.
+    // A successful checkout also bumps the item's borrow count.
+    bool trySetBorrowed(int slot, bool value) {
+        uint64_t mask = uint64_t(1) << (slot & 63);
+        uint64_t before = value ? statusWord(slot).fetch_or(mask, memory_order_acq_rel)
+                                : statusWord(slot).fetch_and(~mask, memory_order_acq_rel);
+        if (bool(before & mask) == value) return false;
+        if (value) countWord(slot).fetch_add(1, memory_order_relaxed);
+        markDirty(slot);
+        return true;
+    }
+
+    void markDirty(int slot) {
+        for (DirtyWords& changes : dirty) changes.template mark<Locking>(size_t(slot) >> 6);
+    }
+
+    // Call once the baseline file matches the current contents
+    void resetBaseline(Baseline baseline) { dirty[size_t(baseline)].reset(borrowedBits.size()); }
+
+    // The caller keeps borrow/return out while this copies
+    StatusCut cutStatus(bool withCounts) const {
+        StatusCut cut;
+        cut.bits.assign(borrowedBits.data(), borrowedBits.data() + borrowedBits.size());
+        if (withCounts) cut.counts.assign(borrowCounts.data(), borrowCounts.data() + borrowCounts.size());
+        return cut;
+    }
+
+    // For a save of cut: moves the status words marked since the baseline
+    // file into it (stale once items were added or removed) and restarts
+    // the tracker, so changes after the cut stay marked for the next
+    // save. Same exclusion as cutStatus.
+    void takeChanges(StatusCut& cut, Baseline baseline) {
+        cut.changes[size_t(baseline)] = move(dirty[size_t(baseline)]);
+        resetBaseline(baseline);
+    }
+
+    // Puts taken changes back: after a failed save, or after a status
+    // delta, which leaves the snapshot baseline where it was. Same
+    // exclusion as cutStatus.
+    void restoreChanges(const StatusCut& cut, Baseline baseline) {
+        dirty[size_t(baseline)].merge(cut.changesSince(baseline));
+    }
+
+    // Position of a slot in ID order, which is where snapshots and CSV
+    // exports put it
+    size_t positionOf(int slot) const {
+        if (orderIsIdentity.load(memory_order_acquire)) return size_t(slot);
+        const vector<int>& order = inIdOrder();
+        return size_t(lower_bound(order.begin(), order.end(), ids[slot],
+                                  [this](int s, int id) { return ids[s] < id; }) - order.begin());
+    }
+
+    size_t titleBytes() const { return titleHeap.size(); }
+
+    // Heap bytes held by the columns, the ID table and the cached orders
+    size_t memoryBytes() const {
+        return ids.memoryBytes() + types.memoryBytes() + titleOffsets.memoryBytes() + titleLengths.memoryBytes() +
+               creatorCodes.memoryBytes() + numbers.memoryBytes() +
+               borrowedBits.memoryBytes() + borrowCounts.memoryBytes() + titleHeap.memoryBytes() +
+               creatorNames.memoryBytes() + table.memoryBytes() +
+               (orderCache.capacity() + heapOrderCache.capacity()) * sizeof(int);
+    }
+
+    // Calls visit(slot) for every title containing the scanner's needle.
+    // The heap is searched as one buffer, so the kernel runs over long
+    // stretches instead of title by title; a hit that lies in dead bytes
+    // or runs past the end of its title is skipped. Slots arrive in heap
+    // order, each at most once. [first, last) selects a range of
+    // inHeapOrder(), which is how parallel scans split the work.
+    template <typename Visit>
+    void scanTitles(const SubstringScanner& scanner, size_t first, size_t last, Visit&& visit) const {
+        const vector<int>& order = inHeapOrder();
+        last = min(last, order.size());
+        if (first >= last) return;
+        if (scanner.size() == 0) {
+            for (size_t i = first; i < last; ++i) visit(order[i]);
+            return;
+        }
+        const char* heap = titleHeap.data();
+        size_t pos = titleOffsets[order[first]];
+        size_t heapEnd = size_t(titleOffsets[order[last - 1]]) + titleLengths[order[last - 1]];
+        size_t owner = first; // Index into order of the last title starting at or before pos
+        while (pos < heapEnd) {
+            const char* hit = scanner.find(heap + pos, heapEnd - pos);
+            if (!hit) break;
+            size_t at = size_t(hit - heap);
+            while (owner + 1 < last && titleOffsets[order[owner + 1]] <= at) ++owner;
+            int slot = order[owner];
+            size_t end = size_t(titleOffsets[slot]) + titleLengths[slot];
+            if (titleOffsets[slot] <= at && at + scanner.size() <= end) {
+                visit(slot);
+                pos = end; // One report per title
+            } else {
+                pos = at + 1;
+            }
+        }
+    }
+
+    template <typename Visit>
+    void scanTitles(const SubstringScanner& scanner, Visit&& visit) const {
+        scanTitles(scanner, 0, size(), visit);
+    }
+
+    // Slots sorted by ascending ID (identity after an in-order load).
+    // Safe to call from concurrent readers.
+    const vector<int>& inIdOrder() const {
+        if (orderValid.load(memory_order_acquire) && !orderIsIdentity.load(memory_order_acquire)) {
+            return orderCache;
+        }
+        lock_guard<Mutex> guard(orderMutex);
+        if (orderIsIdentity) {
+            orderCache.resize(ids.size());
+            for (size_t i = 0; i < orderCache.size(); ++i) orderCache[i] = int(i);
+            orderIsIdentity = false;
+        }
+        if (!orderValid) {
+            orderCache.resize(ids.size());
+            for (size_t i = 0; i < orderCache.size(); ++i) orderCache[i] = int(i);
+            sort(orderCache.begin(), orderCache.end(),
+                 [this](int a, int b) { return ids[a] < ids[b]; });
+            orderValid = true;
+        }
+        return orderCache;
+    }
+
+    // --- Binary snapshot ---
+    // Writes the catalog with the statuses of cut (taken with counts).
+    // Writes to a temporary file and renames it over the target, so a
+    // snapshot that is currently mapped stays intact until replaced; sync
+    // as for replaceFile. resume is stored for attachSnapshot.
+    bool writeSnapshot(const string& path, uint64_t generation, const StatusCut& cut, const JournalResume& resume,
+                       bool sync) const {
+        const vector<int>& order = inIdOrder();
+        size_t n = order.size();
+
+        SnapshotHeader header{};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.itemCount = n;
+        header.generation = generation;
+        int bits = bitsFor(n * 2);
+        header.tableSize = uint64_t(1) << bits;
+        header.creatorBytes = creatorNames.byteSize();
+        header.creatorCodes = creatorNames.size();
+        for (int slot : order) header.titleBytes += titleLengths[slot];
+        SnapshotLayout layout(header);
+
+        string tmpPath = path + ".tmp";
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out) return false;
+
+        // Everything but the checksum itself is checksummed as it is written
+        SnapshotChecksum checksum;
+        auto put = [&](const void* data, size_t bytes) {
+            out.write(static_cast<const char*>(data), streamsize(bytes));
+            checksum.update(data, bytes);
+        };
+        auto writeAt = [&](size_t offset, const void* data, size_t bytes) {
+            static const char zeros[8] = {};
+            size_t pos = size_t(out.tellp());
+            if (offset > pos) put(zeros, offset - pos);
+            put(data, bytes);
+        };
+        // Gathers one column in ID order and writes it as a section
+        auto writeColumn = [&](size_t offset, auto valueOf) {
+            using T = decltype(valueOf(0));
+            vector<T> values;
+            values.reserve(n);
+            for (int slot : order) values.push_back(valueOf(slot));
+            writeAt(offset, values.data(), values.size() * sizeof(T));
+        };
+
+        put(&header, sizeof(header));
+        SnapshotChecks checks{};
+        checks.journalGeneration = resume.generation;
+        checks.journalOffset = resume.offset;
+        out.write(reinterpret_cast<const char*>(&checks), sizeof(checks.checksum)); // Filled in below
+        put(&checks.journalGeneration, sizeof(checks) - sizeof(checks.checksum));
+        writeColumn(layout.ids, [this](int s) { return ids[s]; });
+        writeColumn(layout.types, [this](int s) { return types[s]; });
+
+        vector<uint64_t> bitsOut((n + 63) / 64, 0);
+        for (size_t i = 0; i < n; ++i) {
+            if (cut.borrowed(order[i])) bitsOut[i >> 6] |= uint64_t(1) << (i & 63);
+        }
+        writeAt(layout.borrowed, bitsOut.data(), bitsOut.size() * sizeof(uint64_t));
+
+        uint32_t titleCursor = 0;
+        writeColumn(layout.titleOffsets, [&](int s) {
+            uint32_t offset = titleCursor;
+            titleCursor += titleLengths[s];
+            return offset;
+        });
+        writeColumn(layout.titleLengths, [this](int s) { return titleLengths[s]; });
+        writeColumn(layout.creatorCodes, [this](int s) { return creatorCodes[s]; });
+        writeColumn(layout.numbers, [this](int s) { return numbers[s]; });
+
+        // Prebuilt ID table for the new slot numbering
+        vector<int32_t> tableOut(size_t(header.tableSize), NPOS);
+        size_t mask = tableOut.size() - 1;
+        for (size_t i = 0; i < n; ++i) {
+            size_t b = homeBucket(ids[order[i]], 64 - bits);
+            while (tableOut[b] != NPOS) b = (b + 1) & mask;
+            tableOut[b] = int32_t(i);
+        }
+        writeAt(layout.table, tableOut.data(), tableOut.size() * sizeof(int32_t));
+
+        writeAt(layout.titles, nullptr, 0);
+        for (int slot : order) put(titleHeap.data() + titleOffsets[slot], titleLengths[slot]);
+        writeAt(layout.creators, creatorNames.bytes(), creatorNames.byteSize());
+        writeColumn(layout.borrowCounts, [&cut](int s) { return cut.count(s); });
+        writeAt(layout.creatorSpans, creatorNames.spanData(), creatorNames.size() * sizeof(uint64_t));
+        checks.checksum = checksum.digest();
+        out.seekp(streamoff(sizeof(header)));
+        out.write(reinterpret_cast<const char*>(&checks.checksum), sizeof(checks.checksum));
+
+        out.close();
+        if (!out) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return replaceFile(tmpPath, path, sync);
+    }
+
+    // Worth writing instead of a full snapshot: slots still match the
+    // snapshot and at most 1/8 of the status words changed since
+    bool statusDeltaFits(const StatusCut& cut) const {
+        const DirtyWords& changes = cut.changesSince(Baseline::Snapshot);
+        return !changes.isStale() && changes.count() * 8 <= borrowedBits.size();
+    }
+
+    // Every status change from the snapshot to cut, in one file written
+    // beside it (same temporary-and-rename scheme, resume as for
+    // writeSnapshot)
+    bool writeStatusDelta(const string& path, uint64_t baseGeneration, uint64_t generation,
+                          const StatusCut& cut, const JournalResume& resume, bool sync) const {
+        const DirtyWords& changes = cut.changesSince(Baseline::Snapshot);
+        vector<uint32_t> entries;
+        entries.reserve(changes.count() * 128);
+        changes.forEach([&](size_t word) {
+            size_t last = min(ids.size(), (word + 1) * 64);
+            for (size_t slot = word * 64; slot < last; ++slot) {
+                entries.push_back(uint32_t(positionOf(int(slot))));
+                uint32_t count = min<uint32_t>(cut.count(int(slot)), 0x7FFFFFFF);
+                entries.push_back(count | (cut.borrowed(int(slot)) ? 0x80000000u : 0u));
+            }
+        });
+
+        StatusDeltaHeader header{};
+        memcpy(header.magic, STATUS_DELTA_MAGIC, sizeof(header.magic));
+        header.version = STATUS_DELTA_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.baseGeneration = baseGeneration;
+        header.generation = generation;
+        header.itemCount = ids.size();
+        header.entryCount = entries.size() / 2;
+        header.journalGeneration = resume.generation;
+        header.journalOffset = resume.offset;
+        header.checksum = fnv1a(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint32_t),
+                                fnv1a(reinterpret_cast<const char*>(&header.journalGeneration), 16));
+
+        string tmpPath = path + ".tmp";
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), streamsize(entries.size() * sizeof(uint32_t)));
+        out.close();
+        if (!out) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return replaceFile(tmpPath, path, sync);
+    }
+
+    // Right after attachSnapshot: applies a delta written against that
+    // snapshot. Returns false (changing nothing) if there is none, it is
+    // damaged or it belongs to another snapshot; otherwise sets generation
+    // and resume (left empty by version 1 files).
+    bool applyStatusDelta(const string& path, uint64_t baseGeneration, uint64_t& generation, JournalResume& resume) {
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        StatusDeltaHeader header{};
+        if (data.size() < STATUS_DELTA_V1_HEADER_SIZE) return false;
+        memcpy(&header, data.data(), STATUS_DELTA_V1_HEADER_SIZE);
+        size_t headerBytes = header.version >= 2 ? sizeof(header) : STATUS_DELTA_V1_HEADER_SIZE;
+        if (data.size() < headerBytes) return false;
+        memcpy(&header, data.data(), headerBytes);
+        const char* body = data.data() + headerBytes;
+        size_t bodyBytes = data.size() - headerBytes;
+        uint32_t sum = header.version >= 2 ? fnv1a(reinterpret_cast<const char*>(&header.journalGeneration), 16)
+                                           : fnv1a(nullptr, 0);
+        if (memcmp(header.magic, STATUS_DELTA_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version < 1 || header.version > STATUS_DELTA_VERSION || header.byteOrder != SNAPSHOT_BYTE_ORDER ||
+            header.baseGeneration != baseGeneration || header.itemCount != ids.size() ||
+            bodyBytes != header.entryCount * 2 * sizeof(uint32_t) || fnv1a(body, bodyBytes, sum) != header.checksum) {
+            return false;
+        }
+        for (size_t i = 0; i < size_t(header.entryCount); ++i) {
+            uint32_t entry[2];
+            memcpy(entry, body + i * sizeof(entry), sizeof(entry));
+            if (entry[0] >= ids.size()) return false;
+        }
+        // The delta now differs from the snapshot file, so its words stay dirty
+        for (size_t i = 0; i < size_t(header.entryCount); ++i) {
+            uint32_t entry[2];
+            memcpy(entry, body + i * sizeof(entry), sizeof(entry));
+            int slot = int(entry[0]); // Freshly attached: slot == position
+            setBit(slot, (entry[1] >> 31) != 0);
+            borrowCounts[size_t(slot)] = entry[1] & 0x7FFFFFFF;
+            markDirty(slot);
+        }
+        generation = header.generation;
+        resume = {header.journalGeneration, header.journalOffset};
+        return true;
+    }
+
+    // Sections are 8-byte aligned in the mapping, so they are read in place
+    template <typename T>
+    static const T* sectionAt(const char* base, size_t offset) {
+        return reinterpret_cast<const T*>(base + offset);
+    }
+
+    // Checks a snapshot of layout.total bytes at base: its checksum (from
+    // version 4 on), and that every reference stays inside its section
+    static bool sectionsValid(const char* base, const SnapshotHeader& header, const SnapshotLayout& layout) {
+        if (header.version >= 4) {
+            SnapshotChecks checks;
+            memcpy(&checks, base + sizeof(SnapshotHeader), sizeof(checks));
+            SnapshotChecksum checksum;
+            checksum.update(base, sizeof(SnapshotHeader));
+            checksum.update(base + sizeof(SnapshotHeader) + sizeof(checks.checksum),
+                            sizeof(checks) - sizeof(checks.checksum));
+            checksum.update(base + layout.ids, layout.total - layout.ids);
+            if (checksum.digest() != checks.checksum) return false;
+        }
+        size_t n = size_t(header.itemCount);
+        const uint8_t* types = sectionAt<uint8_t>(base, layout.types);
+        const uint32_t* titleOffsets = sectionAt<uint32_t>(base, layout.titleOffsets);
+        const uint32_t* titleLengths = sectionAt<uint32_t>(base, layout.titleLengths);
+        const uint32_t* creatorRefs = sectionAt<uint32_t>(base, layout.creatorCodes);
+        for (size_t i = 0; i < n; ++i) {
+            if (types[i] > uint8_t(ItemType::Journal)) return false;
+            if (uint64_t(titleOffsets[i]) + titleLengths[i] > header.titleBytes) return false;
+        }
+        if (header.version >= 3) {
+            for (size_t i = 0; i < n; ++i) {
+                if (creatorRefs[i] >= header.creatorCodes) return false;
+            }
+            const uint64_t* spans = sectionAt<uint64_t>(base, layout.creatorSpans);
+            if (spans[0] != 0) return false; // Code 0 is the empty string
+            for (size_t code = 1; code < size_t(header.creatorCodes); ++code) {
+                if ((spans[code] >> 32) + uint32_t(spans[code]) > header.creatorBytes) return false;
+            }
+        } else {
+            const uint32_t* creatorLengths = sectionAt<uint32_t>(base, layout.creatorLengths);
+            for (size_t i = 0; i < n; ++i) {
+                if (uint64_t(creatorRefs[i]) + creatorLengths[i] > header.creatorBytes) return false;
+            }
+        }
+        // Each slot exactly once: the empty entries left over end every probe
+        const int32_t* table = sectionAt<int32_t>(base, layout.table);
+        vector<bool> seen(n, false);
+        size_t used = 0;
+        for (size_t b = 0; b < size_t(header.tableSize); ++b) {
+            if (table[b] == NPOS) continue;
+            if (table[b] < 0 || size_t(table[b]) >= n || seen[size_t(table[b])]) return false;
+            seen[size_t(table[b])] = true;
+            ++used;
+        }
+        return used == n;
+    }
+
+    // Replaces the current contents with a mapped snapshot. Nothing is
+    // decoded: once sectionsValid has read it through, the columns point
+    // straight into the mapping. generation and resume receive the
+    // snapshot's tag and JournalResume (empty before version 4).
+    bool attachSnapshot(const string& path, uint64_t& generation, JournalResume& resume) {
+        auto file = make_unique<MappedFile>();
+        if (!file->open(path) || file->size() < sizeof(SnapshotHeader)) return false;
+
+        SnapshotHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version < 1 || header.version > SNAPSHOT_VERSION || header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            return false;
+        }
+        if (header.itemCount > file->size() || header.tableSize > file->size()) return false;
+        if (header.version >= 3 && (header.creatorCodes == 0 || header.creatorCodes > file->size())) return false;
+        int bits = bitsFor(size_t(header.tableSize));
+        if ((uint64_t(1) << bits) != header.tableSize || header.tableSize < header.itemCount * 2) {
+            return false;
+        }
+        SnapshotLayout layout(header);
+        if (layout.total > file->size() || !sectionsValid(file->data(), header, layout)) return false;
+
+        char* base = file->data();
+        size_t n = size_t(header.itemCount);
+        auto at = [base](size_t offset) { return base + offset; };
+        ids.attach(reinterpret_cast<int32_t*>(at(layout.ids)), n);
+        types.attach(reinterpret_cast<ItemType*>(at(layout.types)), n);
+        borrowedBits.attach(reinterpret_cast<uint64_t*>(at(layout.borrowed)), (n + 63) / 64);
+        titleOffsets.attach(reinterpret_cast<uint32_t*>(at(layout.titleOffsets)), n);
+        titleLengths.attach(reinterpret_cast<uint32_t*>(at(layout.titleLengths)), n);
+        numbers.attach(reinterpret_cast<int32_t*>(at(layout.numbers)), n);
+        table.attach(reinterpret_cast<int32_t*>(at(layout.table)), size_t(header.tableSize));
+        tableShift = 64 - bits;
+        titleHeap.attach(at(layout.titles), size_t(header.titleBytes));
+        if (header.version >= 3) {
+            creatorNames.attach(at(layout.creators), size_t(header.creatorBytes),
+                                reinterpret_cast<uint64_t*>(at(layout.creatorSpans)), size_t(header.creatorCodes));
+            creatorCodes.attach(reinterpret_cast<uint32_t*>(at(layout.creatorCodes)), n);
+        } else {
+            creatorNames.attach(at(layout.creators), size_t(header.creatorBytes), nullptr, 0);
+            const uint32_t* offsets = reinterpret_cast<const uint32_t*>(at(layout.creatorCodes));
+            const uint32_t* lengths = reinterpret_cast<const uint32_t*>(at(layout.creatorLengths));
+            vector<uint32_t> codes(n);
+            for (size_t i = 0; i < n; ++i) codes[i] = creatorNames.adopt(offsets[i], lengths[i]);
+            creatorCodes.replace(codes);
+        }
+        if (header.version >= 2) borrowCounts.attach(reinterpret_cast<uint32_t*>(at(layout.borrowCounts)), n);
+        else borrowCounts.assign(n, 0);
+        deadTitleBytes = 0;
+
+        vector<int>().swap(orderCache);
+        orderValid = true;
+        orderIsIdentity = true;
+        heapOrderValid = false;
+        snapshot = move(file);
+        resetBaseline(Baseline::Snapshot);
+        dirty[size_t(Baseline::Csv)].invalidate();
+        generation = header.generation;
+        resume = JournalResume{};
+        if (header.version >= 4) {
+            SnapshotChecks checks;
+            memcpy(&checks, base + sizeof(SnapshotHeader), sizeof(checks));
+            resume = {checks.journalGeneration, checks.journalOffset};
+        }
+        return true;
+    }
+};
+
+using FlatInventory = BasicFlatInventory<SharedLocking>;
+
+// ==========================================
+// 6. Autocomplete Index (Ranked Prefix Search)
+// ==========================================
+// Every word start of every title and author/publisher is a key: the
+// lowercased rest of the field from that word on, so "lord of" matches
+// "The Lord of the Rings" at its second word. Keys are kept sorted (a
+// flattened trie: one prefix is one contiguous range found by binary
+// search) and point into one NUL-separated heap of lowercased fields.
+//
+// Ranking: a key at the very start of its field beats a later word;
+// then more borrows, then lower ID. Per-key scores are fixed when the
+// index is built, and a max-tree over blocks of keys yields the best
+// blocks of a range first, so a query reads about K blocks however many
+// keys share the prefix. Items added since the build sit in a small
+// unsorted tail that is scanned per query; removed IDs are masked until
+// the next rebuild.
+class SuggestIndex {
+private:
+    static constexpr size_t BLOCK = 32;
+    static constexpr uint32_t LEADING = 1u << 31; // Score flag: key starts its field
+
+    struct Key {
+        uint32_t offset; // Into text; runs to the next NUL
+        int32_t id;
+    };
+
+    string text;                     // Lowercased fields, each followed by NUL
+    vector<Key> keys;                // Sorted by key string
+    vector<uint32_t> scores;         // Parallel to keys, fixed at build
+    vector<uint32_t> tree;           // Max score per block range (heap layout)
+    size_t leaves = 0;               // Tree leaf count (power of two)
+    vector<Key> tail;                // Unsorted keys added since the build
+    unordered_set<int> removedSinceBuild;
+
+    static bool isWordChar(char c) { return isalnum(static_cast<unsigned char>(c)) != 0; }
+
+    string_view keyText(const Key& key) const {
+        return string_view(text.data() + key.offset);
+    }
+
+    bool leading(const Key& key) const { return key.offset == 0 || text[key.offset - 1] == '\0'; }
+
+    uint32_t scoreOf(const Key& key, uint32_t borrows) const {
+        return (leading(key) ? LEADING : 0) | min(borrows, LEADING - 1);
+    }
+
+    // Appends one lowercased field and a key per word start
+    void addField(string_view field, int id, vector<Key>& out) {
+        if (field.empty()) return;
+        uint32_t start = uint32_t(text.size());
+        for (char c : field) text += char(tolower(static_cast<unsigned char>(c)));
+        text += '\0';
+        for (size_t i = 0; i < field.size(); ++i) {
+            if (isWordChar(field[i]) && (i == 0 || !isWordChar(field[i - 1]))) {
+                out.push_back({start + uint32_t(i), id});
+            }
+        }
+    }
+
+    bool masked(int id) const {
+        return !removedSinceBuild.empty() && removedSinceBuild.count(id) != 0;
+    }
+
+    // First block in [lo, hi) holding the range maximum
+    size_t argmaxBlock(size_t lo, size_t hi) const {
+        size_t bestNode = 0;
+        auto consider = [&](size_t node) {
+            if (bestNode == 0 || tree[node] > tree[bestNode]) bestNode = node;
+        };
+        for (size_t l = lo + leaves, r = hi + leaves; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) consider(l++);
+            if (r & 1) consider(--r);
+        }
+        while (bestNode < leaves) {
+            bestNode = tree[2 * bestNode] == tree[bestNode] ? 2 * bestNode : 2 * bestNode + 1;
+        }
+        return bestNode - leaves;
+    }
+
+public:
+    // Builds from every slot; borrow counts are sampled now for ranking
+    template <typename Inventory>
+    void build(const Inventory& inventory) {
+        clear();
+        vector<Key> all;
+        all.reserve(inventory.size() * 6);
+        for (int slot = 0; slot < int(inventory.size()); ++slot) {
+            addField(inventory.title(slot), inventory.id(slot), all);
+            addField(inventory.creator(slot), inventory.id(slot), all);
+        }
+        sort(all.begin(), all.end(), [this](const Key& a, const Key& b) {
+            int order = strcmp(text.data() + a.offset, text.data() + b.offset);
+            return order != 0 ? order < 0 : a.id < b.id;
+        });
+        keys = move(all);
+
+        scores.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            scores[i] = scoreOf(keys[i], inventory.borrowCount(inventory.find(keys[i].id)));
+        }
+        size_t blocks = (keys.size() + BLOCK - 1) / BLOCK;
+        leaves = 1;
+        while (leaves < max<size_t>(blocks, 1)) leaves <<= 1;
+        tree.assign(2 * leaves, 0);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            uint32_t& leaf = tree[leaves + i / BLOCK];
+            leaf = max(leaf, scores[i]);
+        }
+        for (size_t node = leaves - 1; node >= 1; --node) tree[node] = max(tree[2 * node], tree[2 * node + 1]);
+    }
+
+    void clear() {
+        string().swap(text);
+        vector<Key>().swap(keys);
+        vector<uint32_t>().swap(scores);
+        vector<uint32_t>().swap(tree);
+        leaves = 0;
+        tail.clear();
+        removedSinceBuild.clear();
+    }
+
+    size_t memoryBytes() const {
+        return text.capacity() + (keys.capacity() + tail.capacity()) * sizeof(Key) +
+               (scores.capacity() + tree.capacity()) * sizeof(uint32_t) +
+               removedSinceBuild.bucket_count() * sizeof(void*) + removedSinceBuild.size() * 2 * sizeof(void*);
+    }
+
+    void add(int id, string_view title, string_view creator) {
+        addField(title, id, tail);
+        addField(creator, id, tail);
+    }
+
+    void remove(int id) {
+        removedSinceBuild.insert(id);
+        tail.erase(std::remove_if(tail.begin(), tail.end(), [id](const Key& key) { return key.id == id; }),
+                   tail.end());
+    }
+
+    // Rebuild once the unsorted tail or the masked set outgrows 1/16 of
+    // the catalog (at least a few thousand), keeping per-query work bounded
+    bool wantsRebuild() const {
+        size_t limit = max<size_t>(4096, keys.size() / 16);
+        return tail.size() > limit || removedSinceBuild.size() > limit;
+    }
+
+    // IDs of the best k distinct items for prefix, best first
+    template <typename Inventory>
+    vector<int> query(string_view prefix, size_t k, const Inventory& inventory) const {
+        string needle;
+        for (char c : prefix) needle += char(tolower(static_cast<unsigned char>(c)));
+        while (!needle.empty() && !isWordChar(needle.front())) needle.erase(needle.begin());
+        if (needle.empty() || k == 0) return {};
+
+        // Best-so-far, distinct by ID, sorted best first
+        vector<pair<uint32_t, int>> best;
+        auto better = [](const pair<uint32_t, int>& a, const pair<uint32_t, int>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        };
+        auto offer = [&](uint32_t score, int id) {
+            for (auto& entry : best) {
+                if (entry.second != id) continue;
+                if (score > entry.first) {
+                    entry.first = score;
+                    sort(best.begin(), best.end(), better);
+                }
+                return;
+            }
+            if (best.size() == k && !better({score, id}, best.back())) return;
+            best.insert(upper_bound(best.begin(), best.end(), make_pair(score, id), better), {score, id});
+            if (best.size() > k) best.pop_back();
+        };
+        auto threshold = [&]() { return best.size() < k ? 0u : best.back().first; };
+        auto matches = [&](const Key& key) {
+            return keyText(key).compare(0, needle.size(), needle) == 0;
+        };
+
+        // Sorted range of matching keys
+        auto lo = lower_bound(keys.begin(), keys.end(), needle, [this](const Key& key, const string& value) {
+            return keyText(key).compare(0, value.size(), value) < 0;
+        });
+        auto hi = upper_bound(lo, keys.end(), needle, [this](const string& value, const Key& key) {
+            return keyText(key).compare(0, value.size(), value) > 0;
+        });
+        size_t first = size_t(lo - keys.begin()), last = size_t(hi - keys.begin());
+        auto scanKeys = [&](size_t from, size_t to) {
+            for (size_t i = max(from, first); i < min(to, last); ++i) {
+                if (!masked(keys[i].id)) offer(scores[i], keys[i].id);
+            }
+        };
+
+        if (first < last) {
+            // Best-first over whole blocks via the max-tree; partial blocks
+            // at either end are scanned directly
+            size_t firstBlock = (first + BLOCK - 1) / BLOCK, lastBlock = last / BLOCK;
+            if (firstBlock >= lastBlock) {
+                scanKeys(first, last);
+            } else {
+                scanKeys(first, firstBlock * BLOCK);
+                scanKeys(lastBlock * BLOCK, last);
+                struct Range { uint32_t top; size_t lo, hi, block; };
+                auto lower = [](const Range& a, const Range& b) { return a.top < b.top; };
+                vector<Range> heap;
+                auto push = [&](size_t l, size_t h) {
+                    if (l >= h) return;
+                    size_t block = argmaxBlock(l, h);
+                    heap.push_back({tree[leaves + block], l, h, block});
+                    push_heap(heap.begin(), heap.end(), lower);
+                };
+                push(firstBlock, lastBlock);
+                while (!heap.empty()) {
+                    pop_heap(heap.begin(), heap.end(), lower);
+                    Range range = heap.back();
+                    heap.pop_back();
+                    if (range.top < threshold()) break;
+                    scanKeys(range.block * BLOCK, (range.block + 1) * BLOCK);
+                    push(range.lo, range.block);
+                    push(range.block + 1, range.hi);
+                }
+            }
+        }
+
+        for (const Key& key : tail) {
+            if (!matches(key)) continue;
+            int slot = inventory.find(key.id);
+            if (slot != Inventory::NPOS) offer(scoreOf(key, inventory.borrowCount(slot)), key.id);
+        }
+
+        vector<int> ids;
+        ids.reserve(best.size());
+        for (const auto& entry : best) ids.push_back(entry.second);
+        return ids;
+    }
+};
+
+// ==========================================
+// 7. Attribute Index (Filter Queries)
+// ==========================================
+// Answers "all books by X", "journals from Y" or "everything borrowed"
+// without a catalog scan. Every predicate is a set of inventory slots;
+// a query ORs the creator sets together and ANDs in the type and
+// borrowed bitmaps. Per-item flags are kept as compressed bitmaps, except
+// the borrowed flag: it is the inventory's own status column, a plain
+// bitmap updated with atomic operations under the shared catalog lock,
+// which a compressed set could not support. Counting it is a popcount.
+// Compressed set of slot numbers in the style of Roaring bitmaps. Values
+// are grouped by their high 16 bits; a group holding at most ARRAY_MAX
+// values is a sorted array of its low halves, a denser one a 65536-bit
+// bitmap. No group costs more than 8 KiB, sparse sets stay small, and
+// set operations and counts work a whole group at a time.
+class RoaringBitmap {
+private:
+    static constexpr size_t ARRAY_MAX = 4096; // Past this a bitmap is smaller
+    static constexpr size_t BITMAP_WORDS = 65536 / 64;
+
+    struct Container {
+        uint32_t key = 0;          // High 16 bits shared by the group
+        uint32_t cardinality = 0;
+        vector<uint16_t> values;   // Array form: sorted low halves
+        vector<uint64_t> bits;     // Bitmap form: BITMAP_WORDS words
+
+        bool isBitmap() const { return !bits.empty(); }
+
+        bool contains(uint16_t low) const {
+            if (isBitmap()) return (bits[low >> 6] >> (low & 63)) & 1;
+            return binary_search(values.begin(), values.end(), low);
+        }
+
+        template <typename Visit>
+        void forEach(Visit&& visit) const {
+            if (!isBitmap()) {
+                for (uint16_t low : values) visit(low);
+                return;
+            }
+            for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                for (uint64_t word = bits[w]; word; word &= word - 1) {
+                    visit(uint16_t((w << 6) | size_t(lowestBit(word))));
+                }
+            }
+        }
+
+        void toBitmap() {
+            bits.assign(BITMAP_WORDS, 0);
+            for (uint16_t low : values) bits[low >> 6] |= uint64_t(1) << (low & 63);
+            vector<uint16_t>().swap(values);
+        }
+
+        void toArray() {
+            values.clear();
+            values.reserve(cardinality);
+            forEach([this](uint16_t low) { values.push_back(low); });
+            vector<uint64_t>().swap(bits);
+        }
+
+        // Recounts after a bulk change and switches to the smaller form
+        void normalize() {
+            if (isBitmap()) {
+                cardinality = 0;
+                for (uint64_t word : bits) cardinality += uint32_t(popcount64(word));
+                if (cardinality <= ARRAY_MAX) toArray();
+            } else {
+                cardinality = uint32_t(values.size());
+                if (cardinality > ARRAY_MAX) toBitmap();
+            }
+        }
+
+        bool add(uint16_t low) {
+            if (isBitmap()) {
+                uint64_t mask = uint64_t(1) << (low & 63);
+                if (bits[low >> 6] & mask) return false;
+                bits[low >> 6] |= mask;
+            } else if (values.empty() || values.back() < low) {
+                values.push_back(low); // Ascending inserts are the common case
+            } else {
+                auto pos = lower_bound(values.begin(), values.end(), low);
+                if (*pos == low) return false;
+                values.insert(pos, low);
+            }
+            if (++cardinality > ARRAY_MAX && !isBitmap()) toBitmap();
+            return true;
+        }
+
+        bool remove(uint16_t low) {
+            if (isBitmap()) {
+                uint64_t mask = uint64_t(1) << (low & 63);
+                if (!(bits[low >> 6] & mask)) return false;
+                bits[low >> 6] &= ~mask;
+                // Converting back well below ARRAY_MAX keeps a group that
+                // hovers around it from switching form on every change
+                if (--cardinality <= ARRAY_MAX / 2) toArray();
+                return true;
+            }
+            auto pos = lower_bound(values.begin(), values.end(), low);
+            if (pos == values.end() || *pos != low) return false;
+            values.erase(pos);
+            --cardinality;
+            return true;
+        }
+
+        void unionWith(const Container& other) {
+            if (!isBitmap() && !other.isBitmap() && cardinality + other.cardinality <= ARRAY_MAX) {
+                vector<uint16_t> merged;
+                merged.reserve(cardinality + other.cardinality);
+                set_union(values.begin(), values.end(), other.values.begin(), other.values.end(),
+                          back_inserter(merged));
+                values.swap(merged);
+            } else {
+                if (!isBitmap()) toBitmap();
+                if (other.isBitmap()) {
+                    for (size_t w = 0; w < BITMAP_WORDS; ++w) bits[w] |= other.bits[w];
+                } else {
+                    for (uint16_t low : other.values) bits[low >> 6] |= uint64_t(1) << (low & 63);
+                }
+            }
+            normalize();
+        }
+
+        void intersectWith(const Container& other) {
+            if (isBitmap() && other.isBitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) bits[w] &= other.bits[w];
+            } else if (isBitmap()) {
+                // Only the other side's values can survive
+                vector<uint16_t> kept;
+                for (uint16_t low : other.values) {
+                    if (contains(low)) kept.push_back(low);
+                }
+                vector<uint64_t>().swap(bits);
+                values.swap(kept);
+            } else {
+                values.erase(remove_if(values.begin(), values.end(),
+                                       [&other](uint16_t low) { return !other.contains(low); }),
+                             values.end());
+            }
+            normalize();
+        }
+
+        // Keeps values whose bit in an external slot bitmap equals wanted
+        template <typename WordAt>
+        void intersectWith(WordAt& wordAt, bool wanted) {
+            size_t base = size_t(key) * BITMAP_WORDS;
+            auto external = [&](size_t w) { return wanted ? wordAt(base + w) : ~wordAt(base + w); };
+            if (isBitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) bits[w] &= external(w);
+            } else {
+                values.erase(remove_if(values.begin(), values.end(),
+                                       [&](uint16_t low) { return !((external(low >> 6) >> (low & 63)) & 1); }),
+                             values.end());
+            }
+            normalize();
+        }
+    };
+
+    vector<Container> containers; // Ascending key
+    size_t total = 0;
+
+    vector<Container>::iterator position(uint32_t key) {
+        return lower_bound(containers.begin(), containers.end(), key,
+                           [](const Container& c, uint32_t k) { return c.key < k; });
+    }
+
+    vector<Container>::const_iterator position(uint32_t key) const {
+        return lower_bound(containers.begin(), containers.end(), key,
+                           [](const Container& c, uint32_t k) { return c.key < k; });
+    }
+
+    void recount() {
+        containers.erase(remove_if(containers.begin(), containers.end(),
+                                   [](const Container& c) { return c.cardinality == 0; }),
+                         containers.end());
+        total = 0;
+        for (const Container& c : containers) total += c.cardinality;
+    }
+
+public:
+    bool add(uint32_t value) {
+        uint32_t key = value >> 16;
+        auto it = !containers.empty() && containers.back().key == key ? containers.end() - 1 : position(key);
+        if (it == containers.end() || it->key != key) {
+            it = containers.emplace(it);
+            it->key = key;
+        }
+        if (!it->add(uint16_t(value))) return false;
+        ++total;
+        return true;
+    }
+
+    bool remove(uint32_t value) {
+        auto it = position(value >> 16);
+        if (it == containers.end() || it->key != value >> 16 || !it->remove(uint16_t(value))) return false;
+        if (it->cardinality == 0) containers.erase(it);
+        --total;
+        return true;
+    }
+
+    bool contains(uint32_t value) const {
+        auto it = position(value >> 16);
+        return it != containers.end() && it->key == value >> 16 && it->contains(uint16_t(value));
+    }
+
+    size_t cardinality() const { return total; }
+    bool empty() const { return total == 0; }
+    void clear() {
+        containers.clear();
+        total = 0;
+    }
+
+    // Replaces the contents with every value below n
+    void fill(uint32_t n) {
+        clear();
+        for (uint64_t start = 0; start < n; start += 65536) {
+            Container c;
+            c.key = uint32_t(start >> 16);
+            size_t count = size_t(min<uint64_t>(n - start, 65536));
+            c.bits.assign(BITMAP_WORDS, 0);
+            for (size_t w = 0; w < count / 64; ++w) c.bits[w] = ~uint64_t(0);
+            if (count & 63) c.bits[count / 64] = (uint64_t(1) << (count & 63)) - 1;
+            c.normalize();
+            containers.push_back(move(c));
+        }
+        recount();
+    }
+
+    void unionWith(const RoaringBitmap& other) {
+        vector<Container> merged;
+        merged.reserve(containers.size() + other.containers.size());
+        auto mine = containers.begin();
+        auto theirs = other.containers.begin();
+        while (mine != containers.end() || theirs != other.containers.end()) {
+            if (theirs == other.containers.end() || (mine != containers.end() && mine->key < theirs->key)) {
+                merged.push_back(move(*mine++));
+            } else if (mine == containers.end() || theirs->key < mine->key) {
+                merged.push_back(*theirs++);
+            } else {
+                mine->unionWith(*theirs++);
+                merged.push_back(move(*mine++));
+            }
+        }
+        containers.swap(merged);
+        recount();
+    }
+
+    void intersectWith(const RoaringBitmap& other) {
+        auto theirs = other.containers.begin();
+        for (Container& c : containers) {
+            while (theirs != other.containers.end() && theirs->key < c.key) ++theirs;
+            if (theirs == other.containers.end() || theirs->key != c.key) {
+                c.cardinality = 0; // Dropped by recount()
+            } else {
+                c.intersectWith(*theirs);
+            }
+        }
+        recount();
+    }
+
+    // Keeps the values whose bit in an external slot bitmap equals wanted;
+    // wordAt(w) returns bits 64w..64w+63 of that bitmap
+    template <typename WordAt>
+    void intersectWith(WordAt wordAt, bool wanted) {
+        for (Container& c : containers) c.intersectWith(wordAt, wanted);
+        recount();
+    }
+
+    // Calls visit(value) in ascending order
+    template <typename Visit>
+    void forEach(Visit&& visit) const {
+        for (const Container& c : containers) {
+            uint32_t high = c.key << 16;
+            c.forEach([&](uint16_t low) { visit(high | low); });
+        }
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = containers.capacity() * sizeof(Container);
+        for (const Container& c : containers) {
+            bytes += c.values.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+};
+
+// Conditions on attributes; unset fields do not filter. Names match
+// case-insensitively; several authors or publishers mean "any of".
+struct ItemQuery {
+    optional<ItemType> type;
+    optional<bool> borrowed;
+    vector<string> authors;     // Books by any of these
+    vector<string> publishers;  // Journals from any of these
+
+    bool namesCreators() const { return !authors.empty() || !publishers.empty(); }
+};
+
+template <typename Locking>
+class BasicAttributeIndex {
+private:
+    using Inventory = BasicFlatInventory<Locking>;
+    static constexpr size_t TYPE_COUNT = 2;
+
+    RoaringBitmap typeSlots[TYPE_COUNT];
+    // Creator code (see StringDictionary) -> ascending slots, per type,
+    // and lowercased name -> the codes spelling it, so a query folds case
+    // once per name and then matches items by code alone. Built apart
+    // from the type bitmaps, by the first query naming a creator: reading
+    // every creator faults in the cold columns of a mapped snapshot,
+    // which counts and status filters never need.
+    vector<vector<int>> creatorSlots[TYPE_COUNT];
+    unordered_map<string, vector<uint32_t>> codesByName;
+    size_t namedCodes = 0; // Dictionary codes entered in codesByName
+    typename Locking::template Flag<bool> creatorsIndexed{false};
+
+    static string keyOf(string_view creator) {
+        string key(creator);
+        for (char& c : key) c = char(tolower(uint8_t(c)));
+        return key;
+    }
+
+    void nameNewCodes(const StringDictionary& names) {
+        for (; namedCodes < names.size(); ++namedCodes) {
+            codesByName[keyOf(names.view(uint32_t(namedCodes)))].push_back(uint32_t(namedCodes));
+        }
+    }
+
+    vector<int>& postingOf(ItemType type, uint32_t code) {
+        vector<vector<int>>& postings = creatorSlots[size_t(type)];
+        if (code >= postings.size()) postings.resize(size_t(code) + 1);
+        return postings[code];
+    }
+
+public:
+    // Type bitmaps only; see buildCreators
+    void build(const Inventory& inventory) {
+        clear();
+        for (int slot = 0; slot < int(inventory.size()); ++slot) {
+            typeSlots[size_t(inventory.type(slot))].add(uint32_t(slot));
+        }
+    }
+
+    // Readers check hasCreators() without a lock; builds are serialized
+    // by the caller
+    void buildCreators(const Inventory& inventory) {
+        codesByName.clear();
+        namedCodes = 0;
+        nameNewCodes(inventory.creators());
+        for (auto& postings : creatorSlots) postings.assign(inventory.creators().size(), {});
+        for (int slot = 0; slot < int(inventory.size()); ++slot) {
+            creatorSlots[size_t(inventory.type(slot))][inventory.creatorCode(slot)].push_back(slot);
+        }
+        creatorsIndexed.store(true, memory_order_release);
+    }
+
+    bool hasCreators() const { return creatorsIndexed.load(memory_order_acquire); }
+
+    void clear() {
+        for (size_t t = 0; t < TYPE_COUNT; ++t) {
+            typeSlots[t].clear();
+            vector<vector<int>>().swap(creatorSlots[t]);
+        }
+        codesByName.clear();
+        namedCodes = 0;
+        creatorsIndexed = false;
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (size_t t = 0; t < TYPE_COUNT; ++t) {
+            bytes += typeSlots[t].memoryBytes() + creatorSlots[t].capacity() * sizeof(vector<int>);
+            for (const vector<int>& slots : creatorSlots[t]) bytes += slots.capacity() * sizeof(int);
+        }
+        bytes += codesByName.bucket_count() * sizeof(void*);
+        for (const auto& entry : codesByName) {
+            bytes += sizeof(entry) + 2 * sizeof(void*) + entry.first.capacity() + entry.second.capacity() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    // Call after inventory.insert. New items always take the highest
+    // slot, so postings only append.
+    void add(int slot, const Inventory& inventory) {
+        ItemType type = inventory.type(slot);
+        typeSlots[size_t(type)].add(uint32_t(slot));
+        if (!creatorsIndexed) return;
+        nameNewCodes(inventory.creators());
+        postingOf(type, inventory.creatorCode(slot)).push_back(slot);
+    }
+
+    // Call before inventory.erase(slot): mirrors the removal and the move
+    // of the last slot into the hole
+    void erase(int slot, const Inventory& inventory) {
+        int last = int(inventory.size()) - 1;
+        ItemType type = inventory.type(slot);
+        if (creatorsIndexed) {
+            vector<int>& list = postingOf(type, inventory.creatorCode(slot));
+            auto pos = lower_bound(list.begin(), list.end(), slot);
+            if (pos != list.end() && *pos == slot) list.erase(pos);
+        }
+        typeSlots[size_t(type)].remove(uint32_t(slot));
+        if (slot == last) return;
+
+        ItemType movedType = inventory.type(last);
+        if (creatorsIndexed) {
+            vector<int>& list = postingOf(movedType, inventory.creatorCode(last));
+            list.pop_back(); // The last slot is the largest in any posting
+            list.insert(lower_bound(list.begin(), list.end(), slot), slot);
+        }
+        typeSlots[size_t(movedType)].remove(uint32_t(last));
+        typeSlots[size_t(movedType)].add(uint32_t(slot));
+    }
+
+    size_t count(ItemType type) const { return typeSlots[size_t(type)].cardinality(); }
+
+    // Queries naming a creator need buildCreators first
+    RoaringBitmap evaluate(const ItemQuery& query, const Inventory& inventory) const {
+        RoaringBitmap result;
+        bool byCreator = query.namesCreators();
+        if (!byCreator) {
+            if (query.type) result = typeSlots[size_t(*query.type)];
+            else result.fill(uint32_t(inventory.size()));
+        } else {
+            auto addCreators = [&](ItemType type, const vector<string>& names) {
+                const auto& postings = creatorSlots[size_t(type)];
+                for (const string& name : names) {
+                    auto it = codesByName.find(keyOf(name));
+                    if (it == codesByName.end()) continue;
+                    for (uint32_t code : it->second) {
+                        if (code >= postings.size() || postings[code].empty()) continue;
+                        RoaringBitmap slots; // Built by appends, then merged group-wise
+                        for (int slot : postings[code]) slots.add(uint32_t(slot));
+                        result.unionWith(slots);
+                    }
+                }
+            };
+            addCreators(ItemType::Book, query.authors);
+            addCreators(ItemType::Journal, query.publishers);
+        }
+        if (byCreator && query.type) result.intersectWith(typeSlots[size_t(*query.type)]);
+        if (query.borrowed) {
+            result.intersectWith([&](size_t w) { return inventory.statusBits(w); }, *query.borrowed);
+        }
+        return result;
+    }
+};
+
+using AttributeIndex = BasicAttributeIndex<SharedLocking>;
+
+// ==========================================
+// 8. Metrics (Latency Histograms and I/O Counters)
+// ==========================================
+// Optional instrumentation of the manager's hot paths. Each thread
+// records into its own shard with plain (uncontended) relaxed stores;
+// report() sums the shards on demand, so recording never takes a lock
+// or bounces a cache line between cores.
+//
+// Latencies go to HDR-style histograms: values below 16 ns get a bucket
+// each, and every power of two above gets 16 linear sub-buckets, so any
+// value from 1 ns to ~68 s is kept to within 1/16 of itself.
+enum class MetricOp : uint8_t { Add, Remove, Search, Suggest, Filter, Borrow, Load, Save, JournalFlush };
+constexpr size_t METRIC_OP_COUNT = 9;
+const char* const METRIC_OP_NAMES[METRIC_OP_COUNT] = {
+    "add", "remove", "search", "suggest", "filter", "borrow", "load", "save", "journal_flush"};
+
+enum class IoTarget : uint8_t { Csv, Snapshot, Journal, Pack };
+constexpr size_t IO_TARGET_COUNT = 4;
+const char* const IO_TARGET_NAMES[IO_TARGET_COUNT] = {"csv", "snapshot", "journal", "pack"};
+
+struct LatencyHistogram {
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BITS;
+    static constexpr unsigned MAX_BITS = 36; // Longer latencies land in the last bucket
+    static constexpr size_t BUCKETS = size_t(MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t sumNanos = 0;
+
+    static size_t bucketOf(uint64_t nanos) {
+        if (nanos < SUB_BUCKETS) return size_t(nanos);
+        if (nanos >> MAX_BITS) return BUCKETS - 1;
+        unsigned shift = unsigned(highestBit(nanos)) - SUB_BITS;
+        return size_t(shift + 1) * SUB_BUCKETS + size_t((nanos >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that maps to the bucket
+    static uint64_t bucketHigh(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        unsigned shift = unsigned(bucket / SUB_BUCKETS) - 1;
+        uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return low + (uint64_t(1) << shift) - 1;
+    }
+
+    // Upper bound of the value at quantile q (0..1); 0 when empty
+    uint64_t quantile(double q) const {
+        if (total == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, uint64_t(q * double(total) + 0.5));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += counts[b];
+            if (seen >= rank) return bucketHigh(b);
+        }
+        return bucketHigh(BUCKETS - 1);
+    }
+
+    uint64_t maxNanos() const {
+        for (size_t b = BUCKETS; b-- > 0;) {
+            if (counts[b]) return bucketHigh(b);
+        }
+        return 0;
+    }
+};
+
+// Merged view of every shard, plus gauges the manager fills in
+struct MetricsReport {
+    LatencyHistogram latency[METRIC_OP_COUNT];
+    uint64_t bytesRead[IO_TARGET_COUNT] = {};
+    uint64_t bytesWritten[IO_TARGET_COUNT] = {};
+    size_t items = 0;
+    size_t borrowed = 0;
+    vector<pair<const char*, size_t>> indexBytes; // Structures currently built
+};
+
+// Counters and its lock are Locking's; a SingleThreaded sink records into
+// one shard and needs no per-thread lookup.
+template <typename Locking>
+class BasicMetrics {
+private:
+    using Mutex = typename Locking::Mutex;
+    using Counter = typename Locking::template Flag<uint64_t>;
+
+    // Written only by its thread; atomics (when THREADED) so report() may
+    // read mid-update. Value-initialized (make_unique), which zeroes every
+    // counter.
+    struct Shard {
+        Counter latency[METRIC_OP_COUNT][LatencyHistogram::BUCKETS];
+        Counter latencySum[METRIC_OP_COUNT];
+        Counter bytesRead[IO_TARGET_COUNT];
+        Counter bytesWritten[IO_TARGET_COUNT];
+    };
+
+    // Tags the thread_local shard caches; a SingleThreaded sink has none
+    static uint64_t nextInstance() {
+        if constexpr (Locking::THREADED) {
+            static atomic<uint64_t> counter{0};
+            return counter.fetch_add(1) + 1;
+        } else {
+            return 0;
+        }
+    }
+
+    const uint64_t instance = nextInstance(); // Never reused, unlike addresses
+    bool enabled;
+    mutable Mutex shardsMutex;
+    unordered_map<thread::id, unique_ptr<Shard>> shards; // Kept after a thread exits
+    Shard* only = nullptr; // SingleThreaded: the one shard
+
+    static void bump(Counter& counter, uint64_t amount) {
+        counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    Shard& local() {
+        if constexpr (!Locking::THREADED) {
+            if (!only) only = (shards[thread::id()] = make_unique<Shard>()).get();
+            return *only;
+        } else {
+            struct Cache {
+                uint64_t instance = 0;
+                Shard* shard = nullptr;
+            };
+            thread_local Cache cache; // Last instance this thread recorded into
+            if (cache.instance != instance) {
+                lock_guard<Mutex> guard(shardsMutex);
+                unique_ptr<Shard>& shard = shards[this_thread::get_id()];
+                if (!shard) shard = make_unique<Shard>();
+                cache = {instance, shard.get()};
+            }
+            return *cache.shard;
+        }
+    }
+
+public:
+    explicit BasicMetrics(bool enabled) : enabled(enabled) {}
+    BasicMetrics(const BasicMetrics&) = delete;
+    BasicMetrics& operator=(const BasicMetrics&) = delete;
+
+    bool isEnabled() const { return enabled; }
+
+    void recordLatency(MetricOp op, uint64_t nanos) {
+        if (!enabled) return;
+        Shard& shard = local();
+        bump(shard.latency[size_t(op)][LatencyHistogram::bucketOf(nanos)], 1);
+        bump(shard.latencySum[size_t(op)], nanos);
+    }
+
+    void addBytesRead(IoTarget target, uint64_t bytes) {
+        if (enabled) bump(local().bytesRead[size_t(target)], bytes);
+    }
+
+    void addBytesWritten(IoTarget target, uint64_t bytes) {
+        if (enabled) bump(local().bytesWritten[size_t(target)], bytes);
+    }
+
+    MetricsReport report() const {
+        MetricsReport merged;
+        lock_guard<Mutex> guard(shardsMutex);
+        for (const auto& entry : shards) {
+            const Shard& shard = *entry.second;
+            for (size_t op = 0; op < METRIC_OP_COUNT; ++op) {
+                LatencyHistogram& histogram = merged.latency[op];
+                for (size_t b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+                    uint64_t count = shard.latency[op][b].load(memory_order_relaxed);
+                    histogram.counts[b] += count;
+                    histogram.total += count;
+                }
+                histogram.sumNanos += shard.latencySum[op].load(memory_order_relaxed);
+            }
+            for (size_t t = 0; t < IO_TARGET_COUNT; ++t) {
+                merged.bytesRead[t] += shard.bytesRead[t].load(memory_order_relaxed);
+                merged.bytesWritten[t] += shard.bytesWritten[t].load(memory_order_relaxed);
+            }
+        }
+        return merged;
+    }
+};
+
+using Metrics = BasicMetrics<SharedLocking>;
+
+// Records the lifetime of a scope as one sample; free when disabled
+template <typename Locking>
+class MetricTimer {
+private:
+    BasicMetrics<Locking>* metrics;
+    MetricOp op;
+    chrono::steady_clock::time_point start;
+
+public:
+    MetricTimer(BasicMetrics<Locking>& metrics, MetricOp op) : metrics(metrics.isEnabled() ? &metrics : nullptr), op(op) {
+        if (this->metrics) start = chrono::steady_clock::now();
+    }
+    MetricTimer(const MetricTimer&) = delete;
+    MetricTimer& operator=(const MetricTimer&) = delete;
+
+    ~MetricTimer() {
+        if (!metrics) return;
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        metrics->recordLatency(op, uint64_t(elapsed.count()));
+    }
+};
+
+// Prometheus text exposition format (version 0.0.4). Latencies are
+// summaries with quantiles taken from the histograms.
+string formatPrometheus(const MetricsReport& report) {
+    string out;
+    char number[64];
+    auto seconds = [&](uint64_t nanos) {
+        snprintf(number, sizeof(number), "%.9g", double(nanos) * 1e-9);
+        return string(number);
+    };
+    out += "# HELP library_operation_duration_seconds Latency of LibraryManager calls.\n";
+    out += "# TYPE library_operation_duration_seconds summary\n";
+    for (size_t op = 0; op < METRIC_OP_COUNT; ++op) {
+        const LatencyHistogram& histogram = report.latency[op];
+        string label = string("op=\"") + METRIC_OP_NAMES[op] + "\"";
+        for (const char* q : {"0.5", "0.9", "0.99", "0.999"}) {
+            // Prometheus reports quantiles of an empty summary as NaN
+            out += "library_operation_duration_seconds{" + label + ",quantile=\"" + q + "\"} " +
+                   (histogram.total ? seconds(histogram.quantile(strtod(q, nullptr))) : string("NaN")) + "\n";
+        }
+        out += "library_operation_duration_seconds_sum{" + label + "} " + seconds(histogram.sumNanos) + "\n";
+        out += "library_operation_duration_seconds_count{" + label + "} " + to_string(histogram.total) + "\n";
+    }
+    out += "# HELP library_read_bytes_total Bytes read from catalog files.\n";
+    out += "# TYPE library_read_bytes_total counter\n";
+    for (size_t t = 0; t < IO_TARGET_COUNT; ++t) {
+        out += string("library_read_bytes_total{file=\"") + IO_TARGET_NAMES[t] + "\"} " +
+               to_string(report.bytesRead[t]) + "\n";
+    }
+    out += "# HELP library_written_bytes_total Bytes written to catalog files.\n";
+    out += "# TYPE library_written_bytes_total counter\n";
+    for (size_t t = 0; t < IO_TARGET_COUNT; ++t) {
+        out += string("library_written_bytes_total{file=\"") + IO_TARGET_NAMES[t] + "\"} " +
+               to_string(report.bytesWritten[t]) + "\n";
+    }
+    out += "# HELP library_items Items in the catalog.\n# TYPE library_items gauge\n";
+    out += "library_items " + to_string(report.items) + "\n";
+    out += "# HELP library_borrowed_items Items currently borrowed.\n# TYPE library_borrowed_items gauge\n";
+    out += "library_borrowed_items " + to_string(report.borrowed) + "\n";
+    out += "# HELP library_index_memory_bytes Approximate heap memory per structure.\n";
+    out += "# TYPE library_index_memory_bytes gauge\n";
+    for (const auto& entry : report.indexBytes) {
+        out += string("library_index_memory_bytes{index=\"") + entry.first + "\"} " + to_string(entry.second) + "\n";
+    }
+    return out;
+}
+
+// ==========================================
+// 9. Write-Ahead Journal (Durability)
+// ==========================================
+// Every mutation is appended to library_data.wal as a compact binary
+// record, so its cost does not depend on catalog size. Records are
+// buffered and written in groups; a background thread flushes partial
+// groups and periodically folds the log into a fresh snapshot. With
+// writeBehind set, only that thread ever writes: appends just queue, and
+// callers that need durability wait on sync() instead.
+//
+// File: "LIBWAL1\0" | u32 version | u32 byte order | u64 generation, then
+// records of
+//   u32 bodyLength | u32 FNV-1a(body) | body
+// where body = u8 op | i32 id | op-specific fields. Replay stops at the
+// first torn or corrupt record and the log is truncated there. An intact
+// record that does not decode (an unknown op or item type) is skipped,
+// like a malformed CSV line.
+//
+// The generation names the saved state (snapshot plus status delta) the
+// records apply to. A checkpoint writes the new state first and resets
+// the log under the new generation second; if it dies in between, the
+// log still names the old state, and is replayed only from the offset the
+// state stores (see JournalResume) instead of twice. Checkpoints write the
+// state as of a mark() while borrowing goes on; the records queued after
+// the mark are carried over into the new log.
+// Version 1 logs carry no generation and are always replayed.
+//
+// FlipBorrowed records one successful borrow or return. Concurrent flips
+// of one item may reach the log in a different order than they took
+// effect, but each is exactly one change of state, so replaying them as
+// flips still lands on the right status. SetBorrowed is only read from
+// older logs.
+enum class JournalOp : uint8_t { Add = 1, Remove = 2, SetBorrowed = 3, FlipBorrowed = 4 };
+
+struct JournalRecord {
+    JournalOp op = JournalOp::Add;
+    int id = 0;
+    ItemType type = ItemType::Book;
+    bool borrowed = false;
+    int number = 0;
+    string_view title;
+    string_view creator;
+};
+
+struct JournalOptions {
+    size_t groupCommitRecords = 64;                  // Write once this many records are buffered
+    chrono::milliseconds flushInterval{20};          // ...or once the oldest has waited this long
+    size_t fsyncEveryFlushes = 1;                    // 0 leaves syncing to the OS
+    uint64_t compactAfterBytes = 64ull << 20;        // Fold into a snapshot past this log size
+    chrono::seconds compactInterval{30};             // How often the size is checked
+    bool writeBehind = false;                        // Appends never write; the background thread does
+};
+
+// Its locks are Locking's (see SharedLocking), and only THREADED logs
+// start the background writer.
+template <typename Locking>
+class BasicWriteAheadLog {
+private:
+    using Mutex = typename Locking::Mutex;
+
+    static constexpr char MAGIC[8] = {'L', 'I', 'B', 'W', 'A', 'L', '1', '\0'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t HEADER_SIZE = 24;
+    static constexpr size_t V1_HEADER_SIZE = 16;
+
+    JournalOptions options;
+    BasicMetrics<Locking>* metrics; // Flush latency (including fsync) and bytes written
+    string path;
+    FILE* file = nullptr;
+
+    Mutex fileLock;             // Serializes file access; taken before lock
+    string writing;             // Batch being written, under fileLock
+
+    Mutex lock;                 // Guards everything below
+    typename Locking::Condition wake;
+    string pending;             // Encoded records not yet written
+    size_t pendingRecords = 0;
+    size_t flushesSinceSync = 0;
+    uint64_t logBytes = 0;      // Bytes on disk past the header
+    uint64_t queuedBytes = 0;   // Ever queued / known synced, across resets
+    uint64_t syncedBytes = 0;
+    uint64_t generation = 0;    // Of the open file
+    uint64_t startQueued = 0;   // queuedBytes when the file took its first record...
+    uint64_t startBytes = 0;    // ...and the bytes it held past the header then
+    vector<pair<uint64_t, promise<bool>>> syncWaiters; // sync() calls by the byte count they wait for
+    deque<function<void()>> jobs;                      // See post()
+    bool retaining = false;     // Between mark() and reset()/releaseMark()
+    string retained;            // Records queued since mark()
+    size_t retainedRecords = 0;
+    bool stopping = false;
+    bool running = false;       // The worker is taking jobs
+    thread worker;
+    function<void()> compactor; // Invoked from the worker, see start()
+
+    static uint32_t checksum(const char* data, size_t size) { return fnv1a(data, size); }
+
+    template <typename T>
+    static void put(string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void putText(string& out, string_view text) {
+        put(out, uint32_t(text.size()));
+        out.append(text.data(), text.size());
+    }
+
+    template <typename T>
+    static bool get(const char*& cursor, const char* end, T& value) {
+        if (size_t(end - cursor) < sizeof(value)) return false;
+        memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        return true;
+    }
+
+    static bool getText(const char*& cursor, const char* end, string_view& text) {
+        uint32_t size;
+        if (!get(cursor, end, size) || size_t(end - cursor) < size) return false;
+        text = string_view(cursor, size);
+        cursor += size;
+        return true;
+    }
+
+    static bool decode(const char* body, size_t size, JournalRecord& record) {
+        const char* cursor = body;
+        const char* end = body + size;
+        uint8_t op;
+        int32_t id;
+        if (!get(cursor, end, op) || !get(cursor, end, id)) return false;
+        record = JournalRecord{};
+        record.op = JournalOp(op);
+        record.id = id;
+        switch (record.op) {
+        case JournalOp::Add: {
+            uint8_t type, borrowed;
+            int32_t number;
+            if (!get(cursor, end, type) || !get(cursor, end, borrowed) || !get(cursor, end, number) ||
+                !getText(cursor, end, record.title) || !getText(cursor, end, record.creator)) {
+                return false;
+            }
+            if (type > uint8_t(ItemType::Journal)) return false;
+            record.type = ItemType(type);
+            record.borrowed = borrowed != 0;
+            record.number = number;
+            return cursor == end;
+        }
+        case JournalOp::Remove:
+        case JournalOp::FlipBorrowed:
+            return cursor == end;
+        case JournalOp::SetBorrowed: {
+            uint8_t borrowed;
+            if (!get(cursor, end, borrowed)) return false;
+            record.borrowed = borrowed != 0;
+            return cursor == end;
+        }
+        }
+        return false;
+    }
+
+    // Caller holds the lock. Settles every sync() covered by syncedBytes,
+    // plus those covered by upTo with failed if that write failed.
+    void settleWaitersLocked(uint64_t upTo, bool failed) {
+        auto settled = remove_if(syncWaiters.begin(), syncWaiters.end(), [&](pair<uint64_t, promise<bool>>& waiter) {
+            if (waiter.first <= syncedBytes) waiter.second.set_value(true);
+            else if (failed && waiter.first <= upTo) waiter.second.set_value(false);
+            else return false;
+            return true;
+        });
+        syncWaiters.erase(settled, syncWaiters.end());
+    }
+
+    // Writes everything queued so far. The queue is swapped out first, so
+    // appenders only wait for the swap, never for the disk. Syncs when due,
+    // when sync() is waiting, or when forceSync is set.
+    void writePending(bool forceSync = false) {
+        lock_guard<Mutex> writingGuard(fileLock);
+        uint64_t upTo;
+        {
+            lock_guard<Mutex> guard(lock);
+            writing.clear();
+            writing.swap(pending);
+            pendingRecords = 0;
+            upTo = queuedBytes;
+            if (!writing.empty() && options.fsyncEveryFlushes > 0 && ++flushesSinceSync >= options.fsyncEveryFlushes) {
+                forceSync = true;
+            }
+            if (!syncWaiters.empty()) forceSync = true;
+            if (writing.empty() && (!forceSync || syncedBytes == upTo)) return;
+        }
+        bool ok = file != nullptr; // Only changes under fileLock
+        if (ok) {
+            MetricTimer timer(*metrics, MetricOp::JournalFlush);
+            if (!writing.empty()) {
+                ok = fwrite(writing.data(), 1, writing.size(), file) == writing.size() && fflush(file) == 0;
+                metrics->addBytesWritten(IoTarget::Journal, writing.size());
+            }
+#if LIBRARY_POSIX
+            if (ok && forceSync) ok = fsync(fileno(file)) == 0;
+#endif
+        }
+        lock_guard<Mutex> guard(lock);
+        if (ok) logBytes += writing.size();
+        if (ok && forceSync) {
+            syncedBytes = upTo;
+            flushesSinceSync = 0;
+        }
+        settleWaitersLocked(upTo, !ok);
+    }
+
+    void run() {
+        auto lastCompactCheck = chrono::steady_clock::now();
+        unique_lock<Mutex> guard(lock);
+        while (true) {
+            bool idle = jobs.empty() && syncWaiters.empty() && pendingRecords < options.groupCommitRecords;
+            if (!stopping && idle) wake.wait_for(guard, options.flushInterval);
+            guard.unlock();
+            writePending();
+            guard.lock();
+            // Jobs take the catalog lock, and may call reset(), which
+            // needs this one
+            while (!jobs.empty()) {
+                function<void()> job = move(jobs.front());
+                jobs.pop_front();
+                guard.unlock();
+                job();
+                guard.lock();
+            }
+            if (stopping) break;
+
+            auto now = chrono::steady_clock::now();
+            if (compactor && logBytes >= options.compactAfterBytes &&
+                now - lastCompactCheck >= options.compactInterval) {
+                lastCompactCheck = now;
+                // Like the jobs, the compactor ends by calling reset()
+                guard.unlock();
+                compactor();
+                guard.lock();
+            }
+        }
+        running = false;
+    }
+
+public:
+    struct Header {
+        uint32_t version;
+        uint64_t generation; // 0 for version 1
+    };
+
+private:
+    static optional<Header> parseHeader(const string& data) {
+        Header header{0, 0};
+        uint32_t byteOrder = 0;
+        if (data.size() < V1_HEADER_SIZE || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) return nullopt;
+        memcpy(&header.version, data.data() + 8, 4);
+        memcpy(&byteOrder, data.data() + 12, 4);
+        if (byteOrder != SNAPSHOT_BYTE_ORDER || header.version < 1 || header.version > VERSION) return nullopt;
+        if (header.version == 1) return header;
+        if (data.size() < HEADER_SIZE) return nullopt;
+        memcpy(&header.generation, data.data() + 16, 8);
+        return header;
+    }
+
+    // Replaces the file with an empty log that continues from queued
+    // bytes; caller holds both locks
+    bool startFresh(uint64_t newGeneration, uint64_t queued) {
+        if (file) fclose(file);
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        fwrite(MAGIC, 1, sizeof(MAGIC), file);
+        fwrite(&VERSION, sizeof(VERSION), 1, file);
+        fwrite(&SNAPSHOT_BYTE_ORDER, sizeof(SNAPSHOT_BYTE_ORDER), 1, file);
+        fwrite(&newGeneration, sizeof(newGeneration), 1, file);
+        fflush(file);
+        logBytes = 0;
+        generation = newGeneration;
+        startQueued = queued;
+        startBytes = 0;
+        return true;
+    }
+
+public:
+    explicit BasicWriteAheadLog(JournalOptions options, BasicMetrics<Locking>& metrics) : options(options), metrics(&metrics) {}
+    BasicWriteAheadLog(const BasicWriteAheadLog&) = delete;
+    BasicWriteAheadLog& operator=(const BasicWriteAheadLog&) = delete;
+    ~BasicWriteAheadLog() { close(); }
+
+    // Version and generation of an existing log; nullopt if there is none
+    static optional<Header> readHeader(const string& logPath) {
+        ifstream in(logPath, ios::binary);
+        string data(HEADER_SIZE, '\0');
+        in.read(&data[0], streamsize(data.size()));
+        data.resize(size_t(in.gcount()));
+        return parseHeader(data);
+    }
+
+    // Applies every intact record in order, starting at the file offset
+    // from if given (see JournalResume), and truncates a torn tail.
+    // Returns the number of records replayed; skipped, if given, receives
+    // the number of intact records that could not be decoded.
+    static size_t replay(const string& logPath, const function<void(const JournalRecord&)>& apply,
+                         size_t* skipped = nullptr, uint64_t from = 0) {
+        ifstream in(logPath, ios::binary);
+        if (!in) return 0;
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+
+        optional<Header> header = parseHeader(data);
+        if (!header) return 0;
+
+        size_t replayed = 0;
+        size_t start = max<uint64_t>(header->version == 1 ? V1_HEADER_SIZE : HEADER_SIZE, from);
+        if (start > data.size()) return 0; // Nothing past the saved state made it to disk
+        const char* cursor = data.data() + start;
+        const char* end = data.data() + data.size();
+        while (true) {
+            uint32_t length, sum;
+            const char* recordStart = cursor;
+            if (!get(cursor, end, length) || !get(cursor, end, sum) || size_t(end - cursor) < length ||
+                checksum(cursor, length) != sum) {
+                cursor = recordStart;
+                break;
+            }
+            JournalRecord record;
+            if (!decode(cursor, length, record)) {
+                if (skipped) ++*skipped;
+                cursor += length;
+                continue;
+            }
+            apply(record);
+            cursor += length;
+            ++replayed;
+        }
+
+        if (cursor != end) {
+            error_code ec;
+            filesystem::resize_file(logPath, uint64_t(cursor - data.data()), ec);
+        }
+        return replayed;
+    }
+
+    // Appends to the log if it is current for generation; anything else
+    // (missing, older format, another generation) starts a new one
+    bool open(const string& logPath, uint64_t savedGeneration) {
+        optional<Header> header = readHeader(logPath);
+        lock_guard<Mutex> writingGuard(fileLock);
+        lock_guard<Mutex> guard(lock);
+        path = logPath;
+        if (!header || header->version != VERSION || header->generation != savedGeneration) {
+            return startFresh(savedGeneration, queuedBytes);
+        }
+        file = fopen(path.c_str(), "ab");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        logBytes = uint64_t(ftell(file)) - HEADER_SIZE;
+        generation = savedGeneration;
+        startQueued = queuedBytes;
+        startBytes = logBytes;
+        return true;
+    }
+
+    // Starts the background flusher; compact is called when the log grows
+    // past options.compactAfterBytes and must end by calling reset()
+    void start(function<void()> compact) {
+        compactor = move(compact);
+        stopping = false;
+        running = true;
+        worker = thread([this] { run(); });
+    }
+
+    // Runs queued jobs, then writes and syncs the rest of the log
+    void close() {
+        {
+            lock_guard<Mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+        writePending(true);
+        lock_guard<Mutex> writingGuard(fileLock);
+        lock_guard<Mutex> guard(lock);
+        settleWaitersLocked(queuedBytes, true); // Only left if the log is not open
+        if (!file) return;
+        fclose(file);
+        file = nullptr;
+    }
+
+    static void encode(const JournalRecord& record, string& body) {
+        body.clear();
+        put(body, uint8_t(record.op));
+        put(body, int32_t(record.id));
+        if (record.op == JournalOp::Add) {
+            put(body, uint8_t(record.type));
+            put(body, uint8_t(record.borrowed));
+            put(body, int32_t(record.number));
+            putText(body, record.title);
+            putText(body, record.creator);
+        } else if (record.op == JournalOp::SetBorrowed) {
+            put(body, uint8_t(record.borrowed));
+        }
+    }
+
+    // Caller holds the lock
+    void queueLocked(const string& body) {
+        size_t start = pending.size();
+        put(pending, uint32_t(body.size()));
+        put(pending, checksum(body.data(), body.size()));
+        pending += body;
+        ++pendingRecords;
+        queuedBytes += pending.size() - start;
+        if (retaining) {
+            retained.append(pending, start, string::npos);
+            ++retainedRecords;
+        }
+    }
+
+    void append(const JournalRecord& record) {
+        string body;
+        encode(record, body);
+        bool full;
+        {
+            lock_guard<Mutex> guard(lock);
+            queueLocked(body);
+            full = pendingRecords >= options.groupCommitRecords;
+        }
+        if (!full) return;
+        if (options.writeBehind) wake.notify_one();
+        else writePending();
+    }
+
+    // Queues a whole batch and writes it with a single flush, instead of
+    // one write (and possibly fsync) per group of records
+    void appendBatch(const vector<JournalRecord>& records) {
+        if (records.empty()) return;
+        string body;
+        {
+            lock_guard<Mutex> guard(lock);
+            for (const JournalRecord& record : records) {
+                encode(record, body);
+                queueLocked(body);
+            }
+        }
+        if (options.writeBehind) wake.notify_one();
+        else writePending();
+    }
+
+    // Resolves to true once every record appended before the call is
+    // written and synced (or folded into a saved state by reset()), and
+    // to false if writing it fails. Does not wait itself.
+    future<bool> sync() {
+        promise<bool> done;
+        future<bool> result = done.get_future();
+        bool runHere;
+        {
+            lock_guard<Mutex> guard(lock);
+            if (queuedBytes <= syncedBytes) {
+                done.set_value(true);
+                return result;
+            }
+            syncWaiters.emplace_back(queuedBytes, move(done));
+            runHere = !running;
+        }
+        if (runHere) writePending(true);
+        else wake.notify_one();
+        return result;
+    }
+
+    // Runs job on the background thread after the records queued so far
+    // are written, in posting order; inline once the thread has stopped
+    void post(function<void()> job) {
+        {
+            lock_guard<Mutex> guard(lock);
+            if (running) {
+                jobs.push_back(move(job));
+                wake.notify_one();
+                return;
+            }
+        }
+        job();
+    }
+
+    struct Mark {
+        uint64_t position = 0; // In queued bytes, for reset()
+        JournalResume resume;  // Where the same point falls in the current file
+    };
+
+    // Starts keeping a copy of every record queued from now on. A
+    // checkpoint takes the mark together with the state it writes, stores
+    // its resume with the state, and passes it to reset() once written (or
+    // calls releaseMark() on failure).
+    Mark mark() {
+        lock_guard<Mutex> guard(lock);
+        retaining = true;
+        retained.clear();
+        retainedRecords = 0;
+        Mark at;
+        at.position = queuedBytes;
+        if (file) at.resume = {generation, HEADER_SIZE + startBytes + (queuedBytes - startQueued)};
+        return at;
+    }
+
+    void releaseMark() {
+        lock_guard<Mutex> guard(lock);
+        retaining = false;
+        string().swap(retained);
+        retainedRecords = 0;
+    }
+
+    // Continues from the given saved state, which holds everything logged
+    // up to position (from mark()): the log is replaced by one holding
+    // only the records queued since
+    void reset(uint64_t newGeneration, uint64_t position) {
+        lock_guard<Mutex> writingGuard(fileLock);
+        lock_guard<Mutex> guard(lock);
+        if (file) startFresh(newGeneration, position);
+        pending.swap(retained);
+        pendingRecords = retainedRecords;
+        retaining = false;
+        string().swap(retained);
+        retainedRecords = 0;
+        if (file && syncedBytes > position && !pending.empty()) {
+            // Some of them were already synced to the old log, and callers
+            // told so: they must not wait for the next flush
+            bool ok = fwrite(pending.data(), 1, pending.size(), file) == pending.size() && fflush(file) == 0;
+#if LIBRARY_POSIX
+            ok = ok && fsync(fileno(file)) == 0;
+#endif
+            if (ok) {
+                metrics->addBytesWritten(IoTarget::Journal, pending.size());
+                logBytes += pending.size();
+                pending.clear();
+                pendingRecords = 0;
+            }
+        }
+        syncedBytes = max(syncedBytes, position);
+        settleWaitersLocked(position, false);
+    }
+
+    bool wantsCompaction() {
+        lock_guard<Mutex> guard(lock);
+        return logBytes >= options.compactAfterBytes;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+};
+
+using WriteAheadLog = BasicWriteAheadLog<SharedLocking>;
+
+// ==========================================
+// 10. CSV Import (Zero-Copy Parser)
+// ==========================================
+// Record layout, one per line:
+//   BOOK,id,title,isBorrowed,author,pages
+//   JOURNAL,id,title,isBorrowed,publisher,volume
+// Fields may be quoted ("a, b" or "say ""hi""") so titles can contain
+// commas, quotes and newlines; csvField() produces that form on export.
+struct ParsedItem {
+    ItemType type;
+    int id;
+    string_view title;
+    bool borrowed;
+    string_view creator;
+    int number;
+};
+
+// Walks a whole file held in memory and yields each record's fields as
+// views into the buffer. Only quoted fields with doubled quotes need
+// unescaping, and those go to scratch strings owned by the reader.
+class CsvReader {
+private:
+    const char* cursor;
+    const char* end;
+    deque<string> scratch; // Stable addresses; reused across records
+
+    string_view quotedField(size_t fieldIndex) {
+        ++cursor; // Opening quote
+        const char* start = cursor;
+        string* unescaped = nullptr;
+        while (cursor < end) {
+            const char* quote = static_cast<const char*>(memchr(cursor, '"', size_t(end - cursor)));
+            if (!quote) quote = end;
+            if (quote + 1 < end && quote[1] == '"') {
+                // Doubled quote: switch to the scratch copy
+                if (!unescaped) {
+                    while (scratch.size() <= fieldIndex) scratch.emplace_back();
+                    unescaped = &scratch[fieldIndex];
+                    unescaped->clear();
+                }
+                unescaped->append(cursor, quote + 1);
+                cursor = quote + 2;
+                continue;
+            }
+            if (unescaped) unescaped->append(cursor, quote);
+            string_view field = unescaped ? string_view(*unescaped) : string_view(start, size_t(quote - start));
+            cursor = quote < end ? quote + 1 : end;
+            return field;
+        }
+        return unescaped ? string_view(*unescaped) : string_view(start, size_t(cursor - start));
+    }
+
+public:
+    CsvReader(const char* data, size_t size) : cursor(data), end(data + size) {}
+
+    // Fills fields with the next record; returns false at end of input
+    bool next(vector<string_view>& fields) {
+        fields.clear();
+        if (cursor >= end) return false;
+        while (true) {
+            string_view field;
+            if (cursor < end && *cursor == '"') {
+                field = quotedField(fields.size());
+                // Anything between the closing quote and the delimiter is dropped
+                while (cursor < end && *cursor != ',' && *cursor != '\n') ++cursor;
+            } else {
+                const char* start = cursor;
+                while (cursor < end && *cursor != ',' && *cursor != '\n') ++cursor;
+                field = string_view(start, size_t(cursor - start));
+            }
+            fields.push_back(field);
+
+            if (cursor >= end) break;
+            if (*cursor++ == '\n') break;
+        }
+        string_view& last = fields.back();
+        if (!last.empty() && last.back() == '\r') last.remove_suffix(1); // CRLF files
+        return true;
+    }
+};
+
+// Position just past the field starting at pos (at its delimiter), with
+// the same quoting rules as CsvReader
+size_t skipCsvField(string_view text, size_t pos) {
+    if (pos < text.size() && text[pos] == '"') {
+        for (++pos; pos < text.size(); ++pos) {
+            if (text[pos] != '"') continue;
+            if (pos + 1 < text.size() && text[pos + 1] == '"') ++pos;
+            else break;
+        }
+    }
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '\n') ++pos;
+    return pos;
+}
+
+bool parseInt(string_view text, int& value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+// Validates one record; false means the line is malformed
+bool parseItemFields(const vector<string_view>& fields, ParsedItem& item) {
+    if (fields.size() != 6) return false;
+    if (fields[0] == "BOOK") item.type = ItemType::Book;
+    else if (fields[0] == "JOURNAL") item.type = ItemType::Journal;
+    else return false;
+    if (!parseInt(fields[1], item.id) || !parseInt(fields[5], item.number)) return false;
+    item.title = fields[2];
+    item.borrowed = (fields[3] == "1");
+    item.creator = fields[4];
+    return true;
+}
+
+// --- Parallel import ---
+// A chunk's items point into the file buffer, except quoted fields that
+// had to be unescaped; those are owned by the chunk.
+struct ParsedChunk {
+    vector<ParsedItem> items;
+    deque<string> unescaped;
+    size_t malformed = 0;
+};
+
+// Picks up to `parts` split points that all fall on record boundaries.
+// Quote state is tracked with the same rules as CsvReader (a quote opens
+// a field only at its start), so quoted line breaks are never split on.
+vector<size_t> recordBoundaries(const char* data, size_t size, size_t parts) {
+    vector<size_t> cuts{0};
+    size_t pos = 0;
+    bool inQuotes = false;
+
+    // Moves pos forward to `limit`, updating the quote state
+    auto scanTo = [&](size_t limit) {
+        while (pos < limit) {
+            auto q = static_cast<const char*>(memchr(data + pos, '"', limit - pos));
+            if (!q) {
+                pos = limit;
+                return;
+            }
+            size_t at = size_t(q - data);
+            if (inQuotes) {
+                if (at + 1 < size && data[at + 1] == '"') {
+                    pos = at + 2; // Escaped quote
+                    continue;
+                }
+                inQuotes = false;
+            } else if (at == 0 || data[at - 1] == ',' || data[at - 1] == '\n') {
+                inQuotes = true;
+            }
+            pos = at + 1;
+        }
+    };
+
+    for (size_t k = 1; k < parts; ++k) {
+        scanTo(max(pos, size / parts * k));
+        // Continue to the next line break outside quotes
+        while (pos < size) {
+            auto nl = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+            size_t lineEnd = nl ? size_t(nl - data) : size;
+            scanTo(lineEnd);
+            if (!inQuotes) {
+                pos = min(size, lineEnd + 1);
+                break;
+            }
+            ++pos; // Quoted line break; keep scanning
+        }
+        if (pos > cuts.back() && pos < size) cuts.push_back(pos);
+    }
+    cuts.push_back(size);
+    return cuts;
+}
+
+ParsedChunk parseChunk(const char* begin, const char* end) {
+    ParsedChunk chunk;
+    chunk.items.reserve(size_t(end - begin) / 40);
+    CsvReader reader(begin, size_t(end - begin));
+    vector<string_view> fields;
+    ParsedItem item;
+    auto keep = [&](string_view& field) {
+        if (field.empty() || (field.data() >= begin && field.data() < end)) return;
+        chunk.unescaped.emplace_back(field);
+        field = chunk.unescaped.back();
+    };
+    while (reader.next(fields)) {
+        if (fields.size() == 1 && fields[0].empty()) continue;
+        if (!parseItemFields(fields, item)) {
+            ++chunk.malformed;
+            continue;
+        }
+        keep(item.title);
+        keep(item.creator);
+        chunk.items.push_back(item);
+    }
+    return chunk;
+}
+
+// Parses the buffer on `threads` workers; chunks come back in file order
+vector<ParsedChunk> parseCSVParallel(const char* data, size_t size, unsigned threads) {
+    vector<size_t> cuts = recordBoundaries(data, size, threads);
+    vector<ParsedChunk> chunks(cuts.size() - 1);
+    vector<thread> workers;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        workers.emplace_back([&, i] { chunks[i] = parseChunk(data + cuts[i], data + cuts[i + 1]); });
+    }
+    for (thread& worker : workers) worker.join();
+    return chunks;
+}
+
+// ==========================================
+// 11. Packed Catalog (Block-Compressed Archive)
+// ==========================================
+// A compact copy of the catalog for backups and replication: the items
+// in ascending ID order, cut into blocks of about 16 KiB that are each
+// compressed on their own, then an index of the blocks by first ID. A
+// reader maps the file and decompresses only the block holding the item
+// it wants.
+//
+// File: PackHeader | blocks | PackBlockEntry[blockCount]
+// Block contents before compression:
+//   varint creatorCount, then per creator: varint length, bytes
+//   per item: varint idDelta (from the previous item; 0 for the first)
+//             u8 flags (bit 0 = journal, bit 1 = borrowed)
+//             varint number (zigzag)
+//             varint creator (index among the block's creators)
+//             varint shared (leading bytes shared with the previous title)
+//             varint suffixLength, suffix bytes
+// Titles are front-coded against the previous item's, which removes the
+// common stems of series and volumes stored under neighbouring IDs, and
+// creators are dictionary-coded per block, so every block decodes on
+// its own. Borrow counts are not kept, as in the CSV export.
+
+// One catalog entry as seen by callbacks. The views point into the
+// inventory (or a pack block) and are only valid for the duration of
+// the callback.
+struct ItemView {
+    ItemType type;
+    int id;
+    string_view title;
+    string_view creator;  // Author for books, publisher for journals
+    int number;           // Pages for books, volume for journals
+    bool borrowed;
+};
+
+// LZ4 block format (no frame): a sequence is a token (literal length in
+// the high nibble, match length - 4 in the low one, 15 meaning "more
+// bytes follow"), the literals, a 2-byte little-endian back-reference
+// offset and the extra match length bytes. The last sequence is literals
+// only. Implemented here so the engine builds without extra libraries;
+// the compressor is greedy with a single-entry hash of 4-byte sequences.
+struct BlockCodec {
+    static void compress(string_view input, string& out) {
+        constexpr size_t MIN_MATCH = 4, LAST_LITERALS = 5, MATCH_START_LIMIT = 12, HASH_BITS = 14;
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(input.data());
+        size_t n = input.size();
+        out.clear();
+        out.reserve(n + n / 255 + 16);
+        auto putLength = [&out](size_t length) {
+            for (; length >= 255; length -= 255) out += char(255);
+            out += char(length);
+        };
+        size_t anchor = 0;
+        auto emit = [&](size_t literalEnd, size_t matchLength, size_t offset) {
+            size_t literals = literalEnd - anchor;
+            uint8_t token = uint8_t(min<size_t>(literals, 15) << 4);
+            if (matchLength > 0) token |= uint8_t(min<size_t>(matchLength - MIN_MATCH, 15));
+            out += char(token);
+            if (literals >= 15) putLength(literals - 15);
+            out.append(input.data() + anchor, literals);
+            if (matchLength == 0) return;
+            out += char(offset & 0xFF);
+            out += char(offset >> 8);
+            if (matchLength - MIN_MATCH >= 15) putLength(matchLength - MIN_MATCH - 15);
+        };
+        if (n > MATCH_START_LIMIT) {
+            vector<uint32_t> table(size_t(1) << HASH_BITS, 0); // Position + 1 of the last sequence seen
+            auto hashAt = [src](size_t pos) {
+                uint32_t word;
+                memcpy(&word, src + pos, sizeof(word));
+                return (word * 2654435761u) >> (32 - HASH_BITS);
+            };
+            size_t matchEnd = n - LAST_LITERALS;
+            for (size_t i = 0; i + MATCH_START_LIMIT <= n;) {
+                uint32_t& entry = table[hashAt(i)];
+                size_t candidate = entry;
+                entry = uint32_t(i + 1);
+                if (candidate == 0 || i - (candidate - 1) > 65535 || memcmp(src + candidate - 1, src + i, MIN_MATCH) != 0) {
+                    ++i;
+                    continue;
+                }
+                size_t from = candidate - 1;
+                size_t length = MIN_MATCH;
+                while (i + length < matchEnd && src[from + length] == src[i + length]) ++length;
+                emit(i, length, i - from);
+                i += length;
+                anchor = i;
+            }
+        }
+        emit(n, 0, 0);
+    }
+
+    // False unless input decodes to exactly rawSize bytes
+    static bool decompress(string_view input, char* dst, size_t rawSize) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(input.data());
+        const uint8_t* end = p + input.size();
+        size_t o = 0;
+        auto getLength = [&](size_t& length) {
+            uint8_t byte;
+            do {
+                if (p == end) return false;
+                byte = *p++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        };
+        while (p < end) {
+            uint8_t token = *p++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !getLength(literals)) return false;
+            if (size_t(end - p) < literals || rawSize - o < literals) return false;
+            memcpy(dst + o, p, literals);
+            p += literals;
+            o += literals;
+            if (p == end) break; // The closing literals
+            if (end - p < 2) return false;
+            size_t offset = size_t(p[0]) | (size_t(p[1]) << 8);
+            p += 2;
+            size_t length = token & 15;
+            if (length == 15 && !getLength(length)) return false;
+            length += 4;
+            if (offset == 0 || offset > o || rawSize - o < length) return false;
+            if (offset >= length) {
+                memcpy(dst + o, dst + o - offset, length);
+            } else {
+                for (size_t k = 0; k < length; ++k) dst[o + k] = dst[o + k - offset]; // Overlapping run
+            }
+            o += length;
+        }
+        return o == rawSize;
+    }
+};
+
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;     // SNAPSHOT_BYTE_ORDER in the writer's byte order
+    uint64_t itemCount;
+    uint64_t blockCount;
+    uint64_t indexOffset;   // Where the block index starts
+    uint64_t rawBytes;      // All blocks before compression
+    uint32_t indexChecksum; // fnv1a of the block index
+    uint32_t reserved;
+    uint64_t reserved2;
+};
+static_assert(sizeof(PackHeader) == 64, "pack header must stay 64 bytes");
+
+struct PackBlockEntry {
+    int32_t firstId;
+    uint32_t items;
+    uint64_t offset;        // In the file
+    uint32_t packedBytes;
+    uint32_t rawBytes;
+    uint32_t checksum;      // fnv1a of the packed bytes
+    uint32_t reserved;
+};
+static_assert(sizeof(PackBlockEntry) == 32, "pack index entries must stay 32 bytes");
+
+constexpr char PACK_MAGIC[8] = {'L', 'I', 'B', 'P', 'A', 'C', 'K', '\0'};
+constexpr uint32_t PACK_VERSION = 1;
+
+inline void putVarint(string& out, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) out += char(uint8_t(value) | 0x80);
+    out += char(value);
+}
+
+inline bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p != end && shift < 64; shift += 7) {
+        uint8_t byte = uint8_t(*p++);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (byte < 0x80) return true;
+    }
+    return false;
+}
+
+// Writes items given in ascending ID order to a temporary file, renamed
+// over the target by finish()
+class PackWriter {
+public:
+    static constexpr size_t BLOCK_BYTES = 16 << 10;
+
+private:
+    string path, tmpPath;
+    ofstream out;
+    PackHeader header{};
+    vector<PackBlockEntry> index;
+    uint64_t offset = sizeof(PackHeader);
+
+    // The block being filled
+    string creators, rows, previousTitle, raw, packed;
+    unordered_map<string, uint32_t> creatorIndex;
+    uint32_t items = 0;
+    int firstId = 0, previousId = 0;
+
+    void flushBlock() {
+        if (items == 0) return;
+        raw.clear();
+        putVarint(raw, creatorIndex.size());
+        raw += creators;
+        raw += rows;
+        BlockCodec::compress(raw, packed);
+        out.write(packed.data(), streamsize(packed.size()));
+        index.push_back({firstId, items, offset, uint32_t(packed.size()), uint32_t(raw.size()),
+                         fnv1a(packed.data(), packed.size()), 0});
+        offset += packed.size();
+        header.rawBytes += raw.size();
+        creators.clear();
+        rows.clear();
+        creatorIndex.clear();
+        items = 0;
+    }
+
+public:
+    bool open(const string& target) {
+        path = target;
+        tmpPath = target + ".tmp";
+        out.open(tmpPath, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // Rewritten by finish()
+        return bool(out);
+    }
+
+    void add(const ItemView& item) {
+        if (creators.size() + rows.size() >= BLOCK_BYTES) flushBlock();
+        if (items == 0) {
+            firstId = previousId = item.id;
+            previousTitle.clear();
+        }
+        auto known = creatorIndex.find(string(item.creator));
+        uint32_t creator;
+        if (known != creatorIndex.end()) {
+            creator = known->second;
+        } else {
+            creator = uint32_t(creatorIndex.size());
+            creatorIndex.emplace(string(item.creator), creator);
+            putVarint(creators, item.creator.size());
+            creators += item.creator;
+        }
+        size_t shared = 0;
+        size_t limit = min(previousTitle.size(), item.title.size());
+        while (shared < limit && previousTitle[shared] == item.title[shared]) ++shared;
+
+        // Unsigned arithmetic: IDs span the whole int range, so the gap
+        // between neighbours may not fit in an int
+        putVarint(rows, uint64_t(uint32_t(item.id) - uint32_t(previousId)));
+        rows += char((item.type == ItemType::Journal ? 1 : 0) | (item.borrowed ? 2 : 0));
+        int64_t number = item.number;
+        putVarint(rows, (uint64_t(number) << 1) ^ uint64_t(number >> 63));
+        putVarint(rows, creator);
+        putVarint(rows, shared);
+        putVarint(rows, item.title.size() - shared);
+        rows.append(item.title.data() + shared, item.title.size() - shared);
+        previousTitle.assign(item.title);
+        previousId = item.id;
+        ++items;
+        ++header.itemCount;
+    }
+
+    // Writes the index and the header and moves the file into place
+    bool finish() {
+        flushBlock();
+        memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+        header.version = PACK_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.blockCount = index.size();
+        header.indexOffset = offset;
+        header.indexChecksum = fnv1a(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(PackBlockEntry));
+        out.write(reinterpret_cast<const char*>(index.data()), streamsize(index.size() * sizeof(PackBlockEntry)));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if (!out) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return replaceFile(tmpPath, path, true); // A backup is worth the fsync
+    }
+
+    uint64_t bytesWritten() const { return offset + index.size() * sizeof(PackBlockEntry); }
+};
+
+// Random and sequential access to a packed catalog. Keeps the last block
+// it decompressed, so one reader serves one thread at a time.
+class PackReader {
+private:
+    MappedFile file;
+    PackHeader header{};
+    vector<PackBlockEntry> blocks;
+    string raw;                    // Contents of block rawBlock
+    size_t rawBlock = SIZE_MAX;
+    vector<string_view> creators;  // Of block rawBlock, pointing into raw
+    string title;                  // Scratch for front-decoding
+
+    bool loadBlock(size_t b) {
+        if (b == rawBlock) return true;
+        rawBlock = SIZE_MAX;
+        const PackBlockEntry& entry = blocks[b];
+        string_view packed(file.data() + entry.offset, entry.packedBytes);
+        if (fnv1a(packed.data(), packed.size()) != entry.checksum) return false;
+        raw.resize(entry.rawBytes);
+        if (!BlockCodec::decompress(packed, &raw[0], raw.size())) return false;
+        rawBlock = b;
+        return true;
+    }
+
+    // Calls row(view) per item of block b in ID order until it returns
+    // false; false if the block is damaged
+    template <typename Row>
+    bool decodeBlock(size_t b, Row&& row) {
+        if (!loadBlock(b)) return false;
+        const char* p = raw.data();
+        const char* end = p + raw.size();
+        uint64_t count, value;
+        if (!getVarint(p, end, count) || count > raw.size()) return false;
+        creators.clear();
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!getVarint(p, end, value) || value > uint64_t(end - p)) return false;
+            creators.emplace_back(p, size_t(value));
+            p += value;
+        }
+        int id = blocks[b].firstId;
+        title.clear();
+        for (uint32_t i = 0; i < blocks[b].items; ++i) {
+            uint64_t delta, number, creator, shared, suffix;
+            if (!getVarint(p, end, delta) || p == end) return false;
+            uint8_t flags = uint8_t(*p++);
+            if (!getVarint(p, end, number) || !getVarint(p, end, creator) || !getVarint(p, end, shared) ||
+                !getVarint(p, end, suffix)) {
+                return false;
+            }
+            if (creator >= creators.size() || shared > title.size() || suffix > uint64_t(end - p)) return false;
+            id = int(uint32_t(id) + uint32_t(delta));
+            title.resize(size_t(shared));
+            title.append(p, size_t(suffix));
+            p += suffix;
+            int decoded = int(int64_t(number >> 1) ^ -int64_t(number & 1));
+            ItemView view{(flags & 1) ? ItemType::Journal : ItemType::Book, id, title, creators[size_t(creator)],
+                          decoded, (flags & 2) != 0};
+            if (!row(view)) return true;
+        }
+        return p == end;
+    }
+
+public:
+    // Maps the file and checks the header and the block index
+    bool open(const string& path) {
+        if (!file.open(path) || file.size() < sizeof(PackHeader)) return false;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != PACK_VERSION ||
+            header.byteOrder != SNAPSHOT_BYTE_ORDER || header.indexOffset > file.size() ||
+            header.blockCount > (file.size() - header.indexOffset) / sizeof(PackBlockEntry)) {
+            return false;
+        }
+        const char* indexData = file.data() + header.indexOffset;
+        size_t indexBytes = size_t(header.blockCount) * sizeof(PackBlockEntry);
+        if (fnv1a(indexData, indexBytes) != header.indexChecksum) return false;
+        blocks.resize(size_t(header.blockCount));
+        memcpy(blocks.data(), indexData, indexBytes);
+        for (const PackBlockEntry& entry : blocks) {
+            if (entry.offset > header.indexOffset || entry.packedBytes > header.indexOffset - entry.offset) return false;
+        }
+        return true;
+    }
+
+    size_t size() const { return size_t(header.itemCount); }
+    size_t blockCount() const { return blocks.size(); }
+    uint64_t rawBytes() const { return header.rawBytes; }
+    uint64_t fileBytes() const { return file.size(); }
+
+    // Calls visit with the item if it exists; decompresses one block
+    template <typename Visit>
+    bool findItem(int id, Visit&& visit) {
+        auto after = upper_bound(blocks.begin(), blocks.end(), id,
+                                 [](int key, const PackBlockEntry& entry) { return key < entry.firstId; });
+        if (after == blocks.begin()) return false;
+        bool found = false;
+        decodeBlock(size_t(after - blocks.begin()) - 1, [&](const ItemView& item) {
+            if (item.id < id) return true;
+            if (item.id == id) {
+                visit(item);
+                found = true;
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Calls visit for every item in ascending ID order. False if a block
+    // is damaged; the items before it have been visited.
+    template <typename Visit>
+    bool forEach(Visit&& visit) {
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            bool ok = decodeBlock(b, [&](const ItemView& item) {
+                visit(item);
+                return true;
+            });
+            if (!ok) return false;
+        }
+        return true;
+    }
+};
+
+// ==========================================
+// 12. Parallel Scan Pool (Work Stealing)
+// ==========================================
+// Full scans (unindexed title search, parallel listing, CSV export) are
+// split into chunks of a contiguous range. Each lane starts on its own
+// run of chunks and, once that is exhausted, steals the remaining chunks
+// of the other lanes, so an uneven split (one lane hitting many matches,
+// a slow core) does not leave the rest idle. Chunk numbers follow range
+// order, so per-chunk outputs concatenate back into that order.
+class ScanPool {
+private:
+    // A shared cursor over one lane's chunks; owner and thieves claim with fetch_add
+    struct alignas(64) Lane {
+        atomic<size_t> next{0};
+        size_t end = 0;
+    };
+
+    unsigned width;                 // Lanes, counting the calling thread
+    vector<thread> workers;         // Started on first use
+    unique_ptr<Lane[]> lanes;
+    mutex jobMutex;                 // One job at a time; see run()
+
+    mutex lock;                     // Guards the fields below
+    condition_variable wake, done;
+    const function<void(size_t)>* task = nullptr;
+    uint64_t generation = 0;
+    unsigned busyWorkers = 0;
+    bool stopping = false;
+
+    void runLanes(unsigned self) {
+        for (unsigned k = 0; k < width; ++k) {
+            Lane& lane = lanes[(self + k) % width];
+            for (size_t chunk; (chunk = lane.next.fetch_add(1, memory_order_relaxed)) < lane.end;) {
+                (*task)(chunk);
+            }
+        }
+    }
+
+    void workerLoop(unsigned self) {
+        uint64_t seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            guard.unlock();
+            runLanes(self);
+            guard.lock();
+            if (--busyWorkers == 0) done.notify_one();
+        }
+    }
+
+public:
+    explicit ScanPool(unsigned threads) : width(max(1u, threads)), lanes(new Lane[width]) {}
+    ScanPool(const ScanPool&) = delete;
+    ScanPool& operator=(const ScanPool&) = delete;
+
+    ~ScanPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    unsigned size() const { return width; }
+
+    // Calls body(chunk) for every chunk in [0, chunks) across all lanes,
+    // the calling thread included, and returns when all are done. If
+    // another scan holds the pool, the chunks run on the caller alone
+    // rather than waiting for it.
+    template <typename Body>
+    void run(size_t chunks, Body&& body) {
+        unique_lock<mutex> job(jobMutex, try_to_lock);
+        if (width == 1 || chunks <= 1 || !job.owns_lock()) {
+            for (size_t chunk = 0; chunk < chunks; ++chunk) body(chunk);
+            return;
+        }
+        if (workers.empty()) {
+            for (unsigned self = 1; self < width; ++self) {
+                workers.emplace_back([this, self] { workerLoop(self); });
+            }
+        }
+        function<void(size_t)> work(ref(body));
+        for (unsigned i = 0; i < width; ++i) {
+            lanes[i].next.store(chunks * i / width, memory_order_relaxed);
+            lanes[i].end = chunks * (i + 1) / width;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            task = &work;
+            busyWorkers = width - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        runLanes(0);
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this] { return busyWorkers == 0; });
+        task = nullptr;
+    }
+};
+
+// ScanPool's interface for a catalog used from one thread: one lane, the
+// caller, and nothing to lock or start
+class CallerLane {
+public:
+    explicit CallerLane(unsigned) {}
+    unsigned size() const { return 1; }
+
+    template <typename Body>
+    void run(size_t chunks, Body&& body) {
+        for (size_t chunk = 0; chunk < chunks; ++chunk) body(chunk);
+    }
+};
+
+// Merges runs that are each sorted by less into one sorted vector,
+// pairwise so every element moves O(log runs) times
+template <typename Less>
+vector<int> mergeSortedRuns(vector<vector<int>>& runs, Less less) {
+    if (runs.empty()) return {};
+    for (size_t step = 1; step < runs.size(); step *= 2) {
+        for (size_t i = 0; i + step < runs.size(); i += 2 * step) {
+            vector<int> merged;
+            merged.reserve(runs[i].size() + runs[i + step].size());
+            merge(runs[i].begin(), runs[i].end(), runs[i + step].begin(), runs[i + step].end(),
+                  back_inserter(merged), less);
+            runs[i].swap(merged);
+            vector<int>().swap(runs[i + step]);
+        }
+    }
+    return move(runs[0]);
+}
+
+// ==========================================
+// 13. Manager Class (STL & Logic)
+// ==========================================
+// The manager itself never prints. Results come back as status codes
+// and item views; load/save notices go to an optional log sink, and the
+// console wording lives in the presentation layer (section 15).
+enum class LogLevel : uint8_t { Info, Warning };
+
+struct LibraryOptions {
+    string dataPath = "library_data"; // Files are this plus .txt, .snap, .wal and .delta
+    JournalOptions journal;
+    unsigned importThreads = 0;   // CSV import workers; 0 = one per core
+    unsigned scanThreads = 0;     // Parallel scan/export lanes; 0 = one per core, 1 = serial
+    bool metrics = false;         // Latency histograms and I/O counters (see metricsReport)
+    function<void(LogLevel, const string&)> log; // Unset = silent
+};
+
+// Outcome of a mutation; batch operations return one per input position
+enum class OpStatus : uint8_t {
+    Ok,
+    DuplicateId,      // ID already in the catalog (or earlier in the batch)
+    NotFound,         // No item with that ID
+    AlreadyBorrowed,
+    NotBorrowed,
+    Conflict,         // Another caller changed the item first
+};
+
+// Serial visits run on the calling thread in ascending ID order. Parallel
+// visits may run on several threads at once, each covering a contiguous
+// ascending-ID run, so the callback must be thread-safe.
+enum class Execution : uint8_t { Serial, Parallel };
+
+// Logging policies, called as `if (log) log(level, message)`. SinkLogging
+// forwards to LibraryOptions::log when one is set; NoLogging tests false
+// at compile time, so the messages are never even built.
+class SinkLogging {
+private:
+    function<void(LogLevel, const string&)> sink;
+
+public:
+    explicit SinkLogging(function<void(LogLevel, const string&)> sink) : sink(move(sink)) {}
+    explicit operator bool() const { return bool(sink); }
+    void operator()(LogLevel level, const string& message) const { sink(level, message); }
+};
+
+struct NoLogging {
+    explicit NoLogging(const function<void(LogLevel, const string&)>&) {}
+    constexpr explicit operator bool() const { return false; }
+    void operator()(LogLevel, const string&) const {}
+};
+
+// Catalog totals, answered from bitmap counts rather than a scan
+struct CatalogStats {
+    size_t items = 0;
+    size_t books = 0;
+    size_t journals = 0;
+    size_t borrowed = 0;
+};
+
+template <typename Locking = SharedLocking, typename Logging = SinkLogging>
+class BasicLibraryManager;
+
+// One version of the catalog, pinned by LibraryManager::pin for reports
+// and long scans: borrowing and returning go on at full speed but do not
+// show in it. Adding and removing items wait until it is destroyed, so
+// hold one for the length of a report, not indefinitely.
+template <typename Locking, typename Logging>
+class BasicCatalogVersion {
+public:
+    size_t size() const;
+    size_t borrowedCount() const { return status.borrowedCount(); }
+    template <typename Visit>
+    bool findItem(int id, Visit&& visit) const;
+    // Same order and threading as LibraryManager::listAll
+    template <typename Visit>
+    void listAll(Visit&& visit, Execution mode = Execution::Serial) const;
+    bool exportCSV(const string& path) const;
+
+private:
+    using Manager = BasicLibraryManager<Locking, Logging>;
+    friend Manager;
+    const Manager* lib;
+    shared_lock<typename Locking::CatalogMutex> guard;
+    StatusCut status;
+
+    explicit BasicCatalogVersion(const Manager& lib);
+};
+
+// The catalog engine. Locking and Logging are the policies above; the
+// defaults (LibraryManager) suit any number of threads, and
+// SingleThreadedLibrary is the same engine for one thread, free of locks.
+template <typename Locking, typename Logging>
+class BasicLibraryManager {
+public:
+    using CatalogVersion = BasicCatalogVersion<Locking, Logging>;
+
+private:
+    friend CatalogVersion;
+    using CatalogMutex = typename Locking::CatalogMutex;
+    using Gate = typename Locking::Gate;
+    using Mutex = typename Locking::Mutex;
+    template <typename T>
+    using Flag = typename Locking::template Flag<T>;
+    // The storage, under the same policy
+    using FlatInventory = BasicFlatInventory<Locking>;
+    using AttributeIndex = BasicAttributeIndex<Locking>;
+    using WriteAheadLog = BasicWriteAheadLog<Locking>;
+    using Metrics = BasicMetrics<Locking>;
+
+    // Columnar storage with an O(1) hashed ID lookup
+    FlatInventory inventory;
+    // Built on first search, so mapping a snapshot stays free of work
+    mutable TitleIndex titleIndex;
+    mutable TrigramIndex trigramIndex;
+    mutable Flag<bool> indexesBuilt{true};
+    mutable SuggestIndex suggestIndex;             // Built on first suggest()
+    mutable Flag<bool> suggestBuilt{false};
+    mutable AttributeIndex attributeIndex;         // Built on first filter or stats query
+    mutable Flag<bool> attributesBuilt{false};
+    mutable Mutex indexBuildMutex;                 // Serializes the lazy builds
+    bool substringIndexEnabled = true;
+    const string filename;                            // CSV import/export
+    const string snapshotFile;                        // Binary, mmapped at startup
+    const string journalFile;                         // Mutations since the snapshot
+    const string deltaFile;                           // Status changes since the snapshot
+    const bool syncFiles;                             // Saves are synced unless the journal is not
+    uint64_t snapshotGeneration = 0;                  // Tag of the snapshot in memory
+    uint64_t savedGeneration = 0;                     // Saved state the journal continues
+    JournalResume journalResume;                      // Stored with it, as loaded
+    // Start of every 64th record of the last full export of the CSV file
+    // (and its end), so later saves can patch status fields in place
+    struct CsvLayout {
+        vector<uint64_t> recordOffsets;
+        uint64_t bytes = 0;
+        filesystem::file_time_type written;
+    } csvLayout;
+    static constexpr size_t PARALLEL_IMPORT_BYTES = 4 << 20; // Smaller files parse faster serially
+    // Batches touching more than 1/INDEX_REBUILD_FRACTION of the catalog
+    // drop the title indexes and let the next search rebuild them once
+    static constexpr size_t INDEX_REBUILD_FRACTION = 8;
+
+    mutable Metrics metrics;  // Before journal, which records into it
+    // saveAsync requests not started yet; they share one save
+    struct QueuedSave {
+        promise<bool> done;
+        shared_future<bool> result;
+        vector<function<void(bool)>> callbacks;
+    };
+    Mutex saveQueueMutex;
+    shared_ptr<QueuedSave> queuedSave;
+    WriteAheadLog journal;
+    unsigned importThreads;
+    mutable conditional_t<Locking::THREADED, ScanPool, CallerLane> scanPool;
+    static constexpr size_t PARALLEL_SCAN_BYTES = 4 << 20;   // Title heap size worth splitting
+    static constexpr size_t PARALLEL_EXPORT_ITEMS = 1 << 16;
+    static constexpr size_t SCAN_CHUNK_ITEMS = 1 << 14;      // Work unit of a parallel scan
+    // Locking: reads (search, list, export) share catalogLock and never
+    // block each other. Borrow/return also share it (only to keep slots
+    // from moving) and change the status bit with one atomic operation,
+    // so they never wait on each other. Adding or removing items moves
+    // column data, so those take catalogLock exclusively.
+    //
+    // Borrow/return also share statusGate around the change and its
+    // journal record. Long reads and saves take it exclusively for the
+    // moment it takes to copy the status column (a StatusCut), and then
+    // work from that copy: they see one version of the catalog, and
+    // saves write it under the shared lock while borrowing goes on.
+    mutable CatalogMutex catalogLock;
+    mutable Gate statusGate;
+    Mutex saveMutex; // One save at a time; guards the generations and csvLayout
+    Logging log;
+
+    ItemView viewOf(int slot) const {
+        return {inventory.type(slot), inventory.id(slot), inventory.title(slot), inventory.creator(slot),
+                inventory.number(slot), inventory.isBorrowed(slot)};
+    }
+
+    ItemView viewOf(int slot, const StatusCut& cut) const {
+        return {inventory.type(slot), inventory.id(slot), inventory.title(slot), inventory.creator(slot),
+                inventory.number(slot), cut.borrowed(slot)};
+    }
+
+    // Statuses of every item at one instant; catalogLock is held shared
+    StatusCut pinStatus() const {
+        unique_lock<Gate> gate(statusGate);
+        return inventory.cutStatus(false);
+    }
+
+    // What a save writes: statuses, borrow counts and the changes since
+    // each baseline taken (see FlatInventory::takeChanges) at one instant,
+    // and the journal position of that instant
+    struct SaveCut {
+        StatusCut status;
+        typename WriteAheadLog::Mark journalMark;
+    };
+
+    // catalogLock (shared is enough) and saveMutex are held
+    SaveCut cutForSave(bool withCsv) {
+        unique_lock<Gate> gate(statusGate);
+        SaveCut cut;
+        cut.status = inventory.cutStatus(true);
+        inventory.takeChanges(cut.status, Baseline::Snapshot);
+        if (withCsv) inventory.takeChanges(cut.status, Baseline::Csv);
+        cut.journalMark = journal.mark();
+        return cut;
+    }
+
+    void restoreChanges(const SaveCut& cut, Baseline baseline) {
+        unique_lock<Gate> gate(statusGate);
+        inventory.restoreChanges(cut.status, baseline);
+    }
+
+    // Writes the catalog as of cut and restarts the journal from there.
+    // When only statuses changed since the snapshot was written, a status
+    // delta is written beside it instead.
+    bool checkpointCut(const SaveCut& cut) {
+        uint64_t next = newGeneration();
+        bool delta = snapshotGeneration != 0 && inventory.statusDeltaFits(cut.status);
+        const JournalResume& resume = cut.journalMark.resume;
+        bool written = delta
+                           ? inventory.writeStatusDelta(deltaFile, snapshotGeneration, next, cut.status, resume, syncFiles)
+                           : inventory.writeSnapshot(snapshotFile, next, cut.status, resume, syncFiles);
+        if (!written) {
+            if (log) log(LogLevel::Warning, "Error saving snapshot!");
+            restoreChanges(cut, Baseline::Snapshot);
+            journal.releaseMark();
+            return false;
+        }
+        if (delta) {
+            metrics.addBytesWritten(IoTarget::Snapshot, fileBytes(deltaFile));
+            restoreChanges(cut, Baseline::Snapshot); // The next delta again covers everything since the snapshot
+        } else {
+            metrics.addBytesWritten(IoTarget::Snapshot, fileBytes(snapshotFile));
+            snapshotGeneration = next;
+            remove(deltaFile.c_str()); // Written against the previous snapshot
+        }
+        savedGeneration = next;
+        journal.reset(next, cut.journalMark.position);
+        return true;
+    }
+
+    // Saves the catalog and empties the journal. catalogLock is held;
+    // shared is enough, so borrowing goes on while the files are written.
+    bool checkpointLocked() {
+        lock_guard<Mutex> saving(saveMutex);
+        return checkpointCut(cutForSave(false));
+    }
+
+    // Re-applies mutations logged after the last snapshot, from the file
+    // offset from on
+    void replayJournal(uint64_t from = 0) {
+        metrics.addBytesRead(IoTarget::Journal, fileBytes(journalFile));
+        size_t skipped = 0;
+        size_t replayed = WriteAheadLog::replay(journalFile, [this](const JournalRecord& record) {
+            int slot = inventory.find(record.id);
+            switch (record.op) {
+            case JournalOp::Add:
+                if (slot != FlatInventory::NPOS) unindexSlot(slot), inventory.erase(slot);
+                storeItem(record.type, record.id, record.title, record.creator, record.number, record.borrowed);
+                break;
+            case JournalOp::Remove:
+                if (slot != FlatInventory::NPOS) unindexSlot(slot), inventory.erase(slot);
+                break;
+            case JournalOp::SetBorrowed:
+                if (slot != FlatInventory::NPOS) inventory.trySetBorrowed(slot, record.borrowed);
+                break;
+            case JournalOp::FlipBorrowed:
+                if (slot != FlatInventory::NPOS) inventory.trySetBorrowed(slot, !inventory.isBorrowed(slot));
+                break;
+            }
+        }, &skipped, from);
+        if (replayed > 0 && log) log(LogLevel::Info, "Recovered " + to_string(replayed) + " journaled change(s).");
+        if (skipped > 0 && log) {
+            log(LogLevel::Warning, "Skipped " + to_string(skipped) + " unreadable record(s) in " + journalFile);
+        }
+    }
+
+    // Single entry point for inserts so the title indexes stay in sync
+    void storeItem(ItemType type, int id, string_view title, string_view creator, int number, bool borrowed) {
+        int slot = inventory.insert(type, id, title, creator, number, borrowed);
+        if (attributesBuilt) attributeIndex.add(slot, inventory);
+        if (suggestBuilt) {
+            suggestIndex.add(id, title, creator);
+            if (suggestIndex.wantsRebuild()) dropSuggestIndex();
+        }
+        if (!indexesBuilt) return;
+        titleIndex.add(id, title);
+        if (substringIndexEnabled) trigramIndex.add(id, title);
+    }
+
+    // Decomposes an item into columns; the object itself is not kept
+    void storeObject(const CatalogItem& item) {
+        visit([this](const auto& concrete) {
+            storeItem(concrete.TYPE, concrete.getId(), concrete.getTitle(), creatorOf(concrete),
+                      numberOf(concrete), concrete.getStatus());
+        }, item);
+    }
+
+    JournalRecord addRecord(int slot) const {
+        return {JournalOp::Add, inventory.id(slot), inventory.type(slot), inventory.isBorrowed(slot),
+                inventory.number(slot), inventory.title(slot), inventory.creator(slot)};
+    }
+
+    // Positions 0..count-1 sorted by ID, stable so duplicates keep input order.
+    // Visiting in ID order keeps posting-list updates appends.
+    template <typename IdAt>
+    static vector<size_t> orderById(size_t count, IdAt idAt) {
+        vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i) order[i] = i;
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return idAt(a) < idAt(b); });
+        return order;
+    }
+
+    // Cheaper than updating them item by item for large batches
+    void dropIndexes() {
+        dropSuggestIndex();
+        dropAttributeIndex();
+        if (!indexesBuilt) return;
+        titleIndex.clear();
+        trigramIndex.clear();
+        indexesBuilt = false;
+    }
+
+    void dropSuggestIndex() {
+        if (!suggestBuilt) return;
+        suggestIndex.clear();
+        suggestBuilt = false;
+    }
+
+    void dropAttributeIndex() {
+        if (!attributesBuilt) return;
+        attributeIndex.clear();
+        attributesBuilt = false;
+    }
+
+    vector<OpStatus> transitionMany(const vector<int>& ids, bool borrowed) {
+        MetricTimer timer(metrics, MetricOp::Borrow);
+        vector<OpStatus> results(ids.size(), OpStatus::Ok);
+        vector<size_t> order = orderById(ids.size(), [&](size_t i) { return ids[i]; });
+        shared_lock<CatalogMutex> guard(catalogLock);
+        shared_lock<Gate> gate(statusGate);
+        vector<JournalRecord> records;
+        records.reserve(ids.size());
+        for (size_t i : order) {
+            int slot = inventory.find(ids[i]);
+            if (slot == FlatInventory::NPOS) {
+                results[i] = OpStatus::NotFound;
+            } else if (!inventory.trySetBorrowed(slot, borrowed)) {
+                results[i] = borrowed ? OpStatus::AlreadyBorrowed : OpStatus::NotBorrowed;
+            } else {
+                JournalRecord record;
+                record.op = JournalOp::FlipBorrowed;
+                record.id = ids[i];
+                records.push_back(record);
+            }
+        }
+        journal.appendBatch(records);
+        return results;
+    }
+
+    // Runs on the journal's background thread
+    void runQueuedSave() {
+        shared_ptr<QueuedSave> save;
+        {
+            lock_guard<Mutex> guard(saveQueueMutex);
+            save.swap(queuedSave);
+        }
+        bool saved = saveToFile();
+        // Callbacks first: once the result is visible they have all run
+        for (auto& callback : save->callbacks) callback(saved);
+        save->done.set_value(saved);
+    }
+
+    static size_t chunksOf(size_t items) { return (items + SCAN_CHUNK_ITEMS - 1) / SCAN_CHUNK_ITEMS; }
+
+    // catalogLock is held (shared is enough)
+    bool transitionLocked(int id, bool borrowed) {
+        shared_lock<Gate> gate(statusGate);
+        int slot = inventory.find(id);
+        if (slot == FlatInventory::NPOS || !inventory.trySetBorrowed(slot, borrowed)) return false;
+        JournalRecord record;
+        record.op = JournalOp::FlipBorrowed;
+        record.id = id;
+        journal.append(record);
+        return true;
+    }
+
+    void unindexSlot(int slot) {
+        if (attributesBuilt) attributeIndex.erase(slot, inventory);
+        if (suggestBuilt) {
+            suggestIndex.remove(inventory.id(slot));
+            if (suggestIndex.wantsRebuild()) dropSuggestIndex();
+        }
+        if (!indexesBuilt) return;
+        titleIndex.remove(inventory.id(slot), inventory.title(slot));
+        if (substringIndexEnabled) trigramIndex.remove(inventory.id(slot), inventory.title(slot));
+    }
+
+    // Rebuilds both title indexes in one ascending pass over the inventory
+    void rebuildIndexes() const {
+        titleIndex.clear();
+        trigramIndex.clear();
+        for (int slot : inventory.inIdOrder()) {
+            titleIndex.appendSorted(inventory.id(slot), inventory.title(slot));
+            if (substringIndexEnabled) trigramIndex.appendSorted(inventory.id(slot), inventory.title(slot));
+        }
+        indexesBuilt.store(true, memory_order_release);
+    }
+
+    // Readers holding the shared lock may race here; one builds, the rest wait
+    void ensureIndexes() const {
+        if (indexesBuilt.load(memory_order_acquire)) return;
+        lock_guard<Mutex> guard(indexBuildMutex);
+        if (!indexesBuilt.load(memory_order_relaxed)) rebuildIndexes();
+    }
+
+    void ensureSuggestIndex() const {
+        if (suggestBuilt.load(memory_order_acquire)) return;
+        lock_guard<Mutex> guard(indexBuildMutex);
+        if (suggestBuilt.load(memory_order_relaxed)) return;
+        suggestIndex.build(inventory);
+        suggestBuilt.store(true, memory_order_release);
+    }
+
+    // Creator postings only when asked for: counting types and borrowed
+    // items reads just the hot columns
+    void ensureAttributeIndex(bool withCreators = false) const {
+        if (attributesBuilt.load(memory_order_acquire) && (!withCreators || attributeIndex.hasCreators())) return;
+        lock_guard<Mutex> guard(indexBuildMutex);
+        if (!attributesBuilt.load(memory_order_relaxed)) {
+            attributeIndex.build(inventory);
+            attributesBuilt.store(true, memory_order_release);
+        }
+        if (withCreators && !attributeIndex.hasCreators()) attributeIndex.buildCreators(inventory);
+    }
+
+    static uint64_t fileBytes(const string& path) {
+        error_code ec;
+        uint64_t bytes = filesystem::file_size(path, ec);
+        return ec ? 0 : bytes;
+    }
+
+    // Without a background writer, appends must write their own groups
+    static JournalOptions journalOptions(JournalOptions options) {
+        if (!Locking::THREADED) options.writeBehind = false;
+        return options;
+    }
+
+    // The snapshot is preferred unless the CSV was edited after it (or
+    // its status delta) was written
+    bool snapshotIsCurrent() const {
+        error_code ec;
+        auto snapTime = filesystem::last_write_time(snapshotFile, ec);
+        if (ec) return false;
+        auto deltaTime = filesystem::last_write_time(deltaFile, ec);
+        if (!ec) snapTime = max(snapTime, deltaTime);
+        auto csvTime = filesystem::last_write_time(filename, ec);
+        return ec || snapTime >= csvTime;
+    }
+
+public:
+    explicit BasicLibraryManager(LibraryOptions options = {})
+        : filename(options.dataPath + ".txt"), snapshotFile(options.dataPath + ".snap"),
+          journalFile(options.dataPath + ".wal"), deltaFile(options.dataPath + ".delta"),
+          syncFiles(options.journal.fsyncEveryFlushes > 0), metrics(options.metrics),
+          journal(journalOptions(options.journal), metrics), importThreads(options.importThreads),
+          scanPool(!Locking::THREADED ? 1 : options.scanThreads ? options.scanThreads : max(1u, thread::hardware_concurrency())),
+          log(move(options.log)) {
+        if (!Locking::THREADED) importThreads = 1;
+        if (importThreads == 0) importThreads = max(1u, thread::hardware_concurrency());
+        bool fromCSV;
+        bool resumed = false;
+        optional<typename WriteAheadLog::Header> logHeader = WriteAheadLog::readHeader(journalFile);
+        {
+            MetricTimer timer(metrics, MetricOp::Load);
+            fromCSV = !loadFromFile();
+            // A log naming another saved state was left behind by a
+            // checkpoint that stopped short of resetting it: the state
+            // holds the log up to journalResume, so only the rest is
+            // replayed. After a CSV load the journal is applied on top of
+            // the file, as before.
+            if (logHeader && (fromCSV || logHeader->generation == savedGeneration)) {
+                replayJournal();
+            } else if (logHeader && journalResume.generation != 0 && logHeader->generation == journalResume.generation) {
+                replayJournal(journalResume.offset);
+                resumed = true;
+            }
+        }
+        if (fromCSV || resumed || (logHeader && logHeader->version == 1)) {
+            // The CSV is the new baseline (or a log that is about to be
+            // replaced was replayed): save it before opening the log
+            unique_lock<CatalogMutex> guard(catalogLock);
+            if (!checkpointLocked() && logHeader) savedGeneration = logHeader->generation;
+        }
+        if (!journal.open(journalFile, savedGeneration) && log) {
+            log(LogLevel::Warning, "Warning: cannot open " + journalFile + ", changes are not durable!");
+        }
+        if (!Locking::THREADED) return;
+        journal.start([this] {
+            shared_lock<CatalogMutex> guard(catalogLock);
+            checkpointLocked();
+        });
+    }
+
+    // Shutdown only flushes the journal; the snapshot is rewritten when the
+    // journal has grown large, not on every exit
+    ~BasicLibraryManager() {
+        journal.close();
+        if (journal.wantsCompaction()) {
+            unique_lock<CatalogMutex> guard(catalogLock);
+            checkpointLocked();
+        }
+        if (log) log(LogLevel::Info, "Changes saved to " + journalFile);
+    }
+
+    const string& csvPath() const { return filename; }
+    const string& snapshotPath() const { return snapshotFile; }
+
+    OpStatus addItem(const CatalogItem& item) {
+        MetricTimer timer(metrics, MetricOp::Add);
+        int id = itemId(item);
+        unique_lock<CatalogMutex> guard(catalogLock);
+        if (inventory.find(id) != FlatInventory::NPOS) return OpStatus::DuplicateId;
+        storeObject(item);
+        journal.append(addRecord(inventory.find(id)));
+        return OpStatus::Ok;
+    }
+
+    // Bulk insert under one lock acquisition and one journal flush. Items
+    // are stored in ID order; for IDs repeated within the batch the first
+    // occurrence wins.
+    vector<OpStatus> addItems(const vector<CatalogItem>& items) {
+        MetricTimer timer(metrics, MetricOp::Add);
+        vector<OpStatus> results(items.size(), OpStatus::Ok);
+        vector<size_t> order = orderById(items.size(), [&](size_t i) { return itemId(items[i]); });
+        unique_lock<CatalogMutex> guard(catalogLock);
+
+        size_t titleBytes = 0;
+        for (const CatalogItem& item : items) titleBytes += itemTitle(item).size();
+        inventory.reserve(inventory.size() + items.size(), titleBytes);
+        if (items.size() > inventory.size() / INDEX_REBUILD_FRACTION) dropIndexes();
+
+        vector<int> stored;
+        stored.reserve(items.size());
+        for (size_t i : order) {
+            int id = itemId(items[i]);
+            if (inventory.find(id) != FlatInventory::NPOS) {
+                results[i] = OpStatus::DuplicateId;
+            } else {
+                storeObject(items[i]);
+                stored.push_back(id);
+            }
+        }
+        // Records view the string arenas, so they are built only once
+        // every insert (and any arena growth) is done
+        vector<JournalRecord> records;
+        records.reserve(stored.size());
+        for (int id : stored) records.push_back(addRecord(inventory.find(id)));
+        journal.appendBatch(records);
+        return results;
+    }
+
+    OpStatus removeItem(int id) {
+        MetricTimer timer(metrics, MetricOp::Remove);
+        unique_lock<CatalogMutex> guard(catalogLock);
+        int slot = inventory.find(id);
+        if (slot == FlatInventory::NPOS) return OpStatus::NotFound;
+        unindexSlot(slot);
+        inventory.erase(slot);
+        JournalRecord record;
+        record.op = JournalOp::Remove;
+        record.id = id;
+        journal.append(record);
+        return OpStatus::Ok;
+    }
+
+    vector<OpStatus> removeItems(const vector<int>& ids) {
+        MetricTimer timer(metrics, MetricOp::Remove);
+        vector<OpStatus> results(ids.size(), OpStatus::Ok);
+        vector<size_t> order = orderById(ids.size(), [&](size_t i) { return ids[i]; });
+        unique_lock<CatalogMutex> guard(catalogLock);
+        if (ids.size() > inventory.size() / INDEX_REBUILD_FRACTION) dropIndexes();
+
+        vector<JournalRecord> records;
+        records.reserve(ids.size());
+        for (size_t i : order) {
+            int slot = inventory.find(ids[i]);
+            if (slot == FlatInventory::NPOS) {
+                results[i] = OpStatus::NotFound;
+                continue;
+            }
+            unindexSlot(slot);
+            inventory.erase(slot);
+            JournalRecord record;
+            record.op = JournalOp::Remove;
+            record.id = ids[i];
+            records.push_back(record);
+        }
+        journal.appendBatch(records);
+        return results;
+    }
+
+    // Checks out every listed item that is available. Like tryBorrow, this
+    // only shares the catalog lock, so it runs alongside other borrowers.
+    vector<OpStatus> borrowMany(const vector<int>& ids) {
+        return transitionMany(ids, true);
+    }
+
+    vector<OpStatus> returnMany(const vector<int>& ids) {
+        return transitionMany(ids, false);
+    }
+
+    // The trigram index costs memory roughly proportional to total title
+    // length; deployments that rarely search can switch it off.
+    void setSubstringIndex(bool enabled) {
+        unique_lock<CatalogMutex> guard(catalogLock);
+        if (enabled == substringIndexEnabled) return;
+        substringIndexEnabled = enabled;
+        trigramIndex.clear();
+        if (enabled && indexesBuilt) {
+            for (int slot : inventory.inIdOrder()) {
+                trigramIndex.appendSorted(inventory.id(slot), inventory.title(slot));
+            }
+        }
+    }
+
+    // Read callbacks run with catalogLock held shared: they may read
+    // freely but must not call back into mutating methods.
+
+    // Substring match on titles; visit(const ItemView&) is called per hit,
+    // in ascending ID order. ignoreCase folds ASCII letters. Returns the
+    // number of hits.
+    template <typename Visit>
+    size_t searchItem(string_view keyword, Visit&& visit, bool ignoreCase = false) const {
+        MetricTimer timer(metrics, MetricOp::Search);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        SubstringScanner scanner(keyword, ignoreCase);
+        if (!ignoreCase && substringIndexEnabled && keyword.size() >= TrigramIndex::MIN_QUERY) {
+            // Only candidates sharing every trigram are checked
+            ensureIndexes();
+            size_t hits = 0;
+            for (int id : trigramIndex.candidates(keyword)) {
+                int slot = inventory.find(id);
+                if (scanner.matches(inventory.title(slot))) {
+                    visit(viewOf(slot));
+                    ++hits;
+                }
+            }
+            return hits;
+        }
+        // The trigram index is byte-exact, so anything else is one kernel
+        // pass over the title heap, split across the scan pool when large
+        auto byId = [this](int a, int b) { return inventory.id(a) < inventory.id(b); };
+        vector<int> slots;
+        if (scanPool.size() > 1 && inventory.titleBytes() >= PARALLEL_SCAN_BYTES) {
+            vector<vector<int>> runs(chunksOf(inventory.size()));
+            scanPool.run(runs.size(), [&](size_t chunk) {
+                inventory.scanTitles(scanner, chunk * SCAN_CHUNK_ITEMS, (chunk + 1) * SCAN_CHUNK_ITEMS,
+                                     [&](int slot) { runs[chunk].push_back(slot); });
+                sort(runs[chunk].begin(), runs[chunk].end(), byId);
+            });
+            slots = mergeSortedRuns(runs, byId);
+        } else {
+            inventory.scanTitles(scanner, [&](int slot) { slots.push_back(slot); });
+            sort(slots.begin(), slots.end(), byId);
+        }
+        for (int slot : slots) {
+            visit(viewOf(slot));
+        }
+        return slots.size();
+    }
+
+    // Whole-word search: every word of the query must appear in the title
+    // (case-insensitive). Served from the inverted index, no full scan.
+    template <typename Visit>
+    size_t searchKeywords(const string& query, Visit&& visit) const {
+        MetricTimer timer(metrics, MetricOp::Search);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        ensureIndexes();
+        vector<int> ids = titleIndex.search(query);
+        for (int id : ids) {
+            visit(viewOf(inventory.find(id)));
+        }
+        return ids.size();
+    }
+
+    // Autocomplete: the best k items with a word of the title or of the
+    // author/publisher starting with prefix (case-insensitive), best
+    // first. Whole-field prefixes rank above later words, then more
+    // borrowed items first; see SuggestIndex.
+    template <typename Visit>
+    size_t suggest(string_view prefix, size_t k, Visit&& visit) const {
+        MetricTimer timer(metrics, MetricOp::Suggest);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        ensureSuggestIndex();
+        vector<int> ids = suggestIndex.query(prefix, k, inventory);
+        for (int id : ids) {
+            visit(viewOf(inventory.find(id)));
+        }
+        return ids.size();
+    }
+
+    // Items matching every condition of the query, in ascending ID order.
+    // Served from the attribute bitmaps; only the matches are touched.
+    template <typename Visit>
+    size_t filterItems(const ItemQuery& query, Visit&& visit) const {
+        MetricTimer timer(metrics, MetricOp::Filter);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        ensureAttributeIndex(query.namesCreators());
+        vector<int> slots;
+        attributeIndex.evaluate(query, inventory).forEach([&](int slot) { slots.push_back(slot); });
+        sort(slots.begin(), slots.end(), [this](int a, int b) { return inventory.id(a) < inventory.id(b); });
+        for (int slot : slots) {
+            visit(viewOf(slot));
+        }
+        return slots.size();
+    }
+
+    // Number of items filterItems would visit, without visiting them
+    size_t countItems(const ItemQuery& query) const {
+        MetricTimer timer(metrics, MetricOp::Filter);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        ensureAttributeIndex(query.namesCreators());
+        return attributeIndex.evaluate(query, inventory).cardinality();
+    }
+
+    CatalogStats stats() const {
+        shared_lock<CatalogMutex> guard(catalogLock);
+        ensureAttributeIndex();
+        CatalogStats totals;
+        totals.items = inventory.size();
+        totals.books = attributeIndex.count(ItemType::Book);
+        totals.journals = attributeIndex.count(ItemType::Journal);
+        totals.borrowed = inventory.borrowedCount();
+        return totals;
+    }
+
+    // Latency histograms and I/O totals merged across threads (empty
+    // unless LibraryOptions::metrics is set), plus the catalog size and
+    // the heap memory of the inventory and of each index currently built
+    MetricsReport metricsReport() const {
+        MetricsReport report = metrics.report();
+        shared_lock<CatalogMutex> guard(catalogLock);
+        lock_guard<Mutex> building(indexBuildMutex); // Lazy builds run under the shared lock
+        report.items = inventory.size();
+        report.borrowed = inventory.borrowedCount();
+        report.indexBytes.emplace_back("inventory", inventory.memoryBytes());
+        if (indexesBuilt) {
+            report.indexBytes.emplace_back("title", titleIndex.memoryBytes());
+            report.indexBytes.emplace_back("trigram", trigramIndex.memoryBytes());
+        }
+        if (suggestBuilt) report.indexBytes.emplace_back("suggest", suggestIndex.memoryBytes());
+        if (attributesBuilt) report.indexBytes.emplace_back("attribute", attributeIndex.memoryBytes());
+        return report;
+    }
+
+    // Pins the current version of the catalog (see CatalogVersion)
+    CatalogVersion pin() const { return CatalogVersion(*this); }
+
+    // Calls visit for every item, in ascending ID order unless mode is
+    // Parallel (see Execution). Statuses are as of the call.
+    template <typename Visit>
+    void listAll(Visit&& visit, Execution mode = Execution::Serial) const {
+        pin().listAll(forward<Visit>(visit), mode);
+    }
+
+    // Calls visit with the item if it exists; returns whether it did
+    template <typename Visit>
+    bool findItem(int id, Visit&& visit) const {
+        shared_lock<CatalogMutex> guard(catalogLock);
+        int slot = inventory.find(id);
+        if (slot == FlatInventory::NPOS) return false;
+        visit(viewOf(slot));
+        return true;
+    }
+
+    size_t size() const {
+        shared_lock<CatalogMutex> guard(catalogLock);
+        return inventory.size();
+    }
+
+    // Checks out an available item. False if it is unknown or already
+    // borrowed; exactly one of several concurrent callers succeeds.
+    bool tryBorrow(int id) {
+        MetricTimer timer(metrics, MetricOp::Borrow);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        return transitionLocked(id, true);
+    }
+
+    // Returns a borrowed item. False if it is unknown or not borrowed.
+    bool tryReturn(int id) {
+        MetricTimer timer(metrics, MetricOp::Borrow);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        return transitionLocked(id, false);
+    }
+
+    // Flips the status; on success nowBorrowed holds the new state.
+    // Conflict means another caller flipped it between read and update.
+    OpStatus toggleBorrow(int id, bool& nowBorrowed) {
+        MetricTimer timer(metrics, MetricOp::Borrow);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        int slot = inventory.find(id);
+        if (slot == FlatInventory::NPOS) return OpStatus::NotFound;
+        nowBorrowed = !inventory.isBorrowed(slot);
+        return transitionLocked(id, nowBorrowed) ? OpStatus::Ok : OpStatus::Conflict;
+    }
+
+    // --- File I/O Logic ---
+    // Saves the CSV export and a checkpoint, which empties the journal.
+    // Both are incremental while only statuses changed since the last
+    // save: the CSV's status fields are patched in place and the snapshot
+    // gets a status delta. The CSV goes first so the snapshot is never
+    // older than it. Both are written from one StatusCut, so borrowing
+    // and returning go on meanwhile; those changes go to the next save.
+    bool saveToFile() {
+        MetricTimer timer(metrics, MetricOp::Save);
+        shared_lock<CatalogMutex> guard(catalogLock);
+        lock_guard<Mutex> saving(saveMutex);
+        SaveCut cut = cutForSave(true);
+        if (!patchCSVLocked(cut.status) && !saveCSVLocked(cut.status)) {
+            restoreChanges(cut, Baseline::Csv);
+            restoreChanges(cut, Baseline::Snapshot);
+            journal.releaseMark();
+            return false;
+        }
+        return checkpointCut(cut);
+    }
+
+    // saveToFile on the background writer, so the caller never waits on
+    // disk. Requests made before it starts share one save (and result);
+    // done, if given, is called with the result on that thread.
+    shared_future<bool> saveAsync(function<void(bool)> done = nullptr) {
+        shared_ptr<QueuedSave> save;
+        bool first = false;
+        {
+            lock_guard<Mutex> guard(saveQueueMutex);
+            if (!queuedSave) {
+                queuedSave = make_shared<QueuedSave>();
+                queuedSave->result = queuedSave->done.get_future().share();
+                first = true;
+            }
+            save = queuedSave;
+            if (done) save->callbacks.push_back(move(done));
+        }
+        if (first) journal.post([this] { runQueuedSave(); });
+        return save->result;
+    }
+
+    // Resolves to true once every change made before the call is in the
+    // journal and synced, false if it could not be written. Mutations
+    // themselves never wait for this (see JournalOptions::writeBehind).
+    future<bool> flush() { return journal.sync(); }
+
+    bool exportCSV(const string& path) const { return pin().exportCSV(path); }
+
+    // Merges a CSV file and checkpoints, instead of journaling every record
+    bool importCSV(const string& path) {
+        MetricTimer timer(metrics, MetricOp::Load);
+        unique_lock<CatalogMutex> guard(catalogLock);
+        return importCSVLocked(path) && checkpointLocked();
+    }
+
+    // Writes the catalog as a packed archive (section 11) from one pinned
+    // version, so borrowing goes on while it is written
+    bool exportPack(const string& path) const {
+        CatalogVersion version = pin();
+        PackWriter writer;
+        bool ok = writer.open(path);
+        if (ok) {
+            version.listAll([&writer](const ItemView& item) { writer.add(item); });
+            ok = writer.finish();
+        }
+        if (!ok) {
+            if (log) log(LogLevel::Warning, "Error writing " + path + "!");
+            return false;
+        }
+        metrics.addBytesWritten(IoTarget::Pack, writer.bytesWritten());
+        return true;
+    }
+
+    // Merges a packed archive and checkpoints, like importCSV
+    bool importPack(const string& path) {
+        MetricTimer timer(metrics, MetricOp::Load);
+        unique_lock<CatalogMutex> guard(catalogLock);
+        return importPackLocked(path) && checkpointLocked();
+    }
+
+private:
+    // Returns false when the snapshot could not be used and the CSV was read
+    bool loadFromFile() {
+        if (snapshotIsCurrent()) {
+            if (inventory.attachSnapshot(snapshotFile, snapshotGeneration, journalResume)) {
+                indexesBuilt = false;
+                metrics.addBytesRead(IoTarget::Snapshot, fileBytes(snapshotFile));
+                savedGeneration = snapshotGeneration;
+                if (snapshotGeneration != 0 &&
+                    inventory.applyStatusDelta(deltaFile, snapshotGeneration, savedGeneration, journalResume)) {
+                    metrics.addBytesRead(IoTarget::Snapshot, fileBytes(deltaFile));
+                }
+                if (log) log(LogLevel::Info, "Data loaded from " + snapshotFile);
+                return true;
+            }
+            if (log) log(LogLevel::Warning, "Snapshot unreadable, falling back to " + filename);
+        }
+        importCSVLocked(filename);
+        return false;
+    }
+
+    // recordOffsets, if given, receives the start of every 64th record
+    // and the end of the file
+    bool exportCSVLocked(const string& path, const StatusCut& cut, vector<uint64_t>* recordOffsets = nullptr) const {
+        ofstream outFile(path, ios::binary);
+        if (!outFile) {
+            if (log) log(LogLevel::Warning, "Error saving data!");
+            return false;
+        }
+        uint64_t written = writeCSV(outFile, cut, recordOffsets);
+        if (recordOffsets) recordOffsets->push_back(written);
+        outFile.close();
+        if (outFile) metrics.addBytesWritten(IoTarget::Csv, written);
+        return bool(outFile);
+    }
+
+    // Returns the number of bytes written
+    uint64_t writeCSV(ofstream& outFile, const StatusCut& cut, vector<uint64_t>* recordOffsets) const {
+        const vector<int>& order = inventory.inIdOrder();
+        uint64_t written = 0;
+        if (recordOffsets) {
+            recordOffsets->clear();
+            recordOffsets->reserve(order.size() / 64 + 2);
+        }
+        if (scanPool.size() > 1 && order.size() >= PARALLEL_EXPORT_ITEMS) {
+            // Rounds of chunks are formatted on the pool and written in
+            // ID order, so at most a few chunks per lane are buffered
+            static_assert(SCAN_CHUNK_ITEMS % 64 == 0, "chunks start on a 64-record boundary");
+            size_t chunks = chunksOf(order.size());
+            size_t perRound = size_t(scanPool.size()) * 4;
+            vector<string> blocks(perRound);
+            vector<vector<uint64_t>> marks(perRound); // Record offsets within each block
+            for (size_t base = 0; base < chunks && outFile; base += perRound) {
+                size_t count = min(perRound, chunks - base);
+                scanPool.run(count, [&](size_t i) {
+                    size_t first = (base + i) * SCAN_CHUNK_ITEMS;
+                    size_t last = min(order.size(), first + SCAN_CHUNK_ITEMS);
+                    blocks[i].clear();
+                    marks[i].clear();
+                    for (size_t k = first; k < last; ++k) {
+                        if (recordOffsets && k % 64 == 0) marks[i].push_back(blocks[i].size());
+                        appendCsvRecord(blocks[i], order[k], cut);
+                    }
+                });
+                for (size_t i = 0; i < count; ++i) {
+                    if (recordOffsets) {
+                        for (uint64_t mark : marks[i]) recordOffsets->push_back(written + mark);
+                    }
+                    outFile.write(blocks[i].data(), streamsize(blocks[i].size()));
+                    written += blocks[i].size();
+                }
+            }
+            return written;
+        }
+        // Formatted straight from the columns into a block buffer that is
+        // written 1 MiB at a time
+        string block;
+        block.reserve(1 << 20);
+        for (size_t k = 0; k < order.size(); ++k) {
+            if (recordOffsets && k % 64 == 0) recordOffsets->push_back(written + block.size());
+            appendCsvRecord(block, order[k], cut);
+            if (block.size() >= (1 << 20) - 4096) {
+                outFile.write(block.data(), streamsize(block.size()));
+                written += block.size();
+                block.clear();
+            }
+        }
+        outFile.write(block.data(), streamsize(block.size()));
+        return written + block.size();
+    }
+
+    // Writes the CSV file whole, recording where its records start
+    bool saveCSVLocked(const StatusCut& cut) {
+        CsvLayout layout;
+        if (!exportCSVLocked(filename, cut, &layout.recordOffsets)) return false;
+        error_code ec;
+        layout.bytes = layout.recordOffsets.back();
+        layout.written = filesystem::last_write_time(filename, ec);
+        if (ec) layout.recordOffsets.clear();
+        csvLayout = move(layout);
+        return true;
+    }
 
-public:
-    LibraryItem(int id, string title) : id(id), title(title), isBorrowed(false) {}
-    
-    virtual ~LibraryItem() {} // Virtual destructor is essential
+    // Rewrites just the status fields that changed since the last full
+    // export, reading and writing only the 64-record runs holding them.
+    // False if the file is no longer that export (added or removed items,
+    // edited since); the caller then writes it whole.
+    bool patchCSVLocked(const StatusCut& cut) {
+        const DirtyWords& changes = cut.changesSince(Baseline::Csv);
+        if (changes.isStale() || csvLayout.recordOffsets.empty()) return false;
+        if (changes.count() * 8 > (inventory.size() + 63) / 64) return false; // Cheaper to write it all
+        error_code ec;
+        auto modified = filesystem::last_write_time(filename, ec);
+        if (ec || modified != csvLayout.written || fileBytes(filename) != csvLayout.bytes) return false;
 
-    // Pure virtual function
-    virtual void display() const = 0; 
-    virtual string getType() const = 0;
+        vector<size_t> runs;
+        changes.forEach([&](size_t word) {
+            size_t last = min(inventory.size(), (word + 1) * 64);
+            for (size_t slot = word * 64; slot < last; ++slot) runs.push_back(inventory.positionOf(int(slot)) / 64);
+        });
+        sort(runs.begin(), runs.end());
+        runs.erase(unique(runs.begin(), runs.end()), runs.end());
+        if (runs.empty()) return true;
 
-    // Getters and Setters
-    int getId() const { return id; }
-    string getTitle() const { return title; }
-    bool getStatus() const { return isBorrowed; }
-    
-    void setBorrowed(bool status) { isBorrowed = status; }
+        fstream file(filename, ios::in | ios::out | ios::binary);
+        if (!file) return false;
+        const vector<int>& order = inventory.inIdOrder();
+        string run;
+        uint64_t patched = 0;
+        for (size_t r : runs) {
+            uint64_t begin = csvLayout.recordOffsets[r];
+            run.resize(size_t(csvLayout.recordOffsets[r + 1] - begin));
+            file.seekg(streamoff(begin));
+            file.read(&run[0], streamsize(run.size()));
+            if (!file || !setStatusFields(run, order, r * 64, cut)) return false;
+            file.seekp(streamoff(begin));
+            file.write(run.data(), streamsize(run.size()));
+            patched += run.size();
+        }
+        file.close();
+        if (!file) return false;
+        metrics.addBytesRead(IoTarget::Csv, patched);
+        metrics.addBytesWritten(IoTarget::Csv, patched);
+        csvLayout.written = filesystem::last_write_time(filename, ec);
+        if (ec) csvLayout.recordOffsets.clear();
+        return true;
+    }
+
+    // run holds the exported records at positions first, first + 1, ...;
+    // sets each one's borrowed field. False if a record does not parse.
+    bool setStatusFields(string& run, const vector<int>& order, size_t first, const StatusCut& cut) const {
+        size_t pos = 0;
+        auto expect = [&](char c) { return pos < run.size() && run[pos++] == c; };
+        for (size_t k = first; pos < run.size(); ++k) {
+            if (k >= order.size()) return false;
+            for (int field = 0; field < 3; ++field) { // Type, ID, title
+                pos = skipCsvField(run, pos);
+                if (!expect(',')) return false;
+            }
+            if (pos >= run.size() || (run[pos] != '0' && run[pos] != '1')) return false;
+            run[pos++] = cut.borrowed(order[k]) ? '1' : '0';
+            if (!expect(',')) return false;
+            pos = skipCsvField(run, pos); // Author or publisher
+            if (!expect(',')) return false;
+            pos = skipCsvField(run, pos); // Pages or volume
+            if (!expect('\n')) return false;
+        }
+        return true;
+    }
+
+    // Same layout as Book/Journal::toCSV
+    void appendCsvRecord(string& block, int slot, const StatusCut& cut) const {
+        char digits[16];
+        auto appendInt = [&](int value) {
+            block.append(digits, size_t(to_chars(digits, digits + sizeof(digits), value).ptr - digits));
+        };
+        block += (inventory.type(slot) == ItemType::Book ? "BOOK," : "JOURNAL,");
+        appendInt(inventory.id(slot));
+        block += ',';
+        appendCsvField(block, inventory.title(slot));
+        block += (cut.borrowed(slot) ? ",1," : ",0,");
+        appendCsvField(block, inventory.creator(slot));
+        block += ',';
+        appendInt(inventory.number(slot));
+        block += '\n';
+    }
+
+    // Merges a packed archive into the inventory; its records replace
+    // items with the same ID. A damaged block ends the import, keeping the
+    // items before it. False if the file is not a readable archive.
+    bool importPackLocked(const string& path) {
+        PackReader reader;
+        if (!reader.open(path)) {
+            if (log) log(LogLevel::Warning, "Cannot read " + path);
+            return false;
+        }
+        inventory.reserve(inventory.size() + reader.size(), size_t(reader.rawBytes()));
+        bool complete = reader.forEach([this](const ItemView& item) {
+            int slot = inventory.find(item.id);
+            if (slot != FlatInventory::NPOS) inventory.erase(slot);
+            inventory.insert(item.type, item.id, item.title, item.creator, item.number, item.borrowed);
+        });
+        metrics.addBytesRead(IoTarget::Pack, reader.fileBytes());
+        rebuildIndexes();
+        dropSuggestIndex();
+        dropAttributeIndex();
+        if (log) {
+            if (complete) log(LogLevel::Info, "Data loaded from " + path);
+            else log(LogLevel::Warning, path + " is damaged; the items after the first bad block were skipped");
+        }
+        return true;
+    }
+
+    // Merges a CSV file into the inventory; a repeated ID keeps the last record.
+    // False if the file cannot be read.
+    bool importCSVLocked(const string& path) {
+        MappedFile file;
+        if (!file.open(path)) return false; // File might not exist on first run
+        metrics.addBytesRead(IoTarget::Csv, file.size());
 
-    // Serialization helper (for File I/O)
-    virtual string toCSV() const {
-        return to_string(id) + "," + title + "," + (isBorrowed ? "1" : "0");
+        // Fields are views into the mapped file and are copied exactly
+        // once, into the inventory columns
+        size_t malformed = 0;
+        auto store = [this](const ParsedItem& item) {
+            int slot = inventory.find(item.id);
+            if (slot != FlatInventory::NPOS) inventory.erase(slot); // Last record wins
+            inventory.insert(item.type, item.id, item.title, item.creator, item.number, item.borrowed);
+        };
+        if (importThreads > 1 && file.size() >= PARALLEL_IMPORT_BYTES) {
+            // Parse chunks on all workers, then merge them in file order
+            vector<ParsedChunk> chunks = parseCSVParallel(file.data(), file.size(), importThreads);
+            size_t total = 0;
+            for (const ParsedChunk& chunk : chunks) total += chunk.items.size();
+            inventory.reserve(inventory.size() + total, file.size() / 2);
+            for (const ParsedChunk& chunk : chunks) {
+                for (const ParsedItem& item : chunk.items) store(item);
+                malformed += chunk.malformed;
+            }
+        } else {
+            // Size the columns up front from the file size (records are
+            // rarely shorter than ~40 bytes, titles take about half of each)
+            inventory.reserve(file.size() / 40, file.size() / 2);
+            CsvReader reader(file.data(), file.size());
+            vector<string_view> fields;
+            ParsedItem item;
+            while (reader.next(fields)) {
+                if (fields.size() == 1 && fields[0].empty()) continue; // Blank line
+                if (!parseItemFields(fields, item)) {
+                    ++malformed;
+                    continue;
+                }
+                store(item);
+            }
+        }
+        if (malformed > 0 && log) {
+            log(LogLevel::Warning, "Skipped " + to_string(malformed) + " malformed line(s) in " + path);
+        }
+        rebuildIndexes(); // One bulk pass instead of per-line index updates
+        dropSuggestIndex();
+        dropAttributeIndex();
+        if (log) log(LogLevel::Info, "Data loaded from " + path);
+        return true;
     }
 };
 
+template <typename Locking, typename Logging>
+BasicCatalogVersion<Locking, Logging>::BasicCatalogVersion(const Manager& lib)
+    : lib(&lib), guard(lib.catalogLock), status(lib.pinStatus()) {}
+
+template <typename Locking, typename Logging>
+size_t BasicCatalogVersion<Locking, Logging>::size() const { return lib->inventory.size(); }
+
+template <typename Locking, typename Logging>
+template <typename Visit>
+bool BasicCatalogVersion<Locking, Logging>::findItem(int id, Visit&& visit) const {
+    int slot = lib->inventory.find(id);
+    if (slot == Manager::FlatInventory::NPOS) return false;
+    visit(lib->viewOf(slot, status));
+    return true;
+}
+
+template <typename Locking, typename Logging>
+template <typename Visit>
+void BasicCatalogVersion<Locking, Logging>::listAll(Visit&& visit, Execution mode) const {
+    const vector<int>& order = lib->inventory.inIdOrder();
+    if (mode == Execution::Serial) {
+        for (int slot : order) {
+            visit(lib->viewOf(slot, status));
+        }
+        return;
+    }
+    lib->scanPool.run(Manager::chunksOf(order.size()), [&](size_t chunk) {
+        size_t last = min(order.size(), (chunk + 1) * Manager::SCAN_CHUNK_ITEMS);
+        for (size_t i = chunk * Manager::SCAN_CHUNK_ITEMS; i < last; ++i) {
+            visit(lib->viewOf(order[i], status));
+        }
+    });
+}
+
+template <typename Locking, typename Logging>
+bool BasicCatalogVersion<Locking, Logging>::exportCSV(const string& path) const {
+    return lib->exportCSVLocked(path, status);
+}
+
+using LibraryManager = BasicLibraryManager<>;
+using CatalogVersion = LibraryManager::CatalogVersion;
+// For a catalog only ever used from one thread, such as a kiosk
+using SingleThreadedLibrary = BasicLibraryManager<SingleThreaded>;
+
 // ==========================================
-// 2. Derived Classes
+// 14. Sharded Catalog (Router over Shards)
 // ==========================================
-class Book : public LibraryItem {
+// A catalog too large for one manager is split by ID into shards, each
+// a complete catalog with its own files, journal and indexes. The router
+// sends ID operations to the one shard owning the ID, splits batches by
+// shard, and fans searches, filters and listings out to every shard at
+// once, merging the per-shard results (each in ascending ID order) into
+// one ascending run. Shards are reached through CatalogShard only, so a
+// shard served by another process can later stand in for a local one.
+
+// How IDs map to shards. Hash spreads any ID pattern evenly; Range gives
+// shard i the IDs below bounds[i] (the last shard takes the rest), so a
+// range can be moved or split off as a unit.
+struct ShardMap {
+    enum class Kind : uint8_t { Hash, Range };
+    Kind kind = Kind::Hash;
+    size_t shards = 1;
+    vector<int> bounds; // Range only: shards - 1 ascending exclusive upper bounds
+
+    static ShardMap hashed(size_t shards) { return {Kind::Hash, max<size_t>(1, shards), {}}; }
+    static ShardMap ranges(vector<int> bounds) {
+        size_t shards = bounds.size() + 1;
+        return {Kind::Range, shards, move(bounds)};
+    }
+
+    size_t shardOf(int id) const {
+        if (kind == Kind::Range) return size_t(upper_bound(bounds.begin(), bounds.end(), id) - bounds.begin());
+        // Not the inventory's multiplicative hash: that one takes the top
+        // bits, which would then be nearly equal within a shard
+        uint32_t h = uint32_t(id);
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h % shards;
+    }
+};
+
+// Items copied out of one shard's callbacks, to be merged after the
+// shard has returned. Strings go into one shared buffer, so a search
+// with many hits costs no allocation per hit.
+class CollectedItems {
 private:
-    string author;
-    int pages;
+    struct Entry {
+        int id;
+        int number;
+        ItemType type;
+        bool borrowed;
+        uint32_t titleLength;
+        uint32_t creatorLength;
+        size_t text; // Title, then creator, in texts
+    };
+    vector<Entry> entries;
+    string texts;
 
 public:
-    Book(int id, string title, string author, int pages) 
-        : LibraryItem(id, title), author(author), pages(pages) {}
+    void add(const ItemView& view) {
+        entries.push_back({view.id, view.number, view.type, view.borrowed, uint32_t(view.title.size()),
+                           uint32_t(view.creator.size()), texts.size()});
+        texts += view.title;
+        texts += view.creator;
+    }
 
-    void display() const override {
-        cout << "[Book] ID: " << id << " | Title: " << setw(20) << left << title 
-             << " | Author: " << setw(15) << left << author 
-             << " | Status: " << (isBorrowed ? "Borrowed" : "Available") << endl;
+    size_t size() const { return entries.size(); }
+    int id(size_t i) const { return entries[i].id; }
+    ItemView view(size_t i) const {
+        const Entry& entry = entries[i];
+        string_view text(texts.data() + entry.text, entry.titleLength + entry.creatorLength);
+        return {entry.type, entry.id, text.substr(0, entry.titleLength), text.substr(entry.titleLength),
+                entry.number, entry.borrowed};
     }
+};
+
+// One partition as the router uses it; the calls mean what they mean on
+// LibraryManager. Visits run on the calling thread in ascending ID order.
+class CatalogShard {
+public:
+    using Visitor = function<void(const ItemView&)>;
+    virtual ~CatalogShard() = default;
 
-    string getType() const override { return "BOOK"; }
+    virtual OpStatus addItem(const CatalogItem& item) = 0;
+    virtual vector<OpStatus> addItems(const vector<CatalogItem>& items) = 0;
+    virtual OpStatus removeItem(int id) = 0;
+    virtual vector<OpStatus> removeItems(const vector<int>& ids) = 0;
+    virtual bool tryBorrow(int id) = 0;
+    virtual bool tryReturn(int id) = 0;
+    virtual OpStatus toggleBorrow(int id, bool& nowBorrowed) = 0;
+    virtual vector<OpStatus> borrowMany(const vector<int>& ids) = 0;
+    virtual vector<OpStatus> returnMany(const vector<int>& ids) = 0;
 
-    string toCSV() const override {
-        return "BOOK," + LibraryItem::toCSV() + "," + author + "," + to_string(pages);
+    virtual bool findItem(int id, const Visitor& visit) const = 0;
+    virtual size_t searchItem(string_view keyword, bool ignoreCase, const Visitor& visit) const = 0;
+    virtual size_t searchKeywords(const string& query, const Visitor& visit) const = 0;
+    virtual size_t filterItems(const ItemQuery& query, const Visitor& visit) const = 0;
+    virtual size_t countItems(const ItemQuery& query) const = 0;
+    virtual void listAll(const Visitor& visit) const = 0;
+    virtual CatalogStats stats() const = 0;
+    virtual size_t size() const = 0;
+
+    virtual bool saveToFile() = 0;
+    virtual future<bool> flush() = 0;
+};
+
+// A shard in this process
+class LocalShard : public CatalogShard {
+private:
+    LibraryManager lib;
+
+public:
+    explicit LocalShard(LibraryOptions options) : lib(move(options)) {}
+
+    LibraryManager& manager() { return lib; }
+
+    OpStatus addItem(const CatalogItem& item) override { return lib.addItem(item); }
+    vector<OpStatus> addItems(const vector<CatalogItem>& items) override { return lib.addItems(items); }
+    OpStatus removeItem(int id) override { return lib.removeItem(id); }
+    vector<OpStatus> removeItems(const vector<int>& ids) override { return lib.removeItems(ids); }
+    bool tryBorrow(int id) override { return lib.tryBorrow(id); }
+    bool tryReturn(int id) override { return lib.tryReturn(id); }
+    OpStatus toggleBorrow(int id, bool& nowBorrowed) override { return lib.toggleBorrow(id, nowBorrowed); }
+    vector<OpStatus> borrowMany(const vector<int>& ids) override { return lib.borrowMany(ids); }
+    vector<OpStatus> returnMany(const vector<int>& ids) override { return lib.returnMany(ids); }
+
+    bool findItem(int id, const Visitor& visit) const override { return lib.findItem(id, visit); }
+    size_t searchItem(string_view keyword, bool ignoreCase, const Visitor& visit) const override {
+        return lib.searchItem(keyword, visit, ignoreCase);
+    }
+    size_t searchKeywords(const string& query, const Visitor& visit) const override {
+        return lib.searchKeywords(query, visit);
+    }
+    size_t filterItems(const ItemQuery& query, const Visitor& visit) const override {
+        return lib.filterItems(query, visit);
     }
+    size_t countItems(const ItemQuery& query) const override { return lib.countItems(query); }
+    void listAll(const Visitor& visit) const override { lib.listAll(visit); }
+    CatalogStats stats() const override { return lib.stats(); }
+    size_t size() const override { return lib.size(); }
+
+    bool saveToFile() override { return lib.saveToFile(); }
+    future<bool> flush() override { return lib.flush(); }
 };
 
-class Journal : public LibraryItem {
+class ShardedLibrary {
 private:
-    string publisher;
-    int volume;
+    ShardMap map;
+    vector<unique_ptr<CatalogShard>> shards;
+    mutable ScanPool fanOut; // One lane per shard
+
+    CatalogShard& owner(int id) const { return *shards[min(map.shardOf(id), shards.size() - 1)]; }
+
+    // Calls body(shard, index) for every shard, all at once
+    template <typename Body>
+    void eachShard(Body&& body) const {
+        fanOut.run(shards.size(), [&](size_t s) { body(*shards[s], s); });
+    }
+
+    // Runs a batch operation as one sub-batch per shard, all at once, and
+    // puts the results back in input order
+    template <typename Input, typename IdOf, typename Apply>
+    vector<OpStatus> scatter(const vector<Input>& batch, IdOf idOf, Apply apply) {
+        vector<vector<size_t>> positions(shards.size());
+        for (size_t i = 0; i < batch.size(); ++i) positions[min(map.shardOf(idOf(batch[i])), shards.size() - 1)].push_back(i);
+        vector<OpStatus> results(batch.size(), OpStatus::Ok);
+        eachShard([&](CatalogShard& shard, size_t s) {
+            if (positions[s].empty()) return;
+            vector<Input> part;
+            part.reserve(positions[s].size());
+            for (size_t i : positions[s]) part.push_back(batch[i]);
+            vector<OpStatus> partResults = apply(shard, part);
+            for (size_t k = 0; k < positions[s].size(); ++k) results[positions[s][k]] = partResults[k];
+        });
+        return results;
+    }
+
+    // Runs query(shard, collect) on every shard at once and visits the
+    // collected items merged into ascending ID order; returns their number
+    template <typename Query, typename Visit>
+    size_t gather(Query query, Visit& visit) const {
+        vector<CollectedItems> runs(shards.size());
+        eachShard([&](const CatalogShard& shard, size_t s) {
+            CollectedItems& run = runs[s];
+            query(shard, [&run](const ItemView& view) { run.add(view); });
+        });
+        // Shards are few, so the smallest head is found by a linear scan
+        vector<size_t> next(runs.size(), 0);
+        size_t total = 0;
+        for (const CollectedItems& run : runs) total += run.size();
+        for (size_t done = 0; done < total; ++done) {
+            size_t best = SIZE_MAX;
+            for (size_t s = 0; s < runs.size(); ++s) {
+                if (next[s] < runs[s].size() && (best == SIZE_MAX || runs[s].id(next[s]) < runs[best].id(next[best]))) {
+                    best = s;
+                }
+            }
+            visit(runs[best].view(next[best]++));
+        }
+        return total;
+    }
 
 public:
-    Journal(int id, string title, string publisher, int volume) 
-        : LibraryItem(id, title), publisher(publisher), volume(volume) {}
+    // Local shards; shard i keeps its files under options.dataPath plus
+    // ".shard<i>". Unless set, each shard gets an equal part of the cores
+    // for its scans and imports. The shards load in parallel.
+    ShardedLibrary(ShardMap shardMap, LibraryOptions options = {})
+        : map(move(shardMap)), shards(map.shards), fanOut(unsigned(map.shards)) {
+        unsigned perShard = max(1u, thread::hardware_concurrency() / unsigned(map.shards));
+        if (options.scanThreads == 0) options.scanThreads = perShard;
+        if (options.importThreads == 0) options.importThreads = perShard;
+        fanOut.run(shards.size(), [&](size_t s) {
+            LibraryOptions shardOptions = options;
+            shardOptions.dataPath += ".shard" + to_string(s);
+            shards[s] = make_unique<LocalShard>(move(shardOptions));
+        });
+    }
+
+    // Shards made elsewhere (remote ones, say): one per map.shards, in order
+    ShardedLibrary(ShardMap shardMap, vector<unique_ptr<CatalogShard>> shardList)
+        : map(move(shardMap)), shards(move(shardList)), fanOut(unsigned(max<size_t>(1, shards.size()))) {}
+
+    const ShardMap& shardMap() const { return map; }
+    size_t shardCount() const { return shards.size(); }
+    CatalogShard& shard(size_t index) { return *shards[index]; }
+    size_t shardOf(int id) const { return min(map.shardOf(id), shards.size() - 1); }
+
+    // --- Routed to the owning shard ---
+    OpStatus addItem(const CatalogItem& item) { return owner(itemId(item)).addItem(item); }
+    OpStatus removeItem(int id) { return owner(id).removeItem(id); }
+    bool tryBorrow(int id) { return owner(id).tryBorrow(id); }
+    bool tryReturn(int id) { return owner(id).tryReturn(id); }
+    OpStatus toggleBorrow(int id, bool& nowBorrowed) { return owner(id).toggleBorrow(id, nowBorrowed); }
+
+    template <typename Visit>
+    bool findItem(int id, Visit&& visit) const {
+        return owner(id).findItem(id, [&](const ItemView& view) { visit(view); });
+    }
+
+    // --- Split by shard; results in input order ---
+    vector<OpStatus> addItems(const vector<CatalogItem>& items) {
+        return scatter(items, [](const CatalogItem& item) { return itemId(item); },
+                       [](CatalogShard& shard, const vector<CatalogItem>& part) { return shard.addItems(part); });
+    }
+    vector<OpStatus> removeItems(const vector<int>& ids) {
+        return scatter(ids, [](int id) { return id; },
+                       [](CatalogShard& shard, const vector<int>& part) { return shard.removeItems(part); });
+    }
+    vector<OpStatus> borrowMany(const vector<int>& ids) {
+        return scatter(ids, [](int id) { return id; },
+                       [](CatalogShard& shard, const vector<int>& part) { return shard.borrowMany(part); });
+    }
+    vector<OpStatus> returnMany(const vector<int>& ids) {
+        return scatter(ids, [](int id) { return id; },
+                       [](CatalogShard& shard, const vector<int>& part) { return shard.returnMany(part); });
+    }
+
+    // --- Fanned out to every shard, merged in ascending ID order ---
+    template <typename Visit>
+    size_t searchItem(string_view keyword, Visit&& visit, bool ignoreCase = false) const {
+        return gather([&](const CatalogShard& shard, const CatalogShard::Visitor& collect) {
+            shard.searchItem(keyword, ignoreCase, collect);
+        }, visit);
+    }
+
+    template <typename Visit>
+    size_t searchKeywords(const string& query, Visit&& visit) const {
+        return gather([&](const CatalogShard& shard, const CatalogShard::Visitor& collect) {
+            shard.searchKeywords(query, collect);
+        }, visit);
+    }
+
+    template <typename Visit>
+    size_t filterItems(const ItemQuery& query, Visit&& visit) const {
+        return gather([&](const CatalogShard& shard, const CatalogShard::Visitor& collect) {
+            shard.filterItems(query, collect);
+        }, visit);
+    }
+
+    // Range shards are listed one after another, with nothing to merge;
+    // Parallel visits every shard at once, in no overall order
+    template <typename Visit>
+    void listAll(Visit&& visit, Execution mode = Execution::Serial) const {
+        if (mode == Execution::Parallel) {
+            eachShard([&](const CatalogShard& shard, size_t) { shard.listAll([&](const ItemView& view) { visit(view); }); });
+        } else if (map.kind == ShardMap::Kind::Range) {
+            for (const auto& shard : shards) {
+                shard->listAll([&](const ItemView& view) { visit(view); });
+            }
+        } else {
+            gather([](const CatalogShard& shard, const CatalogShard::Visitor& collect) { shard.listAll(collect); },
+                   visit);
+        }
+    }
+
+    // --- Summed over the shards ---
+    size_t countItems(const ItemQuery& query) const {
+        vector<size_t> counts(shards.size());
+        eachShard([&](const CatalogShard& shard, size_t s) { counts[s] = shard.countItems(query); });
+        size_t total = 0;
+        for (size_t count : counts) total += count;
+        return total;
+    }
+
+    CatalogStats stats() const {
+        vector<CatalogStats> parts(shards.size());
+        eachShard([&](const CatalogShard& shard, size_t s) { parts[s] = shard.stats(); });
+        CatalogStats totals;
+        for (const CatalogStats& part : parts) {
+            totals.items += part.items;
+            totals.books += part.books;
+            totals.journals += part.journals;
+            totals.borrowed += part.borrowed;
+        }
+        return totals;
+    }
 
-    void display() const override {
-        cout << "[Journal] ID: " << id << " | Title: " << setw(20) << left << title 
-             << " | Publisher: " << setw(15) << left << publisher 
-             << " | Vol: " << volume 
-             << " | Status: " << (isBorrowed ? "Borrowed" : "Available") << endl;
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) total += shard->size();
+        return total;
     }
 
-    string getType() const override { return "JOURNAL"; }
+    // Saves every shard at once; true only if all of them saved
+    bool saveToFile() {
+        vector<char> saved(shards.size());
+        eachShard([&](CatalogShard& shard, size_t s) { saved[s] = shard.saveToFile(); });
+        return all_of(saved.begin(), saved.end(), [](char ok) { return ok != 0; });
+    }
 
-    string toCSV() const override {
-        return "JOURNAL," + LibraryItem::toCSV() + "," + publisher + "," + to_string(volume);
+    // Resolves once every shard's journal holds the changes made so far
+    future<bool> flush() {
+        vector<future<bool>> parts;
+        for (auto& shard : shards) parts.push_back(shard->flush());
+        return async(launch::deferred, [parts = move(parts)]() mutable {
+            bool ok = true;
+            for (future<bool>& part : parts) ok = part.get() && ok;
+            return ok;
+        });
     }
 };
 
 // ==========================================
-// 3. Manager Class (STL & Logic)
+// 15. Console Presentation
 // ==========================================
-class LibraryManager {
+// Everything the interactive menu prints. LibraryManager only returns
+// statuses and item views, so code embedding it pays for no formatting.
+void printItem(const ItemView& item) {
+    if (item.type == ItemType::Book) {
+        printBookLine(item.id, item.title, item.creator, item.borrowed);
+    } else {
+        printJournalLine(item.id, item.title, item.creator, item.number, item.borrowed);
+    }
+}
+
+string formatDuration(uint64_t nanos) {
+    char text[32];
+    if (nanos < 1000) snprintf(text, sizeof(text), "%llu ns", static_cast<unsigned long long>(nanos));
+    else if (nanos < 1000000) snprintf(text, sizeof(text), "%.1f us", double(nanos) / 1e3);
+    else if (nanos < 1000000000) snprintf(text, sizeof(text), "%.1f ms", double(nanos) / 1e6);
+    else snprintf(text, sizeof(text), "%.2f s", double(nanos) / 1e9);
+    return text;
+}
+
+string formatBytes(uint64_t bytes) {
+    char text[32];
+    if (bytes < 1024) snprintf(text, sizeof(text), "%llu B", static_cast<unsigned long long>(bytes));
+    else if (bytes < (1 << 20)) snprintf(text, sizeof(text), "%.1f KiB", double(bytes) / 1024);
+    else snprintf(text, sizeof(text), "%.1f MiB", double(bytes) / (1 << 20));
+    return text;
+}
+
+void consoleLog(LogLevel level, const string& message) {
+    (level == LogLevel::Warning ? cerr : cout) << message << endl;
+}
+
+class ConsoleView {
 private:
-    // map<ID, ItemPointer> for O(log n) search efficiency
-    map<int, unique_ptr<LibraryItem>> inventory;
-    const string filename = "library_data.txt";
+    LibraryManager& lib;
+    shared_future<bool> pendingSave; // Last background save, until reported
 
 public:
-    LibraryManager() {
-        loadFromFile();
+    explicit ConsoleView(LibraryManager& lib) : lib(lib) {}
+
+    void addItem(const CatalogItem& item) {
+        cout << (lib.addItem(item) == OpStatus::Ok ? "Item added successfully.\n" : "Error: ID already exists!\n");
+    }
+
+    void removeItem(int id) {
+        cout << (lib.removeItem(id) == OpStatus::Ok ? "Item removed.\n" : "Item not found.\n");
     }
 
-    ~LibraryManager() {
-        saveToFile();
+    void toggleBorrow(int id) {
+        bool nowBorrowed = false;
+        switch (lib.toggleBorrow(id, nowBorrowed)) {
+        case OpStatus::Ok:
+            cout << "Item status updated to: " << (nowBorrowed ? "Borrowed" : "Available") << endl;
+            break;
+        case OpStatus::Conflict: cout << "Item status was changed by someone else; please try again.\n"; break;
+        default: cout << "Item not found.\n"; break;
+        }
     }
 
-    void addItem(unique_ptr<LibraryItem> item) {
-        if (inventory.find(item->getId()) != inventory.end()) {
-            cout << "Error: ID already exists!\n";
+    void listAll() {
+        if (lib.size() == 0) {
+            cout << "Library is empty.\n";
             return;
         }
-        inventory[item->getId()] = move(item);
-        cout << "Item added successfully.\n";
+        cout << "\n--- Library Inventory ---\n";
+        lib.listAll(printItem);
+        cout << "-------------------------\n";
     }
 
-    void removeItem(int id) {
-        auto it = inventory.find(id);
-        if (it != inventory.end()) {
-            inventory.erase(it);
-            cout << "Item removed.\n";
+    void searchItem(const string& keyword) {
+        cout << "\n--- Search Results ---\n";
+        if (lib.searchItem(keyword, printItem) == 0) {
+            cout << "No items found matching '" << keyword << "'.\n";
+        }
+    }
+
+    void searchKeywords(const string& query) {
+        cout << "\n--- Keyword Search Results ---\n";
+        if (lib.searchKeywords(query, printItem) == 0) {
+            cout << "No items found matching all of '" << query << "'.\n";
+        }
+    }
+
+    void showMetrics() {
+        MetricsReport report = lib.metricsReport();
+        cout << "\n--- Metrics ---\n";
+        string table;
+        for (string_view heading : {"Operation", "Calls", "p50", "p99", "Max"}) appendPadded(table, heading, 14);
+        table += '\n';
+        for (size_t op = 0; op < METRIC_OP_COUNT; ++op) {
+            const LatencyHistogram& histogram = report.latency[op];
+            if (histogram.total == 0) continue;
+            appendPadded(table, METRIC_OP_NAMES[op], 14);
+            appendPadded(table, to_string(histogram.total), 14);
+            appendPadded(table, formatDuration(histogram.quantile(0.5)), 14);
+            appendPadded(table, formatDuration(histogram.quantile(0.99)), 14);
+            table += formatDuration(histogram.maxNanos()) + "\n";
+        }
+        cout << table;
+        for (size_t t = 0; t < IO_TARGET_COUNT; ++t) {
+            cout << "I/O " << IO_TARGET_NAMES[t] << ": " << formatBytes(report.bytesRead[t]) << " read, "
+                 << formatBytes(report.bytesWritten[t]) << " written\n";
+        }
+        cout << "Items: " << report.items << " (" << report.borrowed << " borrowed)\n";
+        for (const auto& entry : report.indexBytes) {
+            cout << "Memory " << entry.first << ": " << formatBytes(entry.second) << "\n";
+        }
+        cout << "---------------\n";
+    }
+
+    // Saves in the background; reportSave() prints the outcome once known
+    void saveToFile() {
+        pendingSave = lib.saveAsync();
+        cout << "Saving in the background...\n";
+    }
+
+    void reportSave() {
+        if (!pendingSave.valid() || pendingSave.wait_for(chrono::seconds(0)) != future_status::ready) return;
+        if (pendingSave.get()) {
+            cout << "Data saved to " << lib.csvPath() << endl;
+            cout << "Data saved to " << lib.snapshotPath() << endl;
         } else {
-            cout << "Item not found.\n";
+            cout << "Error: data could not be saved to " << lib.csvPath() << "!\n";
         }
+        pendingSave = {};
     }
+};
 
-    void searchItem(string keyword) const {
-        cout << "\n--- Search Results ---\n";
-        bool found = false;
-        // Using iterators to traverse the map
-        for (const auto& pair : inventory) {
-            // Check if title contains keyword (simple substring check)
-            if (pair.second->getTitle().find(keyword) != string::npos) {
-                pair.second->display();
-                found = true;
-            }
+// ==========================================
+// 16. Server Mode (Line Protocol over epoll)
+// ==========================================
+// `library --serve [port]` keeps one LibraryManager hot in memory and
+// answers requests on 127.0.0.1 (default port 7878). Clients may
+// pipeline: every request line gets exactly one response, in order.
+//
+// Lines are TAB-separated fields ended by LF; a literal backslash, tab
+// or newline inside a field is sent as \\, \t or \n.
+//   PING | LIST | STATS | METRICS | SAVE | QUIT
+//   GET id | REMOVE id | BORROW id | RETURN id | TOGGLE id
+//   SEARCH keyword [ignore_case] | KEYWORDS query | SUGGEST prefix [k]
+//   FILTER term... | COUNT [term...]
+//   ADD BOOK|JOURNAL id title author|publisher pages|volume [borrowed]
+// where each filter term is one field: type=BOOK|JOURNAL, borrowed=0|1,
+// author=name or publisher=name (repeat author/publisher for "any of").
+// SAVE is answered once the save finishes in the background; other
+// clients are served meanwhile, and its connection's later lines wait.
+// Responses:
+//   OK                         (TOGGLE: OK <0|1>, COUNT: OK <n>,
+//                               STATS: OK <items> <books> <journals> <borrowed>)
+//   OK <n> + n item lines      (GET, LIST, SEARCH, KEYWORDS, SUGGEST, FILTER)
+//   OK <n> + n text lines      (METRICS: Prometheus text format)
+//   ERR <code>                 (e.g. NOT_FOUND, DUPLICATE_ID, BAD_REQUEST)
+// with items as: BOOK|JOURNAL id title author|publisher pages|volume borrowed
+constexpr int DEFAULT_SERVER_PORT = 7878;
+constexpr int DEFAULT_SUGGESTIONS = 10;
+
+void appendEscaped(string& out, string_view field) {
+    for (char c : field) {
+        switch (c) {
+        case '\\': out += "\\\\"; break;
+        case '\t': out += "\\t"; break;
+        case '\n': out += "\\n"; break;
+        default: out += c;
         }
-        if (!found) cout << "No items found matching '" << keyword << "'.\n";
     }
+}
 
-    void toggleBorrow(int id) {
-        auto it = inventory.find(id);
-        if (it != inventory.end()) {
-            bool currentStatus = it->second->getStatus();
-            it->second->setBorrowed(!currentStatus);
-            cout << "Item status updated to: " << (!currentStatus ? "Borrowed" : "Available") << endl;
+string unescapeField(string_view field) {
+    string out;
+    out.reserve(field.size());
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] == '\\' && i + 1 < field.size()) {
+            char next = field[++i];
+            out += next == 't' ? '\t' : next == 'n' ? '\n' : next;
         } else {
-            cout << "Item not found.\n";
+            out += field[i];
         }
     }
+    return out;
+}
 
-    void listAll() const {
-        if (inventory.empty()) {
-            cout << "Library is empty.\n";
+const char* statusCode(OpStatus status) {
+    switch (status) {
+    case OpStatus::Ok: return "OK";
+    case OpStatus::DuplicateId: return "DUPLICATE_ID";
+    case OpStatus::NotFound: return "NOT_FOUND";
+    case OpStatus::AlreadyBorrowed: return "ALREADY_BORROWED";
+    case OpStatus::NotBorrowed: return "NOT_BORROWED";
+    case OpStatus::Conflict: return "CONFLICT";
+    }
+    return "ERROR";
+}
+
+// Turns one request line into its response; independent of the transport
+class ProtocolHandler {
+private:
+    LibraryManager& lib;
+    vector<string_view> fields;
+    string items; // Item lines of the current response
+    bool deferSaves = false;
+    bool saveRequested = false;
+
+    static void appendItem(string& out, const ItemView& item) {
+        out += item.type == ItemType::Book ? "BOOK\t" : "JOURNAL\t";
+        out += to_string(item.id);
+        out += '\t';
+        appendEscaped(out, item.title);
+        out += '\t';
+        appendEscaped(out, item.creator);
+        out += '\t';
+        out += to_string(item.number);
+        out += item.borrowed ? "\t1\n" : "\t0\n";
+    }
+
+    void reply(string& out, OpStatus status) {
+        if (status == OpStatus::Ok) out += "OK\n";
+        else out += string("ERR\t") + statusCode(status) + "\n";
+    }
+
+    void replyItems(string& out, size_t count) {
+        out += "OK\t" + to_string(count) + "\n";
+        out += items;
+    }
+
+    bool idField(size_t index, int& id) const {
+        return fields.size() == index + 1 && parseInt(fields[index], id);
+    }
+
+    // Reads the filter terms from fields[first] on; false if one is invalid
+    bool queryFields(size_t first, ItemQuery& query) const {
+        for (size_t i = first; i < fields.size(); ++i) {
+            size_t eq = fields[i].find('=');
+            if (eq == string_view::npos) return false;
+            string_view key = fields[i].substr(0, eq), value = fields[i].substr(eq + 1);
+            if (key == "type" && (value == "BOOK" || value == "JOURNAL")) {
+                query.type = value == "BOOK" ? ItemType::Book : ItemType::Journal;
+            } else if (key == "borrowed" && (value == "0" || value == "1")) {
+                query.borrowed = value == "1";
+            } else if (key == "author") {
+                query.authors.push_back(unescapeField(value));
+            } else if (key == "publisher") {
+                query.publishers.push_back(unescapeField(value));
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add(string& out) {
+        int id, number;
+        if (fields.size() < 6 || fields.size() > 7 || !parseInt(fields[2], id) || !parseInt(fields[5], number)) {
+            out += "ERR\tBAD_REQUEST\n";
             return;
         }
-        cout << "\n--- Library Inventory ---\n";
-        for (const auto& pair : inventory) {
-            pair.second->display();
+        if (fields[1] != "BOOK" && fields[1] != "JOURNAL") {
+            out += "ERR\tBAD_REQUEST\n";
+            return;
         }
-        cout << "-------------------------\n";
+        bool borrowed = fields.size() == 7 && fields[6] == "1";
+        string title = unescapeField(fields[3]), creator = unescapeField(fields[4]);
+        CatalogItem item = fields[1] == "BOOK" ? CatalogItem(Book(id, move(title), move(creator), number))
+                                               : CatalogItem(Journal(id, move(title), move(creator), number));
+        visit([borrowed](auto& concrete) { concrete.setBorrowed(borrowed); }, item);
+        reply(out, lib.addItem(item));
     }
 
-    // --- File I/O Logic ---
-    void saveToFile() {
-        ofstream outFile(filename);
-        if (!outFile) {
-            cerr << "Error saving data!\n";
-            return;
+public:
+    // With deferSaves, SAVE appends nothing and sets takeSaveRequest();
+    // the transport saves in the background and answers with replySaved
+    explicit ProtocolHandler(LibraryManager& lib, bool deferSaves = false) : lib(lib), deferSaves(deferSaves) {}
+
+    static void replySaved(string& out, bool saved) { out += saved ? "OK\n" : "ERR\tIO_ERROR\n"; }
+
+    bool takeSaveRequest() {
+        bool requested = saveRequested;
+        saveRequested = false;
+        return requested;
+    }
+
+    // Appends the response to out; returns false when the client asked to quit
+    bool handle(string_view line, string& out) {
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        fields.clear();
+        size_t start = 0;
+        while (true) {
+            size_t tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab == string_view::npos ? string_view::npos : tab - start));
+            if (tab == string_view::npos) break;
+            start = tab + 1;
         }
-        for (const auto& pair : inventory) {
-            outFile << pair.second->toCSV() << endl;
+        items.clear();
+        auto collect = [this](const ItemView& item) { appendItem(items, item); };
+        string_view command = fields[0];
+        int id;
+        ItemQuery query;
+
+        if (command == "PING" && fields.size() == 1) {
+            out += "OK\n";
+        } else if (command == "COUNT" && fields.size() == 1) {
+            out += "OK\t" + to_string(lib.size()) + "\n";
+        } else if (command == "STATS" && fields.size() == 1) {
+            CatalogStats totals = lib.stats();
+            out += "OK\t" + to_string(totals.items) + "\t" + to_string(totals.books) + "\t" +
+                   to_string(totals.journals) + "\t" + to_string(totals.borrowed) + "\n";
+        } else if (command == "METRICS" && fields.size() == 1) {
+            string text = formatPrometheus(lib.metricsReport());
+            out += "OK\t" + to_string(count(text.begin(), text.end(), '\n')) + "\n";
+            out += text;
+        } else if (command == "COUNT" && queryFields(1, query)) {
+            out += "OK\t" + to_string(lib.countItems(query)) + "\n";
+        } else if (command == "FILTER" && fields.size() > 1 && queryFields(1, query)) {
+            replyItems(out, lib.filterItems(query, collect));
+        } else if (command == "LIST" && fields.size() == 1) {
+            size_t count = 0;
+            lib.listAll([&](const ItemView& item) { collect(item); ++count; });
+            replyItems(out, count);
+        } else if (command == "GET" && idField(1, id)) {
+            replyItems(out, lib.findItem(id, collect) ? 1 : 0);
+        } else if (command == "SEARCH" && (fields.size() == 2 || fields.size() == 3)) {
+            bool ignoreCase = fields.size() == 3 && fields[2] == "1";
+            replyItems(out, lib.searchItem(unescapeField(fields[1]), collect, ignoreCase));
+        } else if (command == "KEYWORDS" && fields.size() == 2) {
+            replyItems(out, lib.searchKeywords(unescapeField(fields[1]), collect));
+        } else if (command == "SUGGEST" && (fields.size() == 2 || fields.size() == 3)) {
+            int k = DEFAULT_SUGGESTIONS;
+            if (fields.size() == 3 && (!parseInt(fields[2], k) || k < 0)) {
+                out += "ERR\tBAD_REQUEST\n";
+            } else {
+                replyItems(out, lib.suggest(unescapeField(fields[1]), size_t(k), collect));
+            }
+        } else if (command == "ADD") {
+            add(out);
+        } else if (command == "REMOVE" && idField(1, id)) {
+            reply(out, lib.removeItem(id));
+        } else if (command == "BORROW" && idField(1, id)) {
+            reply(out, lib.borrowMany({id})[0]);
+        } else if (command == "RETURN" && idField(1, id)) {
+            reply(out, lib.returnMany({id})[0]);
+        } else if (command == "TOGGLE" && idField(1, id)) {
+            bool nowBorrowed = false;
+            OpStatus status = lib.toggleBorrow(id, nowBorrowed);
+            if (status == OpStatus::Ok) out += nowBorrowed ? "OK\t1\n" : "OK\t0\n";
+            else reply(out, status);
+        } else if (command == "SAVE" && fields.size() == 1) {
+            if (deferSaves) saveRequested = true;
+            else replySaved(out, lib.saveToFile());
+        } else if (command == "QUIT" && fields.size() == 1) {
+            out += "OK\n";
+            return false;
+        } else {
+            out += "ERR\tBAD_REQUEST\n";
+        }
+        return true;
+    }
+};
+
+#if LIBRARY_EPOLL
+volatile sig_atomic_t serverStopRequested = 0;
+
+void requestServerStop(int) { serverStopRequested = 1; }
+
+// Single-threaded, level-triggered epoll loop with non-blocking sockets.
+// A client that stops reading its responses is paused once
+// OUTPUT_HIGH_WATER bytes are queued, so it cannot grow memory unbounded.
+class LibraryServer {
+private:
+    static constexpr size_t OUTPUT_HIGH_WATER = 4 << 20;
+    static constexpr size_t MAX_REQUEST_BYTES = 1 << 20;
+    static constexpr int MAX_EVENTS = 64;
+
+    struct Connection {
+        string in;           // Received bytes not yet handled
+        string out;          // Responses not yet sent
+        size_t outPos = 0;
+        uint64_t serial = 0;     // Tells a reused descriptor's connections apart
+        bool quit = false;       // QUIT seen: close once out is sent
+        bool peerClosed = false; // EOF: answer what arrived, then close
+        bool saving = false;     // SAVE running in the background; later lines wait
+    };
+
+    // A background save that finished, reported by the writer thread
+    struct FinishedSave {
+        int fd;
+        uint64_t serial;
+        bool saved;
+    };
+
+    LibraryManager& lib;
+    ProtocolHandler handler;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1; // eventfd the writer thread signals finished saves on
+    unordered_map<int, Connection> connections;
+    uint64_t nextSerial = 0;
+
+    mutex saveLock; // Guards the two below against the writer thread
+    condition_variable savesDone;
+    vector<FinishedSave> finishedSaves;
+    size_t savesInFlight = 0;
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &event);
+    }
+
+    void closeConnection(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            Connection conn;
+            conn.serial = ++nextSerial;
+            connections.emplace(fd, move(conn));
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    // Saving never blocks the event loop: the answer is appended when the
+    // writer thread reports back, and the connection pauses until then
+    void startSave(int fd, Connection& conn) {
+        conn.saving = true;
+        {
+            lock_guard<mutex> guard(saveLock);
+            ++savesInFlight;
+        }
+        lib.saveAsync([this, fd, serial = conn.serial](bool saved) {
+            lock_guard<mutex> guard(saveLock);
+            finishedSaves.push_back({fd, serial, saved});
+            uint64_t one = 1;
+            ssize_t written = write(wakeFd, &one, sizeof(one));
+            (void)written; // Fails only when the counter is full, i.e. already signalled
+            --savesInFlight;
+            savesDone.notify_all();
+        });
+    }
+
+    void completeSaves() {
+        uint64_t count;
+        while (read(wakeFd, &count, sizeof(count)) > 0) {}
+        vector<FinishedSave> finished;
+        {
+            lock_guard<mutex> guard(saveLock);
+            finished.swap(finishedSaves);
+        }
+        for (const FinishedSave& save : finished) {
+            auto it = connections.find(save.fd);
+            if (it == connections.end() || it->second.serial != save.serial) continue; // Dropped meanwhile
+            ProtocolHandler::replySaved(it->second.out, save.saved);
+            it->second.saving = false;
+            service(save.fd);
+        }
+    }
+
+    // Answers every complete line buffered so far (unless paused)
+    void process(int fd, Connection& conn) {
+        size_t start = 0;
+        while (!conn.quit && !conn.saving && conn.out.size() - conn.outPos < OUTPUT_HIGH_WATER) {
+            size_t newline = conn.in.find('\n', start);
+            if (newline == string::npos) break;
+            if (!handler.handle(string_view(conn.in).substr(start, newline - start), conn.out)) conn.quit = true;
+            if (handler.takeSaveRequest()) startSave(fd, conn);
+            start = newline + 1;
         }
-        cout << "Data saved to " << filename << endl;
+        conn.in.erase(0, start);
     }
 
-    void loadFromFile() {
-        ifstream inFile(filename);
-        if (!inFile) return; // File might not exist on first run
+    // Sends what it can; false if the connection should be dropped
+    bool flush(int fd, Connection& conn) {
+        while (conn.outPos < conn.out.size()) {
+            ssize_t sent = send(fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno == EINTR) continue;
+                return false;
+            }
+            conn.outPos += size_t(sent);
+        }
+        if (conn.outPos == conn.out.size()) {
+            conn.out.clear();
+            conn.outPos = 0;
+        }
+        return true;
+    }
 
-        string line;
-        while (getline(inFile, line)) {
-            stringstream ss(line);
-            string type, segment;
-            vector<string> data;
+    void onReadable(int fd, Connection& conn) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                conn.in.append(buffer, size_t(received));
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                conn.peerClosed = true;
+            }
+            break;
+        }
+        if (conn.in.size() > MAX_REQUEST_BYTES && conn.in.find('\n') == string::npos) {
+            conn.out += "ERR\tBAD_REQUEST\n";
+            conn.in.clear();
+            conn.quit = true;
+        }
+    }
 
-            while (getline(ss, segment, ',')) {
-                data.push_back(segment);
+    // Re-evaluates a connection after any event: answer, send, re-arm
+    void service(int fd) {
+        Connection& conn = connections[fd];
+        while (true) {
+            process(fd, conn);
+            if (!flush(fd, conn)) {
+                closeConnection(fd);
+                return;
             }
+            bool drained = conn.out.empty() && !conn.saving;
+            // Sending everything may have unpaused lines still buffered
+            if (drained && !conn.quit && conn.in.find('\n') != string::npos) continue;
+            if (drained && (conn.quit || conn.peerClosed)) {
+                closeConnection(fd);
+                return;
+            }
+            break;
+        }
+        // Wait for room to write if responses are queued; stop reading
+        // while paused (or at EOF) so level-triggered EPOLLIN does not spin
+        bool pending = !conn.out.empty();
+        bool paused = conn.out.size() - conn.outPos >= OUTPUT_HIGH_WATER || conn.quit || conn.peerClosed ||
+                      conn.saving;
+        uint32_t events = (paused ? 0u : uint32_t(EPOLLIN)) | (pending ? uint32_t(EPOLLOUT) : 0u);
+        watch(fd, events, EPOLL_CTL_MOD);
+    }
+
+public:
+    explicit LibraryServer(LibraryManager& lib) : lib(lib), handler(lib, true) {}
+    LibraryServer(const LibraryServer&) = delete;
+    LibraryServer& operator=(const LibraryServer&) = delete;
 
-            if (data.empty()) continue;
+    // Saves still running call back into this object; wait for them
+    ~LibraryServer() {
+        {
+            unique_lock<mutex> guard(saveLock);
+            savesDone.wait(guard, [this] { return savesInFlight == 0; });
+        }
+        if (wakeFd >= 0) ::close(wakeFd);
+        for (auto& entry : connections) ::close(entry.first);
+        if (epollFd >= 0) ::close(epollFd);
+        if (listenFd >= 0) ::close(listenFd);
+    }
 
-            // Factory Pattern logic for object creation
-            if (data[0] == "BOOK") {
-                // BOOK,id,title,isBorrowed,author,pages
-                int id = stoi(data[1]);
-                string title = data[2];
-                bool borrowed = (data[3] == "1");
-                string author = data[4];
-                int pages = stoi(data[5]);
+    bool listen(int port) {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) return false;
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(uint16_t(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            ::listen(listenFd, SOMAXCONN) < 0) {
+            return false;
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0) return false;
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+        return true;
+    }
 
-                auto book = make_unique<Book>(id, title, author, pages);
-                book->setBorrowed(borrowed);
-                inventory[id] = move(book);
-            } 
-            else if (data[0] == "JOURNAL") {
-                // JOURNAL,id,title,isBorrowed,publisher,volume
-                int id = stoi(data[1]);
-                string title = data[2];
-                bool borrowed = (data[3] == "1");
-                string publisher = data[4];
-                int volume = stoi(data[5]);
+    // Serves until SIGINT/SIGTERM
+    void run() {
+        struct sigaction action{};
+        action.sa_handler = requestServerStop; // No SA_RESTART: epoll_wait returns EINTR
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
 
-                auto journal = make_unique<Journal>(id, title, publisher, volume);
-                journal->setBorrowed(borrowed);
-                inventory[id] = move(journal);
+        epoll_event events[MAX_EVENTS];
+        while (!serverStopRequested) {
+            int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                    continue;
+                }
+                if (fd == wakeFd) {
+                    completeSaves();
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) onReadable(fd, it->second);
+                service(fd);
             }
         }
-        cout << "Data loaded from " << filename << endl;
     }
 };
+#endif
+
+int runServer(const LibraryOptions& options, int port) {
+#if LIBRARY_EPOLL
+    LibraryManager lib(options);
+    LibraryServer server(lib);
+    if (!server.listen(port)) {
+        cerr << "Cannot listen on 127.0.0.1:" << port << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    cout << "Serving on 127.0.0.1:" << port << endl;
+    server.run();
+    cout << "Shutting down." << endl;
+    return 0;
+#else
+    (void)options;
+    (void)port;
+    cerr << "Server mode needs epoll and is only available on Linux." << endl;
+    return 1;
+#endif
+}
 
 // ==========================================
-// 4. Helper Functions
+// 17. Helper Functions
 // ==========================================
 void clearInput() {
     cin.clear();
@@ -231,15 +6250,42 @@ void clearInput() {
 }
 
 // ==========================================
-// 5. Main Execution
+// 18. Main Execution
 // ==========================================
-int main() {
-    LibraryManager lib;
+// Embedders (such as the Python module in library_module.cpp) define
+// LIBRARY_NO_MAIN and include this file for the engine alone.
+#ifndef LIBRARY_NO_MAIN
+int main(int argc, char* argv[]) {
+    LibraryOptions options;
+    options.log = consoleLog;
+    options.metrics = true;
+    options.journal.writeBehind = true; // Menu and server never wait on disk
+    if (argc >= 2 && string_view(argv[1]) == "--serve") {
+        int port = DEFAULT_SERVER_PORT;
+        if (argc >= 3 && (!parseInt(argv[2], port) || port <= 0 || port > 65535)) {
+            cerr << "Usage: " << argv[0] << " --serve [port]" << endl;
+            return 1;
+        }
+        return runServer(options, port);
+    }
+    if (argc >= 2 && (string_view(argv[1]) == "--export-pack" || string_view(argv[1]) == "--import-pack")) {
+        if (argc != 3) {
+            cerr << "Usage: " << argv[0] << " --export-pack|--import-pack <file>" << endl;
+            return 1;
+        }
+        LibraryManager lib(options);
+        bool ok = string_view(argv[1]) == "--export-pack" ? lib.exportPack(argv[2]) : lib.importPack(argv[2]);
+        return ok ? 0 : 1;
+    }
+
+    LibraryManager lib(options);
+    ConsoleView console(lib);
     int choice;
 
     while (true) {
+        console.reportSave();
         cout << "\n=== Advanced Library System ===\n";
-        cout << "1. Add Book\n2. Add Journal\n3. List All\n4. Search by Title\n5. Borrow/Return Item\n6. Remove Item\n7. Exit\n";
+        cout << "1. Add Book\n2. Add Journal\n3. List All\n4. Search by Title\n5. Search by Keywords\n6. Borrow/Return Item\n7. Remove Item\n8. Save & Export CSV\n9. Show Metrics\n10. Exit\n";
         cout << "Choice: ";
         
         if (!(cin >> choice)) {
@@ -249,7 +6295,7 @@ int main() {
         }
         clearInput(); // Consume newline
 
-        if (choice == 7) break;
+        if (choice == 10) break;
 
         try {
             switch (choice) {
@@ -261,8 +6307,7 @@ int main() {
                 cout << "Enter Author: "; getline(cin, author);
                 cout << "Enter Pages: "; cin >> pages;
                 
-                // Using make_unique (C++14 feature)
-                lib.addItem(make_unique<Book>(id, title, author, pages));
+                console.addItem(Book(id, title, author, pages));
                 break;
             }
             case 2: {
@@ -273,30 +6318,42 @@ int main() {
                 cout << "Enter Publisher: "; getline(cin, pub);
                 cout << "Enter Volume: "; cin >> vol;
 
-                lib.addItem(make_unique<Journal>(id, title, pub, vol));
+                console.addItem(Journal(id, title, pub, vol));
                 break;
             }
             case 3:
-                lib.listAll();
+                console.listAll();
                 break;
             case 4: {
                 string keyword;
                 cout << "Enter search keyword: "; getline(cin, keyword);
-                lib.searchItem(keyword);
+                console.searchItem(keyword);
                 break;
             }
             case 5: {
+                string query;
+                cout << "Enter keywords: "; getline(cin, query);
+                console.searchKeywords(query);
+                break;
+            }
+            case 6: {
                 int id;
                 cout << "Enter ID to Borrow/Return: "; cin >> id;
-                lib.toggleBorrow(id);
+                console.toggleBorrow(id);
                 break;
             }
-            case 6: {
+            case 7: {
                 int id;
                 cout << "Enter ID to remove: "; cin >> id;
-                lib.removeItem(id);
+                console.removeItem(id);
                 break;
             }
+            case 8:
+                console.saveToFile();
+                break;
+            case 9:
+                console.showMetrics();
+                break;
             default:
                 cout << "Unknown command.\n";
             }
@@ -305,4 +6362,5 @@ int main() {
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,434 @@
+// Benchmark suite and synthetic catalog generator for the C++ engine.
+//
+// Build (from this directory):
+//   g++ -std=c++17 -O2 -pthread library_bench.cpp -o library_bench
+//
+//   ./library_bench generate <items> [path]    write a library_data.txt-format catalog
+//   ./library_bench [options] [items...]       run the suite (default sizes: 10000 1000000)
+// Options:
+//   --csv      print name,items,ns_per_op,ops_per_sec lines instead of a table
+//   --fsync    keep the journal's default fsync policy (off by default, so
+//              disk latency does not drown out engine changes)
+//   --metrics  run with LibraryOptions::metrics on, to see its overhead
+//   --write-behind  leave all journal writes to the background thread
+//              (JournalOptions::writeBehind), as the console and server do
+//
+// Every size runs in its own scratch directory, bench_data/<items>/. The
+// catalog is generated there once (catalog.csv) and copied to
+// library_data.txt before each run, so repeated runs (say, before and
+// after a change) measure the same data. 10M items take about 700 MB of
+// CSV and several GB of memory.
+#define LIBRARY_NO_MAIN
+#include "library.cpp"
+
+#include <random>
+#if defined(__GLIBC__)
+#include <malloc.h> // malloc_trim, for stable resident-size readings
+#endif
+
+namespace {
+
+// --- Synthetic catalog ---
+// Titles draw from a skewed vocabulary, so a few words are very common
+// (search hits) and most are rare. Authors and publishers come from fixed
+// pools, and about 1 in 64 titles needs CSV quoting.
+class CatalogGenerator {
+private:
+    mt19937_64 rng;
+    vector<string> words;
+    vector<string> authors;
+    vector<string> publishers;
+
+    // Letters only from a-p, so benchmark misses like "qqq" never match
+    string randomWord(size_t minLength, size_t maxLength) {
+        size_t length = minLength + rng() % (maxLength - minLength + 1);
+        string word;
+        for (size_t i = 0; i < length; ++i) word += char('a' + rng() % 16);
+        word[0] = char(word[0] - 'a' + 'A');
+        return word;
+    }
+
+    // Low indexes are far more likely than high ones
+    const string& skewedPick(const vector<string>& pool) {
+        double u = double(rng() >> 11) / double(uint64_t(1) << 53);
+        return pool[size_t(u * u * u * double(pool.size()))];
+    }
+
+public:
+    explicit CatalogGenerator(size_t items, uint64_t seed = 42) : rng(seed) {
+        words.push_back("Python"); // The most common word, used for search hits
+        for (size_t i = 1; i < 20000; ++i) words.push_back(randomWord(3, 10));
+        for (size_t i = max<size_t>(items / 20, 100); i > 0; --i) {
+            authors.push_back(randomWord(4, 8) + " " + randomWord(5, 10));
+        }
+        for (size_t i = 0; i < 500; ++i) publishers.push_back(randomWord(5, 9) + " Press");
+    }
+
+    static const string& commonWord() {
+        static const string word = "Python";
+        return word;
+    }
+
+    string title() {
+        size_t count = 2 + rng() % 5;
+        string text;
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) text += ' ';
+            text += skewedPick(words);
+        }
+        if (rng() % 64 == 0) text += rng() % 2 ? ", Revised" : " \"Annotated\"";
+        return text;
+    }
+
+    // Appends one CSV record in the same layout as Book/Journal::toCSV
+    void appendRecord(string& out, int id) {
+        bool isBook = rng() % 5 != 0;
+        out += isBook ? "BOOK," : "JOURNAL,";
+        out += to_string(id);
+        out += ',';
+        appendCsvField(out, title());
+        out += rng() % 20 == 0 ? ",1," : ",0,";
+        appendCsvField(out, isBook ? authors[rng() % authors.size()] : skewedPick(publishers));
+        out += ',';
+        out += to_string(isBook ? 50 + rng() % 950 : 1 + rng() % 60);
+        out += '\n';
+    }
+};
+
+bool generateCatalog(const string& path, size_t items) {
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    CatalogGenerator generator(items);
+    string block;
+    block.reserve(1 << 20);
+    for (size_t i = 1; i <= items; ++i) {
+        generator.appendRecord(block, int(i));
+        if (block.size() >= (1 << 20) - 4096) {
+            out.write(block.data(), streamsize(block.size()));
+            block.clear();
+        }
+    }
+    out.write(block.data(), streamsize(block.size()));
+    return bool(out);
+}
+
+// --- Timing ---
+struct Result {
+    string name;
+    size_t items;
+    size_t ops;
+    double seconds;
+
+    double nsPerOp() const { return seconds * 1e9 / double(ops); }
+    double opsPerSecond() const { return double(ops) / seconds; }
+};
+
+// Calls body() until minSeconds have passed (and at least minCalls times);
+// each call counts as opsPerCall operations. setup() runs untimed before
+// every call.
+template <typename Setup, typename Body>
+Result measure(string name, size_t items, size_t opsPerCall, double minSeconds, size_t minCalls,
+               Setup&& setup, Body&& body) {
+    double elapsed = 0;
+    size_t calls = 0;
+    while (calls < minCalls || elapsed < minSeconds) {
+        setup();
+        auto start = chrono::steady_clock::now();
+        body();
+        elapsed += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        ++calls;
+    }
+    return {move(name), items, calls * opsPerCall, elapsed};
+}
+
+template <typename Body>
+Result measure(string name, size_t items, size_t opsPerCall, double minSeconds, Body&& body) {
+    return measure(move(name), items, opsPerCall, minSeconds, 1, [] {}, body);
+}
+
+// Resident set size, or 0 where it cannot be read. Freed heap pages are
+// returned first so earlier work does not hide new allocations.
+size_t residentBytes() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+#if LIBRARY_POSIX && defined(__linux__)
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (statm >> pages >> resident) return resident * size_t(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+void removeCatalogState() {
+    remove("library_data.snap");
+    remove("library_data.wal");
+    remove("library_data.delta");
+}
+
+void removeShardState(size_t shards) {
+    for (size_t s = 0; s < shards; ++s) {
+        string path = "library_data.shard" + to_string(s);
+        for (const char* suffix : {".txt", ".snap", ".wal", ".delta"}) remove((path + suffix).c_str());
+    }
+}
+
+struct Config {
+    bool csv = false;
+    bool fsync = false;
+    bool metrics = false;
+    bool writeBehind = false;
+    size_t shards = 0; // Also time the same queries through a ShardedLibrary
+};
+
+LibraryOptions benchOptions(const Config& config) {
+    LibraryOptions options;
+    if (!config.fsync) options.journal.fsyncEveryFlushes = 0;
+    options.metrics = config.metrics;
+    options.journal.writeBehind = config.writeBehind;
+    return options;
+}
+
+// A CSV load builds the title indexes as it goes, so they are counted
+// with the columns; the autocomplete index is built on first use
+void reportMemory(size_t items, const Config& config) {
+    removeCatalogState();
+    size_t before = residentBytes();
+    LibraryManager lib(benchOptions(config));
+    size_t loaded = residentBytes();
+    lib.suggest("py", 10, [](const ItemView&) {});
+    size_t suggested = residentBytes();
+    uintmax_t snapshotBytes = filesystem::file_size(lib.snapshotPath());
+    uintmax_t csvBytes = filesystem::file_size(lib.csvPath());
+    uintmax_t packBytes = lib.exportPack("catalog.pack") ? filesystem::file_size("catalog.pack") : 0;
+
+    if (before == 0) {
+        cout << "memory: resident size not available on this platform\n";
+        return;
+    }
+    auto perItem = [items](size_t bytes) { return double(bytes) / double(items); };
+    if (config.csv) {
+        cout << "memory/catalog," << items << "," << perItem(loaded - before) << "\n";
+        cout << "memory/suggest_index," << items << "," << perItem(suggested - loaded) << "\n";
+        cout << "memory/snapshot_file," << items << "," << perItem(size_t(snapshotBytes)) << "\n";
+        cout << "memory/csv_file," << items << "," << perItem(size_t(csvBytes)) << "\n";
+        cout << "memory/pack_file," << items << "," << perItem(size_t(packBytes)) << "\n";
+        return;
+    }
+    cout << "  memory per item: columns + title indexes " << perItem(loaded - before) << " B, autocomplete "
+         << perItem(suggested - loaded) << " B, snapshot file " << perItem(size_t(snapshotBytes)) << " B\n";
+    cout << "  file per item: csv " << perItem(size_t(csvBytes)) << " B, pack " << perItem(size_t(packBytes)) << " B\n";
+}
+
+// The searches above, fanned out over hash shards holding the same items
+template <typename Record>
+void runShardedSuite(const LibraryManager& source, size_t items, const Config& config, Record& record) {
+    removeShardState(config.shards);
+    vector<CatalogItem> catalog;
+    catalog.reserve(items);
+    source.listAll([&](const ItemView& view) {
+        if (view.type == ItemType::Book) catalog.push_back(Book(view.id, string(view.title), string(view.creator), view.number));
+        else catalog.push_back(Journal(view.id, string(view.title), string(view.creator), view.number));
+    });
+    ShardedLibrary lib(ShardMap::hashed(config.shards), benchOptions(config));
+    record(measure("sharded/add_batch", items, items, 0.0, [&] { lib.addItems(catalog); }));
+    vector<CatalogItem>().swap(catalog);
+
+    size_t sink = 0;
+    auto count = [&sink](const ItemView&) { ++sink; };
+    lib.searchItem("qqq", count); // Build the indexes outside the timings
+    record(measure("sharded/search_hit", items, 1, 0.5, [&] { lib.searchItem(CatalogGenerator::commonWord(), count); }));
+    record(measure("sharded/search_miss", items, 1, 0.5, [&] { lib.searchItem("qqq", count); }));
+    record(measure("sharded/keywords_hit", items, 1, 0.5, [&] { lib.searchKeywords("python", count); }));
+    mt19937 rng(11);
+    record(measure("sharded/find", items, 1000, 0.5, [&] {
+        for (int i = 0; i < 1000; ++i) lib.findItem(int(1 + rng() % items), count);
+    }));
+    lib.saveToFile();
+}
+
+void runSuite(size_t items, const Config& config, vector<Result>& results) {
+    auto record = [&](Result result) {
+        if (!config.csv) {
+            cout << "  " << left;
+            cout.width(24);
+            cout << result.name << right;
+            cout.width(14);
+            cout << size_t(result.nsPerOp()) << " ns/op";
+            cout.width(14);
+            cout << size_t(result.opsPerSecond()) << " ops/s\n";
+        }
+        results.push_back(move(result));
+    };
+
+    // Loading from CSV also writes the first snapshot, as a real first start does
+    record(measure("load/csv", items, 1, 1.0, 1, removeCatalogState,
+                   [&] { LibraryManager lib(benchOptions(config)); }));
+    record(measure("load/snapshot", items, 1, 0.5, [&] { LibraryManager lib(benchOptions(config)); }));
+
+    LibraryManager lib(benchOptions(config));
+    size_t sink = 0;
+    auto count = [&sink](const ItemView&) { ++sink; };
+    // Counts are served from the type bitmaps, built once from the hot
+    // columns; a query naming an author also reads every creator
+    record(measure("stats/first_call", items, 1, 0.0, [&] { lib.stats(); }));
+    ItemQuery byAuthor;
+    byAuthor.authors.push_back("nobody");
+    record(measure("filter/author_first_call", items, 1, 0.0, [&] { lib.countItems(byAuthor); }));
+    lib.searchItem("qqq", count); // Build the indexes outside the timings
+
+    record(measure("search/hit", items, 1, 0.5, [&] { lib.searchItem(CatalogGenerator::commonWord(), count); }));
+    record(measure("search/miss", items, 1, 0.5, [&] { lib.searchItem("qqq", count); }));
+    record(measure("search/short_scan", items, 1, 0.5, [&] { lib.searchItem("Py", count); }));
+    record(measure("search/ignore_case", items, 1, 0.5,
+                   [&] { lib.searchItem("PYTHON", count, true); }));
+    record(measure("keywords/hit", items, 1, 0.5, [&] { lib.searchKeywords("python", count); }));
+    // The first suggestion builds the autocomplete index; timed once on its own
+    record(measure("suggest/first_call", items, 1, 0.0, [&] { lib.suggest("py", 10, count); }));
+    record(measure("suggest/top10", items, 1, 0.5, [&] { lib.suggest("py", 10, count); }));
+
+    constexpr size_t BATCH = 1000;
+    mt19937 rng(7);
+    vector<int> ids(BATCH);
+    auto pickIds = [&] {
+        for (int& id : ids) id = int(1 + rng() % items);
+    };
+    record(measure("toggleBorrow", items, BATCH, 0.5, 1, pickIds, [&] {
+        bool borrowed;
+        for (int id : ids) lib.toggleBorrow(id, borrowed);
+    }));
+
+    // New IDs above the catalog's range, added and then removed again
+    int nextId = int(items) + 1;
+    vector<Book> fresh;
+    auto makeBooks = [&] {
+        fresh.clear();
+        for (size_t i = 0; i < BATCH; ++i) fresh.emplace_back(nextId + int(i), "Benchmark Title", "Bench Author", 100);
+    };
+    double addSeconds = 0, removeSeconds = 0;
+    size_t rounds = 0;
+    while (rounds < 3 || addSeconds + removeSeconds < 1.0) {
+        makeBooks();
+        auto start = chrono::steady_clock::now();
+        for (const Book& book : fresh) lib.addItem(book);
+        auto middle = chrono::steady_clock::now();
+        for (const Book& book : fresh) lib.removeItem(book.getId());
+        auto end = chrono::steady_clock::now();
+        addSeconds += chrono::duration<double>(middle - start).count();
+        removeSeconds += chrono::duration<double>(end - middle).count();
+        ++rounds;
+    }
+    record({"addItem", items, rounds * BATCH, addSeconds});
+    record({"removeItem", items, rounds * BATCH, removeSeconds});
+
+    // The same with each batch in random ID order, as a merge of several
+    // sources would add them
+    addSeconds = removeSeconds = 0;
+    rounds = 0;
+    while (rounds < 3 || addSeconds + removeSeconds < 1.0) {
+        makeBooks();
+        shuffle(fresh.begin(), fresh.end(), rng);
+        auto start = chrono::steady_clock::now();
+        for (const Book& book : fresh) lib.addItem(book);
+        auto middle = chrono::steady_clock::now();
+        for (const Book& book : fresh) lib.removeItem(book.getId());
+        auto end = chrono::steady_clock::now();
+        addSeconds += chrono::duration<double>(middle - start).count();
+        removeSeconds += chrono::duration<double>(end - middle).count();
+        ++rounds;
+    }
+    record({"addItem/shuffled", items, rounds * BATCH, addSeconds});
+    record({"removeItem/shuffled", items, rounds * BATCH, removeSeconds});
+
+    // An add + remove moves slots, so the next save writes everything; a
+    // lone checkout leaves it an in-place CSV patch plus a status delta
+    record(measure("saveToFile/full", items, 1, 1.0, 1, [&] {
+        lib.addItem(Book(nextId, "Benchmark Title", "Bench Author", 100));
+        lib.removeItem(nextId);
+    }, [&] { lib.saveToFile(); }));
+    record(measure("saveToFile/one_toggle", items, 1, 0.5, 1, [&] {
+        bool borrowed;
+        lib.toggleBorrow(int(1 + rng() % items), borrowed);
+    }, [&] { lib.saveToFile(); }));
+
+    // The packed archive: written from a pinned version, then read back
+    // one item at a time, each lookup decompressing one block
+    record(measure("pack/export", items, 1, 0.5, [&] { lib.exportPack("catalog.pack"); }));
+    PackReader pack;
+    if (pack.open("catalog.pack")) {
+        record(measure("pack/find", items, BATCH, 0.5, [&] {
+            for (size_t i = 0; i < BATCH; ++i) pack.findItem(int(1 + rng() % items), count);
+        }));
+    }
+    if (sink == 0) cout << "  (search benchmarks found nothing)\n";
+    if (config.shards > 0) runShardedSuite(lib, items, config, record);
+}
+
+int usage(const char* program) {
+    cerr << "Usage: " << program << " [--csv] [--fsync] [--metrics] [--write-behind] [--shards N] [items...]\n"
+         << "       " << program << " generate <items> [path]\n";
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && string_view(argv[1]) == "generate") {
+        int items;
+        if (argc < 3 || argc > 4 || !parseInt(argv[2], items) || items <= 0) return usage(argv[0]);
+        string path = argc == 4 ? argv[3] : "library_data.txt";
+        if (!generateCatalog(path, size_t(items))) {
+            cerr << "Cannot write " << path << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    Config config;
+    vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        string_view arg = argv[i];
+        int items;
+        if (arg == "--csv") config.csv = true;
+        else if (arg == "--fsync") config.fsync = true;
+        else if (arg == "--metrics") config.metrics = true;
+        else if (arg == "--write-behind") config.writeBehind = true;
+        else if (arg == "--shards" && i + 1 < argc && parseInt(argv[i + 1], items) && items > 0) {
+            config.shards = size_t(items);
+            ++i;
+        }
+        else if (parseInt(arg, items) && items > 0) sizes.push_back(size_t(items));
+        else return usage(argv[0]);
+    }
+    if (sizes.empty()) sizes = {10000, 1000000};
+
+    filesystem::path home = filesystem::current_path();
+    vector<Result> results;
+    if (config.csv) cout << "name,items,ns_per_op,ops_per_sec\n";
+    for (size_t items : sizes) {
+        filesystem::path dir = home / "bench_data" / to_string(items);
+        filesystem::create_directories(dir);
+        filesystem::current_path(dir);
+        if (!filesystem::exists("catalog.csv")) {
+            if (!config.csv) cout << "Generating " << items << " items in " << dir.string() << "...\n";
+            if (!generateCatalog("catalog.csv", items)) {
+                cerr << "Cannot write the catalog in " << dir.string() << "\n";
+                return 1;
+            }
+        }
+        // saveToFile rewrites library_data.txt, so every run starts from the pristine copy
+        filesystem::copy_file("catalog.csv", "library_data.txt", filesystem::copy_options::overwrite_existing);
+        if (!config.csv) cout << "\n== " << items << " items ==\n";
+        size_t first = results.size();
+        reportMemory(items, config);
+        runSuite(items, config, results);
+        if (config.csv) {
+            for (size_t i = first; i < results.size(); ++i) {
+                cout << results[i].name << "," << results[i].items << "," << results[i].nsPerOp() << ","
+                     << results[i].opsPerSecond() << "\n";
+            }
+        }
+        filesystem::current_path(home);
+    }
+    return 0;
+}
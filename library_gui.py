@@ -5,6 +5,13 @@ import os
 from abc import ABC, abstractmethod
 from datetime import datetime
 
+# Native C++ engine (build library_module.cpp, see its header). Without it
+# the GUI falls back to the pure-Python LibraryManager below.
+try:
+    import library_engine
+except ImportError:
+    library_engine = None
+
 # ==========================================
 # Color Scheme - Modern Dark Theme
 # ==========================================
@@ -145,6 +152,13 @@ class LibraryManager:
     def get_item(self, item_id):
         return self.inventory.get(item_id)
     
+    def get_stats(self):
+        borrowed = sum(1 for item in self.inventory.values() if item.is_borrowed)
+        return len(self.inventory), borrowed
+    
+    def close(self):
+        pass
+    
     def save_to_file(self):
         data = [item.to_dict() for item in self.inventory.values()]
         with open(self.filename, 'w') as f:
@@ -181,6 +195,76 @@ class LibraryManager:
         except Exception as e:
             print(f"Error loading data: {e}")
 
+class NativeLibraryManager:
+    """Same interface as LibraryManager, backed by the C++ engine.
+
+    The engine keeps its own files (library_data.snap/.delta/.wal/.txt) and
+    journals every change, so nothing has to be rewritten per edit. An
+    existing library_data.json is imported once, into an empty catalog.
+    """
+    MESSAGES = {
+        'DUPLICATE_ID': "ID already exists!",
+        'NOT_FOUND': "Item not found",
+        'CONFLICT': "Item was changed by someone else, please try again",
+    }
+
+    def __init__(self):
+        # Journal writes happen on the engine's own thread, never in the Tk loop
+        self.engine = library_engine.Library(write_behind=True)
+        self.filename = "library_data.json"
+        if self.engine.count() == 0 and os.path.exists(self.filename):
+            for item in LibraryManager().get_all_items():
+                self.add_item(item)
+    
+    def _result(self, status, message):
+        if status == 'OK':
+            return True, message
+        return False, self.MESSAGES.get(status, status)
+    
+    @staticmethod
+    def _to_item(row):
+        kind, item_id, title, creator, number, borrowed = row
+        if kind == 'BOOK':
+            item = Book(item_id, title, creator, number)
+        else:
+            item = Journal(item_id, title, creator, number)
+        item.is_borrowed = borrowed
+        return item
+    
+    def add_item(self, item):
+        if isinstance(item, Book):
+            status = self.engine.add_book(item.id, item.title, item.author, item.pages, item.is_borrowed)
+        else:
+            status = self.engine.add_journal(item.id, item.title, item.publisher, item.volume, item.is_borrowed)
+        return self._result(status, "Item added successfully")
+    
+    def remove_item(self, item_id):
+        return self._result(self.engine.remove(item_id), "Item removed successfully")
+    
+    def search_items(self, keyword):
+        return [self._to_item(row) for row in self.engine.search(keyword, True)]
+    
+    def toggle_borrow(self, item_id):
+        status, borrowed = self.engine.toggle(item_id)
+        return self._result(status, f"Status updated to: {'Borrowed' if borrowed else 'Available'}")
+    
+    def get_all_items(self):
+        return [self._to_item(row) for row in self.engine.items()]
+    
+    def get_item(self, item_id):
+        row = self.engine.get(item_id)
+        return self._to_item(row) if row else None
+    
+    def get_stats(self):
+        stats = self.engine.stats()
+        return stats['items'], stats['borrowed']
+    
+    def close(self):
+        self.engine.close()
+    
+    def save_to_file(self):
+        self.engine.save()
+
 # ==========================================
 # Custom Styled Widgets
 # ==========================================
@@ -260,7 +344,7 @@ class LibraryGUI:
         self.root.geometry("1200x700")
         self.root.configure(bg=COLORS['bg_dark'])
         
-        self.manager = LibraryManager()
+        self.manager = NativeLibraryManager() if library_engine else LibraryManager()
         
         # Configure root grid
         self.root.grid_rowconfigure(1, weight=1)
@@ -291,8 +375,7 @@ class LibraryGUI:
         stats_frame = tk.Frame(header, bg=COLORS['bg_medium'])
         stats_frame.pack(side=tk.RIGHT, padx=30)
         
-        total_items = len(self.manager.get_all_items())
-        borrowed = sum(1 for item in self.manager.get_all_items() if item.is_borrowed)
+        total_items, borrowed = self.manager.get_stats()
         
         self.stats_label = tk.Label(
             stats_frame,
@@ -304,8 +387,7 @@ class LibraryGUI:
         self.stats_label.pack()
     
     def update_stats(self):
-        total_items = len(self.manager.get_all_items())
-        borrowed = sum(1 for item in self.manager.get_all_items() if item.is_borrowed)
+        total_items, borrowed = self.manager.get_stats()
         self.stats_label.config(
             text=f"Total: {total_items} | Available: {total_items - borrowed} | Borrowed: {borrowed}"
         )
@@ -732,3 +814,4 @@ if __name__ == "__main__":
     root = tk.Tk()
     app = LibraryGUI(root)
     root.mainloop()
+    app.manager.close()
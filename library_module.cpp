@@ -0,0 +1,356 @@
+// Python bindings for the C++ engine: `import library_engine`.
+//
+// Build (from this directory, one line):
+//   g++ -std=c++17 -O2 -shared -fPIC -pthread $(python3-config --includes)
+//       library_module.cpp -o library_engine$(python3-config --extension-suffix)
+//
+// library_engine.Library() opens the catalog in the current directory
+// (library_data.snap / .delta / .wal / .txt) exactly like the console program.
+// Items come back as tuples (type, id, title, creator, number, borrowed),
+// built straight from the engine's columns without intermediate strings.
+// Mutations return a status string: "OK", "DUPLICATE_ID", "NOT_FOUND",
+// "ALREADY_BORROWED", "NOT_BORROWED" or "CONFLICT".
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define LIBRARY_NO_MAIN
+#include "library.cpp"
+
+namespace {
+
+struct LibraryObject {
+    PyObject_HEAD
+    LibraryManager* lib;
+};
+
+PyObject* itemTuple(const ItemView& item) {
+    return Py_BuildValue("(sis#s#iO)", item.type == ItemType::Book ? "BOOK" : "JOURNAL", item.id,
+                         item.title.data(), Py_ssize_t(item.title.size()),
+                         item.creator.data(), Py_ssize_t(item.creator.size()),
+                         item.number, item.borrowed ? Py_True : Py_False);
+}
+
+// Collects visited items into a new list; tracks the first failure
+struct ListBuilder {
+    PyObject* list = PyList_New(0);
+
+    void operator()(const ItemView& item) {
+        if (!list) return;
+        PyObject* tuple = itemTuple(item);
+        if (!tuple || PyList_Append(list, tuple) < 0) Py_CLEAR(list);
+        Py_XDECREF(tuple);
+    }
+};
+
+bool isOpen(LibraryObject* self) {
+    if (self->lib) return true;
+    PyErr_SetString(PyExc_ValueError, "library is closed");
+    return false;
+}
+
+PyObject* statusResult(OpStatus status) {
+    return PyUnicode_FromString(statusCode(status));
+}
+
+int Library_init(LibraryObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"import_threads", "metrics", "write_behind", nullptr};
+    unsigned int importThreads = 0;
+    int metrics = 0, writeBehind = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Ipp", const_cast<char**>(keywords), &importThreads, &metrics,
+                                     &writeBehind)) {
+        return -1;
+    }
+    delete self->lib;
+    self->lib = nullptr;
+    try {
+        LibraryOptions options;
+        options.importThreads = importThreads;
+        options.metrics = metrics != 0;
+        options.journal.writeBehind = writeBehind != 0;
+        self->lib = new LibraryManager(options);
+    } catch (const exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return -1;
+    }
+    return 0;
+}
+
+void Library_dealloc(LibraryObject* self) {
+    PyTypeObject* type = Py_TYPE(self); // Heap type: instances hold a reference
+    delete self->lib;                   // Flushes the journal
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+PyObject* Library_close(LibraryObject* self, PyObject*) {
+    delete self->lib;
+    self->lib = nullptr;
+    Py_RETURN_NONE;
+}
+
+template <typename Item>
+PyObject* addItem(LibraryObject* self, PyObject* args) {
+    int id, number, borrowed = 0;
+    const char* title;
+    const char* creator;
+    Py_ssize_t titleSize, creatorSize;
+    if (!isOpen(self) ||
+        !PyArg_ParseTuple(args, "is#s#i|p", &id, &title, &titleSize, &creator, &creatorSize, &number, &borrowed)) {
+        return nullptr;
+    }
+    Item item(id, string(title, size_t(titleSize)), string(creator, size_t(creatorSize)), number);
+    item.setBorrowed(borrowed != 0);
+    return statusResult(self->lib->addItem(item));
+}
+
+PyObject* Library_remove(LibraryObject* self, PyObject* args) {
+    int id;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "i", &id)) return nullptr;
+    return statusResult(self->lib->removeItem(id));
+}
+
+PyObject* Library_borrow(LibraryObject* self, PyObject* args) {
+    int id;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "i", &id)) return nullptr;
+    return statusResult(self->lib->borrowMany({id})[0]);
+}
+
+PyObject* Library_return(LibraryObject* self, PyObject* args) {
+    int id;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "i", &id)) return nullptr;
+    return statusResult(self->lib->returnMany({id})[0]);
+}
+
+// Returns (status, borrowed_now)
+PyObject* Library_toggle(LibraryObject* self, PyObject* args) {
+    int id;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "i", &id)) return nullptr;
+    bool nowBorrowed = false;
+    OpStatus status = self->lib->toggleBorrow(id, nowBorrowed);
+    return Py_BuildValue("(sO)", statusCode(status), nowBorrowed ? Py_True : Py_False);
+}
+
+PyObject* Library_get(LibraryObject* self, PyObject* args) {
+    int id;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "i", &id)) return nullptr;
+    PyObject* result = nullptr;
+    bool found = self->lib->findItem(id, [&](const ItemView& item) { result = itemTuple(item); });
+    if (!found) Py_RETURN_NONE;
+    return result;
+}
+
+PyObject* Library_items(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    ListBuilder builder;
+    self->lib->listAll(ref(builder));
+    return builder.list;
+}
+
+PyObject* Library_search(LibraryObject* self, PyObject* args) {
+    const char* keyword;
+    Py_ssize_t size;
+    int ignoreCase = 0;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "s#|p", &keyword, &size, &ignoreCase)) return nullptr;
+    ListBuilder builder;
+    // ignore_case folds ASCII letters, matching the GUI's keyword.lower() in title.lower()
+    self->lib->searchItem(string_view(keyword, size_t(size)), ref(builder), ignoreCase != 0);
+    return builder.list;
+}
+
+PyObject* Library_keywords(LibraryObject* self, PyObject* args) {
+    const char* query;
+    Py_ssize_t size;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "s#", &query, &size)) return nullptr;
+    ListBuilder builder;
+    self->lib->searchKeywords(string(query, size_t(size)), ref(builder));
+    return builder.list;
+}
+
+PyObject* Library_suggest(LibraryObject* self, PyObject* args) {
+    const char* prefix;
+    Py_ssize_t size, k = 10;
+    if (!isOpen(self) || !PyArg_ParseTuple(args, "s#|n", &prefix, &size, &k)) return nullptr;
+    ListBuilder builder;
+    self->lib->suggest(string_view(prefix, size_t(size)), size_t(max<Py_ssize_t>(k, 0)), ref(builder));
+    return builder.list;
+}
+
+// Appends a str, or every str of an iterable, to names
+bool appendNames(PyObject* value, vector<string>& names) {
+    if (!value || value == Py_None) return true;
+    auto appendOne = [&names](PyObject* item) {
+        Py_ssize_t size;
+        const char* text = PyUnicode_AsUTF8AndSize(item, &size);
+        if (!text) return false;
+        names.emplace_back(text, size_t(size));
+        return true;
+    };
+    if (PyUnicode_Check(value)) return appendOne(value);
+    PyObject* iterator = PyObject_GetIter(value);
+    if (!iterator) return false;
+    bool ok = true;
+    while (PyObject* item = PyIter_Next(iterator)) {
+        ok = appendOne(item);
+        Py_DECREF(item);
+        if (!ok) break;
+    }
+    Py_DECREF(iterator);
+    return ok && !PyErr_Occurred();
+}
+
+// filter(type=None, borrowed=None, authors=None, publishers=None)
+bool parseQuery(PyObject* args, PyObject* kwargs, ItemQuery& query) {
+    static const char* keywords[] = {"type", "borrowed", "authors", "publishers", nullptr};
+    const char* type = nullptr;
+    PyObject* borrowed = Py_None;
+    PyObject* authors = nullptr;
+    PyObject* publishers = nullptr;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zOOO", const_cast<char**>(keywords), &type, &borrowed,
+                                     &authors, &publishers)) {
+        return false;
+    }
+    if (type) {
+        if (strcmp(type, "BOOK") == 0) query.type = ItemType::Book;
+        else if (strcmp(type, "JOURNAL") == 0) query.type = ItemType::Journal;
+        else {
+            PyErr_SetString(PyExc_ValueError, "type must be 'BOOK', 'JOURNAL' or None");
+            return false;
+        }
+    }
+    if (borrowed != Py_None) {
+        int flag = PyObject_IsTrue(borrowed);
+        if (flag < 0) return false;
+        query.borrowed = flag != 0;
+    }
+    return appendNames(authors, query.authors) && appendNames(publishers, query.publishers);
+}
+
+PyObject* Library_filter(LibraryObject* self, PyObject* args, PyObject* kwargs) {
+    ItemQuery query;
+    if (!isOpen(self) || !parseQuery(args, kwargs, query)) return nullptr;
+    ListBuilder builder;
+    self->lib->filterItems(query, ref(builder));
+    return builder.list;
+}
+
+PyObject* Library_countMatching(LibraryObject* self, PyObject* args, PyObject* kwargs) {
+    ItemQuery query;
+    if (!isOpen(self) || !parseQuery(args, kwargs, query)) return nullptr;
+    return PyLong_FromSize_t(self->lib->countItems(query));
+}
+
+PyObject* Library_count(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    return PyLong_FromSize_t(self->lib->size());
+}
+
+PyObject* Library_borrowedCount(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    return PyLong_FromSize_t(self->lib->stats().borrowed);
+}
+
+// One call for the GUI header: {"items", "books", "journals", "borrowed"}
+PyObject* Library_stats(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    CatalogStats totals = self->lib->stats();
+    return Py_BuildValue("{snsnsnsn}", "items", Py_ssize_t(totals.items), "books", Py_ssize_t(totals.books),
+                         "journals", Py_ssize_t(totals.journals), "borrowed", Py_ssize_t(totals.borrowed));
+}
+
+// Latency and I/O metrics in Prometheus text format
+PyObject* Library_metrics(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    string text = formatPrometheus(self->lib->metricsReport());
+    return PyUnicode_FromStringAndSize(text.data(), Py_ssize_t(text.size()));
+}
+
+PyObject* Library_save(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    bool saved;
+    Py_BEGIN_ALLOW_THREADS
+    saved = self->lib->saveToFile();
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(saved);
+}
+
+// Waits (without the GIL) until every change so far is synced to the journal
+PyObject* Library_flush(LibraryObject* self, PyObject*) {
+    if (!isOpen(self)) return nullptr;
+    bool durable;
+    Py_BEGIN_ALLOW_THREADS
+    durable = self->lib->flush().get();
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(durable);
+}
+
+// METH_KEYWORDS methods take a third argument; the table stores them as
+// PyCFunction, through void(*)() so the compiler accepts the cast
+template <typename Method>
+PyCFunction keywordMethod(Method method) {
+    return reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(method));
+}
+
+PyMethodDef libraryMethods[] = {
+    {"add_book", reinterpret_cast<PyCFunction>(addItem<Book>), METH_VARARGS,
+     "add_book(id, title, author, pages, borrowed=False) -> status"},
+    {"add_journal", reinterpret_cast<PyCFunction>(addItem<Journal>), METH_VARARGS,
+     "add_journal(id, title, publisher, volume, borrowed=False) -> status"},
+    {"remove", reinterpret_cast<PyCFunction>(Library_remove), METH_VARARGS, "remove(id) -> status"},
+    {"borrow", reinterpret_cast<PyCFunction>(Library_borrow), METH_VARARGS, "borrow(id) -> status"},
+    {"return_item", reinterpret_cast<PyCFunction>(Library_return), METH_VARARGS, "return_item(id) -> status"},
+    {"toggle", reinterpret_cast<PyCFunction>(Library_toggle), METH_VARARGS, "toggle(id) -> (status, borrowed)"},
+    {"get", reinterpret_cast<PyCFunction>(Library_get), METH_VARARGS, "get(id) -> item tuple or None"},
+    {"items", reinterpret_cast<PyCFunction>(Library_items), METH_NOARGS, "items() -> all items in ID order"},
+    {"search", reinterpret_cast<PyCFunction>(Library_search), METH_VARARGS,
+     "search(keyword, ignore_case=False) -> items whose title contains keyword"},
+    {"keywords", reinterpret_cast<PyCFunction>(Library_keywords), METH_VARARGS,
+     "keywords(query) -> items whose title has every word of query"},
+    {"suggest", reinterpret_cast<PyCFunction>(Library_suggest), METH_VARARGS,
+     "suggest(prefix, k=10) -> best k items whose title or author has a word starting with prefix"},
+    {"filter", keywordMethod(Library_filter), METH_VARARGS | METH_KEYWORDS,
+     "filter(type=None, borrowed=None, authors=None, publishers=None) -> matching items in ID order"},
+    {"count_matching", keywordMethod(Library_countMatching), METH_VARARGS | METH_KEYWORDS,
+     "count_matching(...) -> number of items filter() would return"},
+    {"count", reinterpret_cast<PyCFunction>(Library_count), METH_NOARGS, "count() -> number of items"},
+    {"borrowed_count", reinterpret_cast<PyCFunction>(Library_borrowedCount), METH_NOARGS,
+     "borrowed_count() -> number of borrowed items"},
+    {"stats", reinterpret_cast<PyCFunction>(Library_stats), METH_NOARGS,
+     "stats() -> dict of item, book, journal and borrowed counts"},
+    {"metrics", reinterpret_cast<PyCFunction>(Library_metrics), METH_NOARGS,
+     "metrics() -> latency histograms, I/O and index sizes as Prometheus text (Library(metrics=True))"},
+    {"save", reinterpret_cast<PyCFunction>(Library_save), METH_NOARGS, "save() -> True if CSV and snapshot were written"},
+    {"flush", reinterpret_cast<PyCFunction>(Library_flush), METH_NOARGS,
+     "flush() -> True once every change so far is synced to the journal (for Library(write_behind=True))"},
+    {"close", reinterpret_cast<PyCFunction>(Library_close), METH_NOARGS, "close() -> flush and release the catalog"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyType_Slot librarySlots[] = {
+    {Py_tp_doc, const_cast<char*>("In-memory catalog backed by the C++ LibraryManager")},
+    {Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew)},
+    {Py_tp_init, reinterpret_cast<void*>(Library_init)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(Library_dealloc)},
+    {Py_tp_methods, libraryMethods},
+    {0, nullptr},
+};
+
+PyType_Spec librarySpec = {"library_engine.Library", sizeof(LibraryObject), 0, Py_TPFLAGS_DEFAULT, librarySlots};
+
+PyModuleDef libraryModule = {
+    PyModuleDef_HEAD_INIT, "library_engine", "C++ library catalog engine", -1,
+    nullptr, nullptr, nullptr, nullptr, nullptr,
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_library_engine() {
+    PyObject* module = PyModule_Create(&libraryModule);
+    if (!module) return nullptr;
+    PyObject* type = PyType_FromSpec(&librarySpec);
+    if (!type || PyModule_AddObject(module, "Library", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
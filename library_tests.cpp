@@ -0,0 +1,1667 @@
+// Regression tests for the C++ engine.
+//
+// Build and run (from this directory):
+//   g++ -std=c++17 -O2 -pthread library_tests.cpp -o library_tests
+//   ./library_tests            run every test
+//   ./library_tests <name>...  run the named tests
+//
+// Each test runs in its own empty scratch directory, test_data/<name>/,
+// so the files it leaves behind can be inspected after a failure.
+#define LIBRARY_NO_MAIN
+#include "library.cpp"
+
+#include <map>
+#include <random>
+#include <set>
+
+#if LIBRARY_POSIX
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+// Set by the crash tests: runs inside the rename that publishes a saved
+// state, with its target, after which the process ends as if it crashed
+static function<void(const string&)> onStateRename;
+
+extern "C" int rename(const char* from, const char* to) noexcept {
+    using Rename = int (*)(const char*, const char*);
+    static const Rename next = reinterpret_cast<Rename>(dlsym(RTLD_NEXT, "rename"));
+    string target = to;
+    auto endsWith = [&target](const string& suffix) {
+        return target.size() >= suffix.size() && target.compare(target.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    bool crash = onStateRename && (endsWith(".snap") || endsWith(".delta"));
+    if (crash) onStateRename(target);
+    int result = next(from, to);
+    if (crash) _exit(result == 0 ? 0 : 1);
+    return result;
+}
+#endif
+
+namespace {
+
+size_t failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            ++failures;                                                                   \
+            cout << "    " << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+        }                                                                                 \
+    } while (0)
+
+LibraryOptions testOptions() {
+    LibraryOptions options;
+    options.journal.fsyncEveryFlushes = 0;
+    return options;
+}
+
+// One line per item, in ascending ID order
+template <typename Catalog>
+string dump(const Catalog& lib) {
+    string out;
+    lib.listAll([&out](const ItemView& item) {
+        out += to_string(item.id) + (item.type == ItemType::Book ? " B " : " J ") + string(item.title) + " | " +
+               string(item.creator) + " | " + to_string(item.number) + (item.borrowed ? " *" : "") + "\n";
+    });
+    return out;
+}
+
+void addSampleItems(LibraryManager& lib, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (i % 3 == 0) lib.addItem(Journal(i * 7 - 100, "Journal of " + to_string(i % 11), "Press " + to_string(i % 5), i));
+        else lib.addItem(Book(i * 7 - 100, "Book \"" + to_string(i) + "\", vol, 2", "Author " + to_string(i % 13), i * 3));
+    }
+    for (int i = 0; i < count; i += 4) lib.tryBorrow(i * 7 - 100);
+}
+
+string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+void writeFile(const string& path, const string& data) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out << data;
+}
+
+// Opens the catalog in the current directory; returns the file it was
+// loaded from
+string openedFrom(string* contents = nullptr) {
+    LibraryOptions options = testOptions();
+    string source;
+    options.log = [&source](LogLevel, const string& message) {
+        const string prefix = "Data loaded from ";
+        if (message.compare(0, prefix.size(), prefix) == 0) source = message.substr(prefix.size());
+    };
+    LibraryManager lib(options);
+    if (contents) *contents = dump(lib);
+    return source;
+}
+
+// --- Tests ---
+
+// Full snapshots and status deltas reload to the same catalog, and leave
+// no temporary files behind
+void testSnapshotRoundTrip() {
+    LibraryOptions options = testOptions();
+    options.journal.fsyncEveryFlushes = 1; // Saves are synced too
+    string expected;
+    {
+        LibraryManager lib(options);
+        addSampleItems(lib, 3000);
+        CHECK(lib.saveToFile());
+        expected = dump(lib);
+    }
+    {
+        LibraryManager lib(options);
+        CHECK(dump(lib) == expected);
+        for (int i = 0; i < 12; i += 4) lib.tryReturn(i * 7 - 100);
+        CHECK(lib.saveToFile()); // Only statuses changed: written as a delta
+        CHECK(filesystem::exists("library_data.delta"));
+        expected = dump(lib);
+    }
+    {
+        LibraryManager lib(options);
+        CHECK(dump(lib) == expected);
+    }
+    for (const auto& entry : filesystem::directory_iterator(".")) CHECK(entry.path().extension() != ".tmp");
+
+    // Version 1 deltas, without the journal fields, still apply
+    string delta = readFile("library_data.delta");
+    StatusDeltaHeader header;
+    memcpy(&header, delta.data(), sizeof(header));
+    string entries = delta.substr(sizeof(header));
+    header.version = 1;
+    header.checksum = fnv1a(entries.data(), entries.size());
+    writeFile("library_data.delta", string(reinterpret_cast<const char*>(&header), STATUS_DELTA_V1_HEADER_SIZE) + entries);
+    CHECK(dump(LibraryManager(testOptions())) == expected);
+}
+
+
+// The single-threaded build, with logging compiled out, shares the files
+// of the threaded one: it loads its snapshot, journals, replays, saves
+// and records metrics
+void testSingleThreaded() {
+    using Quiet = BasicLibraryManager<SingleThreaded, NoLogging>;
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        addSampleItems(lib, 1000);
+        CHECK(lib.saveToFile());
+        expected = dump(lib);
+    }
+    {
+        LibraryOptions options = testOptions();
+        options.metrics = true;
+        Quiet lib(options);
+        CHECK(dump(lib) == expected);
+        for (int i = 1; i < 40; i += 4) CHECK(lib.tryBorrow(i * 7 - 100));
+        CHECK(!lib.tryBorrow(-93));
+        CHECK(lib.flush().get());
+        expected = dump(lib);
+        MetricsReport report = lib.metricsReport(); // Plain counters in this build
+        CHECK(report.latency[size_t(MetricOp::Borrow)].total == 11);
+        CHECK(report.latency[size_t(MetricOp::Load)].total == 1);
+        CHECK(report.bytesWritten[size_t(IoTarget::Journal)] > 0);
+    }
+    {
+        Quiet lib(testOptions()); // From the journal
+        CHECK(dump(lib) == expected);
+        CHECK(lib.saveAsync().get()); // Saved on the spot
+        lib.addItem(Book(99999, "Single", "Thread", 1));
+        lib.removeItem(-100);
+        size_t items = 0;
+        lib.listAll([&items](const ItemView&) { ++items; }, Execution::Parallel);
+        CHECK(items == 1000);
+        expected = dump(lib);
+        CHECK(lib.flush().get());
+    }
+    LibraryManager lib(testOptions());
+    CHECK(dump(lib) == expected);
+}
+
+// Out-of-order inserts must not re-sort the ID order every time
+void testShuffledInserts() {
+    LibraryManager lib(testOptions());
+    vector<int> ids(20000);
+    for (size_t i = 0; i < ids.size(); ++i) ids[i] = int(i) * 3 - 30000;
+    shuffle(ids.begin(), ids.end(), mt19937(1));
+    auto start = chrono::steady_clock::now();
+    for (int id : ids) lib.addItem(Book(id, "Title " + to_string(id), "Author", 1));
+    for (size_t i = 0; i < ids.size(); i += 2) {
+        lib.removeItem(ids[i]);
+        lib.addItem(Journal(ids[i], "Again", "Publisher", 2));
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    CHECK(seconds < 8.0); // About 0.1 s; re-sorting on every insert took over 15
+    int previous = numeric_limits<int>::min();
+    size_t seen = 0;
+    bool ascending = true;
+    lib.listAll([&](const ItemView& item) {
+        ascending = ascending && item.id > previous;
+        previous = item.id;
+        ++seen;
+    });
+    CHECK(ascending);
+    CHECK(seen == ids.size());
+}
+
+// A damaged snapshot is skipped for the CSV saved with it, wherever the
+// damage is
+void testCorruptSnapshotFallsBack() {
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        addSampleItems(lib, 500);
+        CHECK(lib.saveToFile());
+        expected = dump(lib);
+    }
+    string snapshot = readFile("library_data.snap");
+    mt19937 rng(3);
+    for (int trial = 0; trial < 40; ++trial) {
+        string damaged = snapshot;
+        damaged[rng() % damaged.size()] ^= char(1 + rng() % 255);
+        writeFile("library_data.snap", damaged); // Newer than the CSV, so tried first
+        string contents;
+        openedFrom(&contents);
+        CHECK(contents == expected);
+    }
+}
+
+// References out of their sections are rejected even under a valid checksum
+void testSnapshotBoundsChecked() {
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        addSampleItems(lib, 100);
+        CHECK(lib.saveToFile());
+        expected = dump(lib);
+    }
+    string snapshot = readFile("library_data.snap");
+    SnapshotHeader header;
+    memcpy(&header, snapshot.data(), sizeof(header));
+    SnapshotLayout layout(header);
+    auto reseal = [&](string& file) {
+        SnapshotChecksum checksum;
+        checksum.update(file.data(), sizeof(SnapshotHeader));
+        SnapshotChecks checks;
+        memcpy(&checks, &file[sizeof(SnapshotHeader)], sizeof(checks));
+        checksum.update(&checks.journalGeneration, sizeof(checks) - sizeof(checks.checksum));
+        checksum.update(file.data() + layout.ids, layout.total - layout.ids);
+        checks.checksum = checksum.digest();
+        memcpy(&file[sizeof(SnapshotHeader)], &checks, sizeof(checks));
+    };
+    // Returns the file the catalog was loaded from
+    auto load = [&](size_t offset, uint32_t value) {
+        string crafted = snapshot;
+        memcpy(&crafted[offset], &value, sizeof(value));
+        reseal(crafted);
+        writeFile("library_data.snap", crafted);
+        string contents;
+        string source = openedFrom(&contents);
+        CHECK(contents == expected);
+        return source;
+    };
+    uint32_t firstNumber;
+    memcpy(&firstNumber, snapshot.data() + layout.numbers, sizeof(firstNumber));
+    CHECK(openedFrom() == "library_data.snap");
+    writeFile("library_data.snap", snapshot);
+    CHECK(load(layout.numbers, firstNumber) == "library_data.snap"); // Resealed unchanged: accepted
+    CHECK(load(layout.titleOffsets, uint32_t(header.titleBytes)) == "library_data.txt");
+    CHECK(load(layout.creatorCodes, uint32_t(header.creatorCodes)) == "library_data.txt");
+    CHECK(load(layout.types, 7) == "library_data.txt");
+    CHECK(load(layout.table + 4 * (size_t(header.tableSize) - 1), uint32_t(header.itemCount)) == "library_data.txt");
+}
+
+// Mutations since the snapshot come back from the journal; a torn tail is
+// cut off, and an intact record of an unknown item type is skipped
+void testJournalReplay() {
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        lib.addItem(Book(1, "First", "Ann", 10));
+        lib.addItem(Journal(2, "Second", "Press", 4));
+        lib.addItem(Book(3, "Third", "Bob", 30));
+        lib.tryBorrow(3);
+        lib.removeItem(1);
+        lib.addItem(Book(4, "Fourth", "Cy", 40));
+        expected = dump(lib);
+    }
+    string log = readFile("library_data.wal");
+    {
+        LibraryManager lib(testOptions());
+        CHECK(dump(lib) == expected);
+    }
+
+    writeFile("library_data.wal", log + string("\x20\0\0\0garbage", 11));
+    {
+        LibraryManager lib(testOptions());
+        CHECK(dump(lib) == expected);
+    }
+    CHECK(readFile("library_data.wal") == log);
+
+    // Records: u32 length | u32 fnv1a | u8 op | i32 id | u8 type ...
+    size_t pos = 24;
+    while (pos + 9 <= log.size()) {
+        uint32_t length;
+        memcpy(&length, &log[pos], 4);
+        int32_t id;
+        memcpy(&id, &log[pos + 9], 4);
+        if (log[pos + 8] == char(JournalOp::Add) && id == 2) break;
+        pos += 8 + length;
+    }
+    CHECK(pos + 9 <= log.size());
+    if (pos + 9 > log.size()) return;
+    log[pos + 13] = 9;
+    uint32_t length, sum;
+    memcpy(&length, &log[pos], 4);
+    sum = fnv1a(&log[pos + 8], length);
+    memcpy(&log[pos + 4], &sum, 4);
+    writeFile("library_data.wal", log);
+    LibraryManager lib(testOptions());
+    string withoutSecond = expected;
+    size_t line = withoutSecond.find("2 J ");
+    withoutSecond.erase(line, withoutSecond.find('\n', line) + 1 - line);
+    CHECK(dump(lib) == withoutSecond);
+}
+
+// Quoted fields (delimiters, doubled quotes, line breaks), CRLF, blank
+// and malformed lines; the export reads back to the same catalog
+void testCsvQuoting() {
+    {
+        const string line = "BOOK,7,\"Say \"\"hi\"\", then, go\",1,\"Lee,\nAnn\",12\r\nBOOK,8";
+        CsvReader reader(line.data(), line.size());
+        vector<string_view> fields;
+        CHECK(reader.next(fields));
+        CHECK(fields.size() == 6);
+        if (fields.size() == 6) {
+            CHECK(fields[2] == "Say \"hi\", then, go");
+            CHECK(fields[4] == "Lee,\nAnn");
+            CHECK(fields[5] == "12");
+        }
+        CHECK(reader.next(fields));
+        CHECK(fields.size() == 2);
+        CHECK(!reader.next(fields));
+    }
+    writeFile("library_data.txt",
+              "BOOK,1,Plain,0,Ann,100\n"
+              "JOURNAL,2,\"Quoted, with comma\",1,\"Press \"\"X\"\"\",4\r\n"
+              "\n"
+              "BOOK,3,\"Two\nlines\",0,Bob,30\n"
+              "BOOK,4,Too,few,fields\n"
+              "BOOK,x5,Bad id,0,Cy,1\n"
+              "MAGAZINE,6,Unknown type,0,Di,1\n"
+              "BOOK,1,Replaced,1,Eve,101\n" // Last record wins
+              "JOURNAL,7,\"\"\"\",0,\"\",0");   // No final line break
+    const string expected = "1 B Replaced | Eve | 101 *\n"
+                            "2 J Quoted, with comma | Press \"X\" | 4 *\n"
+                            "3 B Two\nlines | Bob | 30\n"
+                            "7 J \" |  | 0\n";
+    {
+        LibraryManager lib(testOptions());
+        CHECK(dump(lib) == expected);
+        CHECK(lib.saveToFile());
+    }
+    for (const char* file : {"library_data.snap", "library_data.wal", "library_data.delta"}) remove(file);
+    string contents;
+    CHECK(openedFrom(&contents) == "library_data.txt");
+    CHECK(contents == expected);
+
+    // Sample book titles carry quotes and commas
+    filesystem::create_directory("sample");
+    filesystem::current_path("sample");
+    string sample;
+    {
+        LibraryManager lib(testOptions());
+        addSampleItems(lib, 300);
+        CHECK(lib.saveToFile());
+        sample = dump(lib);
+    }
+    for (const char* file : {"library_data.snap", "library_data.wal", "library_data.delta"}) remove(file);
+    CHECK(openedFrom(&contents) == "library_data.txt");
+    CHECK(contents == sample);
+    filesystem::current_path("..");
+}
+
+// Records with quoted line breaks and quotes, some IDs repeated
+string trickyCsv(int records, size_t titleBytes) {
+    string csv;
+    const string filler(titleBytes, 'x');
+    for (int i = 0; i < records; ++i) {
+        int id = i % 10 == 9 ? i - 5 : i; // Repeats land in other chunks too
+        switch (i % 5) {
+        case 0: csv += "BOOK," + to_string(id) + ",\"Line\n" + filler + "\nbreaks\",0,Ann,1\n"; break;
+        case 1: csv += "JOURNAL," + to_string(id) + ",\"Say \"\"hi\"\"\n\"\"\"," + "1,\"A,\nB\",2\r\n"; break;
+        case 2: csv += "BOOK," + to_string(id) + ",mid\"field" + filler + ",1,\"\"\"\n\",3\n"; break;
+        case 3: csv += "BOOK," + to_string(id) + ",\"\n\n,\n\",0,\",\"," + to_string(i) + "\n"; break;
+        default: csv += "JOURNAL," + to_string(id) + "," + filler + ",0,Press,4\n"; break;
+        }
+    }
+    return csv;
+}
+
+string describe(const vector<ParsedChunk>& chunks, size_t* malformed) {
+    string out;
+    *malformed = 0;
+    for (const ParsedChunk& chunk : chunks) {
+        for (const ParsedItem& item : chunk.items) {
+            out += to_string(int(item.type)) + " " + to_string(item.id) + " " + string(item.title) + " | " +
+                   string(item.creator) + " | " + to_string(item.number) + (item.borrowed ? " *" : "") + "\n";
+        }
+        *malformed += chunk.malformed;
+    }
+    return out;
+}
+
+// Splitting never lands inside a quoted field, for any number of parts,
+// and a parallel import loads the same catalog as a serial one
+void testParallelSplit() {
+    const string csv = trickyCsv(200, 3);
+    vector<ParsedChunk> whole;
+    whole.push_back(parseChunk(csv.data(), csv.data() + csv.size()));
+    size_t malformed = 0;
+    const string expected = describe(whole, &malformed);
+    CHECK(whole[0].items.size() == 200);
+    CHECK(malformed == 0);
+    for (unsigned parts = 2; parts <= 64; ++parts) {
+        vector<size_t> cuts = recordBoundaries(csv.data(), csv.size(), parts);
+        CHECK(cuts.front() == 0 && cuts.back() == csv.size());
+        CHECK(is_sorted(cuts.begin(), cuts.end()));
+        CHECK(describe(parseCSVParallel(csv.data(), csv.size(), parts), &malformed) == expected);
+        CHECK(malformed == 0);
+    }
+
+    const string big = trickyCsv(100000, 30);
+    CHECK(big.size() >= size_t(4) << 20); // Above the parallel import threshold
+    string dumps[2];
+    const unsigned threads[2] = {1, 4};
+    for (int run = 0; run < 2; ++run) {
+        const string dir = "threads_" + to_string(threads[run]);
+        filesystem::create_directory(dir);
+        filesystem::current_path(dir);
+        writeFile("library_data.txt", big);
+        LibraryOptions options = testOptions();
+        options.importThreads = threads[run];
+        LibraryManager lib(options);
+        dumps[run] = dump(lib);
+        filesystem::current_path("..");
+    }
+    CHECK(!dumps[0].empty());
+    CHECK(dumps[0] == dumps[1]);
+}
+
+bool sameValues(const RoaringBitmap& bitmap, const set<uint32_t>& reference) {
+    vector<uint32_t> values;
+    bitmap.forEach([&values](uint32_t value) { values.push_back(value); });
+    return bitmap.cardinality() == reference.size() && values == vector<uint32_t>(reference.begin(), reference.end());
+}
+
+// Random values in a dense group (bitmap form), a sparse one (array form)
+// and one that hovers around the conversion size
+uint32_t randomValue(mt19937& rng) {
+    switch (rng() % 3) {
+    case 0: return rng() % 16384;
+    case 1: return (7u << 16) | (rng() % 65536);
+    default: return (9u << 16) | (rng() % 10000);
+    }
+}
+
+// Compressed slot sets agree with std::set through every container form
+void testRoaringBitmap() {
+    mt19937 rng(5);
+    RoaringBitmap a, b;
+    set<uint32_t> refA, refB;
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < 40000; ++i) {
+            uint32_t value = randomValue(rng);
+            bool isA = rng() & 1;
+            RoaringBitmap& bitmap = isA ? a : b;
+            set<uint32_t>& ref = isA ? refA : refB;
+            switch (rng() % 4) {
+            case 0:
+            case 1: CHECK(bitmap.add(value) == ref.insert(value).second); break;
+            case 2: CHECK(bitmap.remove(value) == (ref.erase(value) == 1)); break;
+            default: CHECK(bitmap.contains(value) == (ref.count(value) == 1)); break;
+            }
+        }
+        CHECK(sameValues(a, refA));
+        CHECK(sameValues(b, refB));
+        // Shrink toward the array form for the next round
+        for (auto it = refA.begin(); it != refA.end();) {
+            if (rng() % 3 == 0) {
+                CHECK(a.remove(*it));
+                it = refA.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        CHECK(sameValues(a, refA));
+    }
+
+    RoaringBitmap both = a;
+    set<uint32_t> refBoth;
+    both.unionWith(b);
+    set_union(refA.begin(), refA.end(), refB.begin(), refB.end(), inserter(refBoth, refBoth.end()));
+    CHECK(sameValues(both, refBoth));
+    both = a;
+    refBoth.clear();
+    both.intersectWith(b);
+    set_intersection(refA.begin(), refA.end(), refB.begin(), refB.end(), inserter(refBoth, refBoth.end()));
+    CHECK(sameValues(both, refBoth));
+    RoaringBitmap none;
+    both = a;
+    both.intersectWith(none);
+    CHECK(both.empty());
+    both = none;
+    both.unionWith(b);
+    CHECK(sameValues(both, refB));
+
+    // Intersection with an external slot bitmap, for both bit values
+    vector<uint64_t> words(12 * 1024);
+    for (uint64_t& word : words) word = (uint64_t(rng()) << 32) | rng();
+    auto wordAt = [&words](size_t w) { return w < words.size() ? words[w] : 0; };
+    auto bitSet = [&](uint32_t value) { return (wordAt(value >> 6) >> (value & 63)) & 1; };
+    for (bool wanted : {true, false}) {
+        both = b;
+        both.intersectWith(wordAt, wanted);
+        refBoth.clear();
+        for (uint32_t value : refB) {
+            if (bool(bitSet(value)) == wanted) refBoth.insert(value);
+        }
+        CHECK(sameValues(both, refBoth));
+    }
+
+    for (uint32_t n : {0u, 1u, 63u, 64u, 4097u, 65536u, 65537u, 200000u}) {
+        RoaringBitmap filled = a;
+        filled.fill(n);
+        CHECK(filled.cardinality() == n);
+        CHECK(n == 0 || filled.contains(n - 1));
+        CHECK(!filled.contains(n));
+        uint32_t expected = 0;
+        bool ascending = true;
+        filled.forEach([&](uint32_t value) { ascending = ascending && value == expected++; });
+        CHECK(ascending && expected == n);
+    }
+    a.clear();
+    CHECK(a.empty() && !a.contains(0));
+}
+
+// Scans and exports split across the scan pool give the same results,
+// in the same order, as serial ones
+void testParallelScans() {
+    vector<int> ids(110000);
+    for (size_t i = 0; i < ids.size(); ++i) ids[i] = int(i) * 5 - 200000;
+    shuffle(ids.begin(), ids.end(), mt19937(7)); // Slot order differs from ID order
+    // Imported in bulk; adding this many items one by one keeps the title
+    // indexes current on every insert and takes far longer
+    string csv;
+    size_t titleBytes = 0;
+    for (int id : ids) {
+        string title = (id % 7 ? "Volume " : "Annual VOLUME ") + to_string(id) + ", a title long enough to scan";
+        titleBytes += title.size();
+        csv += (id % 3 ? "BOOK," : "JOURNAL,") + to_string(id) + ",\"" + title + "\",0,Author " + to_string(id % 17) +
+               "," + to_string(id & 1023) + "\n";
+    }
+    string results[2];
+    string exported[2];
+    const unsigned threads[2] = {1, 4};
+    for (int run = 0; run < 2; ++run) {
+        const string dir = "threads_" + to_string(threads[run]);
+        filesystem::create_directory(dir);
+        filesystem::current_path(dir);
+        LibraryOptions options = testOptions();
+        options.scanThreads = threads[run];
+        writeFile("library_data.txt", csv);
+        LibraryManager lib(options);
+        for (size_t i = 0; i < ids.size(); i += 9) lib.tryBorrow(ids[i]);
+
+        string& out = results[run];
+        for (const char* keyword : {"volume", "VOLUME 1", "Scan", "-19999", "no such title"}) {
+            size_t hits = lib.searchItem(keyword, [&out](const ItemView& item) { out += to_string(item.id) + " "; }, true);
+            out += "= " + to_string(hits) + "\n";
+        }
+        CHECK(lib.searchItem("VoLuMe", [](const ItemView&) {}, true) == ids.size());
+        mutex seenLock;
+        vector<int> seen;
+        lib.listAll(
+            [&](const ItemView& item) {
+                lock_guard<mutex> guard(seenLock);
+                seen.push_back(item.id);
+            },
+            Execution::Parallel);
+        sort(seen.begin(), seen.end());
+        CHECK(seen.size() == ids.size() && adjacent_find(seen.begin(), seen.end()) == seen.end());
+
+        lib.addItem(Book(1, "Forces a full export", "Author", 1));
+        CHECK(lib.saveToFile());
+        exported[run] = readFile("library_data.txt");
+        filesystem::current_path("..");
+    }
+    CHECK(titleBytes >= size_t(4) << 20); // Above the parallel scan threshold
+    CHECK(results[0] == results[1]);
+    CHECK(!exported[0].empty() && exported[0] == exported[1]);
+}
+
+// One to five words of a small vocabulary, in mixed case and with
+// punctuation between them; the same word often appears twice
+string randomTitle(mt19937& rng) {
+    static const char* const WORDS[] = {"Data", "data", "SYSTEMS", "sys", "C++", "Rust's", "the", "of", "42", "x", "\xc3\x9c" "ber"};
+    static const char* const GAPS[] = {" ", ", ", "-", ".", "  ", "/"};
+    string title;
+    for (size_t words = 1 + rng() % 5; words > 0; --words) {
+        if (!title.empty()) title += GAPS[rng() % size(GAPS)];
+        title += WORDS[rng() % size(WORDS)];
+    }
+    return title;
+}
+
+// The IDs a search visits, in visiting order; a return value that does
+// not match the visits adds a sentinel so the comparison fails
+template <typename Search>
+vector<int> hitsOf(Search&& search) {
+    vector<int> ids;
+    size_t count = search([&ids](const ItemView& item) { ids.push_back(item.id); });
+    if (count != ids.size()) ids.push_back(numeric_limits<int>::min());
+    return ids;
+}
+
+// Lowercased runs of ASCII letters and digits
+set<string> wordsOf(string_view text) {
+    set<string> words;
+    string word;
+    for (char c : string(text) + " ") {
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            word += c;
+        } else if (c >= 'A' && c <= 'Z') {
+            word += char(c - 'A' + 'a');
+        } else if (!word.empty()) {
+            words.insert(word);
+            word.clear();
+        }
+    }
+    return words;
+}
+
+// Keyword search matches a scan for titles holding every word of the
+// query, through the bulk index build, single adds and removes, and a
+// reload
+void testKeywordSearch() {
+    mt19937 rng(11);
+    map<int, string> titles;
+    const char* const QUERIES[] = {"data", "DATA systems", "c", "rust S", "the of 42", "\xc3\x9c" "ber",
+                                   "ber", "x x", "nothing", "", " , "};
+    auto compare = [&](const LibraryManager& lib) {
+        for (const char* query : QUERIES) {
+            set<string> wanted = wordsOf(query);
+            vector<int> expected;
+            for (const auto& entry : titles) {
+                set<string> words = wordsOf(entry.second);
+                if (!wanted.empty() && includes(words.begin(), words.end(), wanted.begin(), wanted.end())) {
+                    expected.push_back(entry.first);
+                }
+            }
+            CHECK(hitsOf([&](auto visit) { return lib.searchKeywords(query, visit); }) == expected);
+        }
+    };
+    {
+        LibraryManager lib(testOptions());
+        vector<int> ids(1500);
+        for (size_t i = 0; i < ids.size(); ++i) ids[i] = int(i) * 2 - 700;
+        shuffle(ids.begin(), ids.end(), rng);
+        for (int id : ids) {
+            titles[id] = randomTitle(rng);
+            lib.addItem(Book(id, titles[id], "Author", 1));
+        }
+        compare(lib); // Builds the index in one pass
+        for (size_t i = 0; i < 300; ++i) {
+            int id = ids[i];
+            lib.removeItem(id);
+            titles.erase(id);
+            if (i % 2 == 0) {
+                titles[id] = randomTitle(rng); // Same ID, new title
+                lib.addItem(Journal(id, titles[id], "Press", 1));
+            }
+            int fresh = 5000 + int(i);
+            titles[fresh] = randomTitle(rng);
+            lib.addItem(Book(fresh, titles[fresh], "Author", 1));
+        }
+        compare(lib);
+        CHECK(lib.saveToFile());
+    }
+    LibraryManager lib(testOptions());
+    compare(lib);
+}
+
+string foldedAscii(string text) {
+    for (char& c : text) c = foldAscii(c);
+    return text;
+}
+
+// Substring search, through the trigram index or a scan, matches
+// string::find on every title: for queries shorter than a trigram, with
+// the index switched off and on again, and around adds and removes
+void testSubstringSearch() {
+    mt19937 rng(13);
+    map<int, string> titles;
+    const char* const QUERIES[] = {"Data", "ata", "a-s", "C++", "s's", "SYSTEMS.the", "42/", "Data Data",
+                                   "ys", "x", "", "\xc3\x9c", "\xc3\x9c" "b", "DATA", "sYs", "nothing"};
+    auto compare = [&](LibraryManager& lib) {
+        for (const char* query : QUERIES) {
+            for (bool ignoreCase : {false, true}) {
+                vector<int> expected;
+                for (const auto& entry : titles) {
+                    bool hit = ignoreCase ? foldedAscii(entry.second).find(foldedAscii(query)) != string::npos
+                                          : entry.second.find(query) != string::npos;
+                    if (hit) expected.push_back(entry.first);
+                }
+                CHECK(hitsOf([&](auto visit) { return lib.searchItem(query, visit, ignoreCase); }) == expected);
+            }
+        }
+    };
+    int nextId = 0;
+    auto churn = [&](LibraryManager& lib) {
+        for (int i = 0; i < 200; ++i) {
+            auto victim = titles.begin();
+            advance(victim, rng() % titles.size());
+            lib.removeItem(victim->first);
+            titles.erase(victim);
+            titles[nextId] = randomTitle(rng);
+            lib.addItem(Book(nextId, titles[nextId], "Author", 1));
+            nextId += 3;
+        }
+    };
+    {
+        LibraryManager lib(testOptions());
+        for (; nextId < 3000; nextId += 3) {
+            titles[nextId] = randomTitle(rng);
+            lib.addItem(Journal(nextId, titles[nextId], "Press", 1));
+        }
+        compare(lib); // Builds the index in one pass
+        churn(lib);
+        compare(lib);
+        lib.setSubstringIndex(false);
+        compare(lib);
+        churn(lib);
+        compare(lib);
+        lib.setSubstringIndex(true); // Rebuilt from the current titles
+        compare(lib);
+        churn(lib);
+        compare(lib);
+        CHECK(lib.saveToFile());
+    }
+    LibraryManager lib(testOptions());
+    compare(lib);
+}
+
+// Exactly one of several concurrent callers checks out (or returns) an
+// item, through tryBorrow or borrowMany alike, and the journal keeps the
+// result
+void testBorrowContention() {
+    const int items = 512;
+    const unsigned threads = 8;
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        for (int id = 0; id < items; ++id) lib.addItem(Book(id, "Contended " + to_string(id), "Author", 1));
+        for (int round = 0; round < 5; ++round) {
+            const bool borrowing = round % 2 == 0;
+            vector<atomic<int>> wins(items);
+            atomic<bool> go{false};
+            vector<thread> callers;
+            for (unsigned t = 0; t < threads; ++t) {
+                callers.emplace_back([&, t] {
+                    vector<int> ids(items);
+                    for (int id = 0; id < items; ++id) ids[size_t(id)] = id;
+                    shuffle(ids.begin(), ids.end(), mt19937(round * 100 + t));
+                    while (!go.load()) this_thread::yield();
+                    if (t % 2 == 0) {
+                        for (int id : ids) {
+                            if (borrowing ? lib.tryBorrow(id) : lib.tryReturn(id)) ++wins[size_t(id)];
+                        }
+                        return;
+                    }
+                    for (size_t first = 0; first < ids.size(); first += 32) {
+                        vector<int> batch(ids.begin() + first, ids.begin() + first + 32);
+                        vector<OpStatus> results = borrowing ? lib.borrowMany(batch) : lib.returnMany(batch);
+                        for (size_t i = 0; i < batch.size(); ++i) {
+                            if (results[i] == OpStatus::Ok) ++wins[size_t(batch[i])];
+                        }
+                    }
+                });
+            }
+            go = true;
+            for (thread& caller : callers) caller.join();
+            size_t single = 0, inState = 0;
+            for (const atomic<int>& win : wins) single += win == 1;
+            lib.listAll([&](const ItemView& item) { inState += item.borrowed == borrowing; });
+            CHECK(single == size_t(items));
+            CHECK(inState == size_t(items));
+        }
+        CHECK(lib.flush().get());
+        expected = dump(lib);
+    }
+    LibraryManager lib(testOptions()); // From the journal
+    CHECK(dump(lib) == expected);
+}
+
+// Batches answer per input position; of IDs repeated in a batch the
+// first occurrence wins, and the rest see the state it left
+void testBatchResults() {
+    using S = OpStatus;
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        lib.addItem(Book(5, "Existing", "Ann", 1));
+        vector<CatalogItem> items = {Book(9, "First nine", "Bo", 2), Journal(3, "Three", "Press", 3),
+                                     Book(5, "Not stored", "Cy", 4), Journal(9, "Second nine", "Press", 5),
+                                     Book(-4, "Minus four", "Di", 6), Book(3, "Second three", "Ed", 7),
+                                     Book(-4, "Again", "Fay", 8)};
+        CHECK((lib.addItems(items) == vector<S>{S::Ok, S::Ok, S::DuplicateId, S::DuplicateId, S::Ok,
+                                                S::DuplicateId, S::DuplicateId}));
+        CHECK(dump(lib) == "-4 B Minus four | Di | 6\n3 J Three | Press | 3\n5 B Existing | Ann | 1\n"
+                           "9 B First nine | Bo | 2\n");
+        CHECK((lib.borrowMany({9, 7, 9, 5, -4, 5}) ==
+               vector<S>{S::Ok, S::NotFound, S::AlreadyBorrowed, S::Ok, S::Ok, S::AlreadyBorrowed}));
+        CHECK((lib.returnMany({5, 5, 3, 100, 9}) == vector<S>{S::Ok, S::NotBorrowed, S::NotBorrowed, S::NotFound, S::Ok}));
+        CHECK((lib.removeItems({3, 8, 3, -4}) == vector<S>{S::Ok, S::NotFound, S::NotFound, S::Ok}));
+        CHECK(lib.addItems({}).empty() && lib.removeItems({}).empty() && lib.borrowMany({}).empty());
+        CHECK(dump(lib) == "5 B Existing | Ann | 1\n9 B First nine | Bo | 2\n");
+
+        // Small batches against a larger catalog keep the indexes current
+        // instead of dropping them
+        vector<CatalogItem> many;
+        for (int id = 100; id < 300; ++id) many.push_back(Book(id, "Bulk " + to_string(id), "Gus", id));
+        many.push_back(Book(150, "Repeated", "Gus", 0));
+        vector<OpStatus> results = lib.addItems(many);
+        CHECK(count(results.begin(), results.end(), S::Ok) == 200 && results.back() == S::DuplicateId);
+        CHECK(lib.searchKeywords("bulk", [](const ItemView&) {}) == 200);
+        CHECK((lib.addItems({Book(1, "Bulk one", "Hal", 1), Book(100, "Bulk dup", "Hal", 1)}) ==
+               vector<S>{S::Ok, S::DuplicateId}));
+        CHECK((lib.removeItems({101, 101}) == vector<S>{S::Ok, S::NotFound}));
+        CHECK(lib.searchKeywords("bulk", [](const ItemView&) {}) == 200);
+        CHECK(lib.flush().get());
+        expected = dump(lib);
+    }
+    LibraryManager lib(testOptions()); // From the journal
+    CHECK(dump(lib) == expected);
+}
+
+// Requests answered through ProtocolHandler::handle(), without a socket:
+// field escapes, every error code, ADD validation, SUGGEST's k, filter
+// terms and QUIT
+void testLineProtocol() {
+    LibraryManager lib(testOptions());
+    ProtocolHandler handler(lib);
+    bool more = true;
+    auto ask = [&](string_view line) {
+        string out;
+        more = handler.handle(line, out);
+        return out;
+    };
+
+    CHECK(ask("PING") == "OK\n");
+    CHECK(ask("PING\r") == "OK\n");
+    CHECK(ask("") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("PING\tnow") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ping") == "ERR\tBAD_REQUEST\n");
+
+    // Escapes: \\, \t and \n decode on the way in and encode on the way
+    // out; a lone trailing backslash is kept as it is
+    CHECK(ask("ADD\tBOOK\t1\tTab\\there, new\\nline\tA\\\\B\t10") == "OK\n");
+    CHECK(ask("ADD\tJOURNAL\t2\tEnds in \\\tPress\t3\t1") == "OK\n");
+    string title;
+    lib.findItem(1, [&title](const ItemView& item) { title = string(item.title); });
+    CHECK(title == "Tab\there, new\nline");
+    CHECK(ask("GET\t1") == "OK\t1\nBOOK\t1\tTab\\there, new\\nline\tA\\\\B\t10\t0\n");
+    CHECK(ask("GET\t2") == "OK\t1\nJOURNAL\t2\tEnds in \\\\\tPress\t3\t1\n");
+    CHECK(ask("SEARCH\t\\t") == "OK\t1\nBOOK\t1\tTab\\there, new\\nline\tA\\\\B\t10\t0\n");
+
+    // ADD: six or seven fields, a known type, integer id and number
+    CHECK(ask("ADD\tBOOK\t3\tShort\tAnn") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t3\tLong\tAnn\t1\t0\textra") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tMAGAZINE\t3\tType\tAnn\t1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tbook\t3\tCase\tAnn\t1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t3x\tId\tAnn\t1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t99999999999\tId\tAnn\t1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t3\tNumber\tAnn\t") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t3\tNumber\tAnn\tten") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("ADD\tBOOK\t1\tAgain\tAnn\t1") == "ERR\tDUPLICATE_ID\n");
+    CHECK(ask("ADD\tBOOK\t-3\tData systems\tBo\t7\t0") == "OK\n");
+    CHECK(ask("ADD\tJOURNAL\t4\tData weekly\tPress\t8\t1") == "OK\n");
+    CHECK(ask("ADD\tBOOK\t5\tDatabases\tCy\t9\tyes") == "OK\n"); // Only 1 means borrowed
+    CHECK(lib.size() == 5);
+
+    // Errors of the single-item commands
+    CHECK(ask("GET\t77") == "OK\t0\n");
+    CHECK(ask("GET\tone") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("GET") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("REMOVE\t77") == "ERR\tNOT_FOUND\n");
+    CHECK(ask("BORROW\t77") == "ERR\tNOT_FOUND\n");
+    CHECK(ask("BORROW\t4") == "ERR\tALREADY_BORROWED\n");
+    CHECK(ask("RETURN\t5") == "ERR\tNOT_BORROWED\n");
+    CHECK(ask("BORROW\t5") == "OK\n");
+    CHECK(ask("RETURN\t5") == "OK\n");
+    CHECK(ask("TOGGLE\t5") == "OK\t1\n");
+    CHECK(ask("TOGGLE\t5") == "OK\t0\n");
+    CHECK(ask("TOGGLE\t77") == "ERR\tNOT_FOUND\n");
+    CHECK(string(statusCode(OpStatus::Conflict)) == "CONFLICT"); // Needs a racing toggle
+
+    // SUGGEST takes an optional k >= 0, default DEFAULT_SUGGESTIONS
+    auto countOf = [](const string& response) { return response.substr(0, response.find('\n')); };
+    CHECK(countOf(ask("SUGGEST\tdata")) == "OK\t3");
+    CHECK(countOf(ask("SUGGEST\tdata\t2")) == "OK\t2");
+    CHECK(ask("SUGGEST\tdata\t0") == "OK\t0\n");
+    CHECK(countOf(ask("SUGGEST\tdata\t99")) == "OK\t3");
+    CHECK(ask("SUGGEST\tdata\t-1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("SUGGEST\tdata\ttwo") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("SUGGEST\tdata\t") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("SUGGEST\tdata\t1\t1") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("SUGGEST") == "ERR\tBAD_REQUEST\n");
+
+    // COUNT and FILTER terms
+    CHECK(ask("COUNT") == "OK\t5\n");
+    CHECK(ask("COUNT\ttype=BOOK") == "OK\t3\n");
+    CHECK(ask("COUNT\ttype=JOURNAL\tborrowed=1") == "OK\t2\n");
+    CHECK(ask("COUNT\tborrowed=0") == "OK\t3\n");
+    CHECK(ask("COUNT\tauthor=Bo\tauthor=Cy") == "OK\t2\n");
+    CHECK(ask("COUNT\tauthor=A\\\\B") == "OK\t1\n");
+    CHECK(ask("COUNT\tpublisher=Press\ttype=BOOK") == "OK\t0\n");
+    CHECK(ask("COUNT\tauthor=") == "OK\t0\n");
+    CHECK(ask("COUNT\ttype=MAGAZINE") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("COUNT\tborrowed=2") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("COUNT\tcolor=red") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("COUNT\tBOOK") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("FILTER") == "ERR\tBAD_REQUEST\n");
+    CHECK(ask("FILTER\tpublisher=Press") == "OK\t2\nJOURNAL\t2\tEnds in \\\\\tPress\t3\t1\n"
+                                               "JOURNAL\t4\tData weekly\tPress\t8\t1\n");
+    CHECK(ask("FILTER\ttype=BOOK\tborrowed=0\tauthor=Bo") == "OK\t1\nBOOK\t-3\tData systems\tBo\t7\t0\n");
+    CHECK(ask("FILTER\ttype=BOOK\tborrowed") == "ERR\tBAD_REQUEST\n");
+
+    CHECK(ask("STATS") == "OK\t5\t3\t2\t2\n");
+    CHECK(countOf(ask("LIST")) == "OK\t5");
+    CHECK(ask("KEYWORDS\tdata") == "OK\t2\nBOOK\t-3\tData systems\tBo\t7\t0\n"
+                                     "JOURNAL\t4\tData weekly\tPress\t8\t1\n");
+    CHECK(ask("REMOVE\t5") == "OK\n");
+    CHECK(ask("REMOVE\t5") == "ERR\tNOT_FOUND\n");
+
+    // SAVE answers inline, or is handed to the transport with deferSaves
+    CHECK(ask("SAVE") == "OK\n");
+    ProtocolHandler deferred(lib, true);
+    string out;
+    CHECK(deferred.handle("SAVE", out) && out.empty());
+    CHECK(deferred.takeSaveRequest() && !deferred.takeSaveRequest());
+    LibraryOptions unwritable = testOptions();
+    unwritable.dataPath = "missing_dir/library_data";
+    LibraryManager nowhere(unwritable);
+    ProtocolHandler failing(nowhere);
+    CHECK(failing.handle("SAVE", out) && out == "ERR\tIO_ERROR\n");
+
+    CHECK(ask("QUIT\tnow") == "ERR\tBAD_REQUEST\n" && more);
+    CHECK(ask("QUIT") == "OK\n" && !more);
+}
+
+struct SuggestEntry {
+    bool journal;
+    string title, creator;
+    bool borrowed = false;
+    uint32_t borrows = 0; // Successful checkouts
+    uint32_t ranked = 0;  // Checkouts when the index was last built
+    bool sinceBuild = false;
+};
+
+// suggest() matches a brute-force ranking: items with a word of the title
+// or creator starting with the prefix, whole-field prefixes first, then
+// borrow counts as of the last index build (live counts for items added
+// since), then ascending IDs. Runs through the unsorted tail of new items,
+// masked removals, and the rebuilds after a large batch and after enough
+// single removes
+void testSuggestRanking() {
+    mt19937 rng(17);
+    map<int, SuggestEntry> model;
+    const char* const CREATORS[] = {"Ann Lee", "ann-marie", "Bo Data", "Press of the x", "", "Sys Admin", "42 Dat"};
+    const char* const PREFIXES[] = {"d", "Data", "data s", "data, sys", "sys", "SYSTEMS", "the", "  -the", "c+",
+                                    "o", "an", "ann-", "x", "4", "\xc3\x9c", "rust's", "", " ", "zzz"};
+    auto expected = [&](string_view prefix, size_t k) {
+        string needle;
+        for (char c : prefix) {
+            bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+            if (word || !needle.empty()) needle += (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+        }
+        vector<tuple<bool, uint32_t, int>> ranked; // (!whole-field, -count, id) sorts best first
+        for (const auto& [id, entry] : model) {
+            bool hit = false, leading = false;
+            for (const string& field : {entry.title, entry.creator}) {
+                string folded = field;
+                for (char& c : folded) c = char(tolower(static_cast<unsigned char>(c)));
+                for (size_t i = 0; i < folded.size(); ++i) {
+                    bool start = isalnum(static_cast<unsigned char>(folded[i])) &&
+                                 (i == 0 || !isalnum(static_cast<unsigned char>(folded[i - 1])));
+                    if (!start || folded.compare(i, needle.size(), needle) != 0) continue;
+                    hit = true;
+                    leading = leading || i == 0;
+                }
+            }
+            uint32_t count = entry.sinceBuild ? entry.borrows : entry.ranked;
+            if (hit && !needle.empty()) ranked.emplace_back(!leading, numeric_limits<uint32_t>::max() - count, id);
+        }
+        sort(ranked.begin(), ranked.end());
+        vector<int> ids;
+        for (size_t i = 0; i < min(k, ranked.size()); ++i) ids.push_back(get<2>(ranked[i]));
+        return ids;
+    };
+    // Call only when the next suggest() builds the index afresh
+    auto rebuilt = [&] {
+        for (auto& entry : model) {
+            entry.second.ranked = entry.second.borrows;
+            entry.second.sinceBuild = false;
+        }
+    };
+    auto compare = [&](const LibraryManager& lib) {
+        for (const char* prefix : PREFIXES) {
+            for (size_t k : {size_t(0), size_t(1), size_t(3), size_t(10), size_t(60)}) {
+                CHECK(hitsOf([&](auto visit) { return lib.suggest(prefix, k, visit); }) == expected(prefix, k));
+            }
+        }
+    };
+    auto itemOf = [](int id, const SuggestEntry& entry) -> CatalogItem {
+        if (entry.journal) return Journal(id, entry.title, entry.creator, 1);
+        return Book(id, entry.title, entry.creator, 1);
+    };
+    auto randomEntry = [&] {
+        SuggestEntry entry;
+        entry.journal = rng() % 3 == 0;
+        entry.title = rng() % 10 == 0 ? string() : randomTitle(rng);
+        entry.creator = CREATORS[rng() % size(CREATORS)];
+        entry.sinceBuild = true;
+        return entry;
+    };
+    auto randomId = [&] {
+        auto it = model.begin();
+        advance(it, rng() % model.size());
+        return it->first;
+    };
+    auto borrowOrReturn = [&](LibraryManager& lib, int id) {
+        SuggestEntry& entry = model[id];
+        CHECK((entry.borrowed ? lib.tryReturn(id) : lib.tryBorrow(id)));
+        if (!entry.borrowed) ++entry.borrows;
+        entry.borrowed = !entry.borrowed;
+    };
+    auto addBatch = [&](LibraryManager& lib, int from, int count) {
+        vector<CatalogItem> items;
+        for (int id = from; id < from + count; ++id) {
+            model[id] = randomEntry();
+            items.push_back(itemOf(id, model[id]));
+        }
+        lib.addItems(items);
+    };
+
+    LibraryManager lib(testOptions());
+    addBatch(lib, 0, 600);
+    for (int i = 0; i < 1500; ++i) borrowOrReturn(lib, randomId()); // Counts of 0 to a dozen
+    rebuilt();
+    compare(lib);
+    for (int i = 0; i < 200; ++i) borrowOrReturn(lib, randomId()); // Not ranked until a rebuild
+    compare(lib);
+
+    // Adds, removes, re-adds under a removed ID and checkouts, one at a time
+    int nextId = 600;
+    vector<int> removed;
+    for (int step = 1; step <= 400; ++step) {
+        int op = int(rng() % 4);
+        if (op == 0) {
+            model[nextId] = randomEntry();
+            CHECK(lib.addItem(itemOf(nextId, model[nextId])) == OpStatus::Ok);
+            ++nextId;
+        } else if (op == 1) {
+            int id = randomId();
+            CHECK(lib.removeItem(id) == OpStatus::Ok);
+            model.erase(id);
+            removed.push_back(id);
+        } else if (op == 2 && !removed.empty()) {
+            int id = removed[rng() % removed.size()];
+            if (model.count(id) == 0) {
+                model[id] = randomEntry();
+                CHECK(lib.addItem(itemOf(id, model[id])) == OpStatus::Ok);
+            }
+        } else {
+            borrowOrReturn(lib, randomId());
+        }
+        if (step % 50 == 0) compare(lib);
+    }
+
+    // A batch over 1/INDEX_REBUILD_FRACTION of the catalog drops the index
+    vector<int> batch;
+    for (int i = 0; i < int(model.size()) / 5; ++i) {
+        int id = randomId();
+        if (find(batch.begin(), batch.end(), id) == batch.end()) batch.push_back(id);
+    }
+    lib.removeItems(batch);
+    for (int id : batch) model.erase(id);
+    rebuilt();
+    compare(lib);
+
+    // So do more single removes than the masked set holds
+    addBatch(lib, 10000, 6000);
+    rebuilt();
+    compare(lib);
+    for (int i = 0; i < 300; ++i) borrowOrReturn(lib, randomId());
+    compare(lib);
+    for (int i = 0; i < 4200; ++i) {
+        int id = randomId();
+        CHECK(lib.removeItem(id) == OpStatus::Ok);
+        model.erase(id);
+    }
+    rebuilt();
+    compare(lib);
+}
+
+struct FilterEntry {
+    bool journal;
+    string creator;
+    bool borrowed;
+};
+
+// filterItems and countItems match a scan for every combination of type,
+// borrowed and creator terms, with names in any ASCII case. Runs through
+// single adds and removes (which move the last slot into the hole),
+// batches large enough to drop the index, and a CSV import.
+void testFilterScan() {
+    mt19937 rng(19);
+    map<int, FilterEntry> model;
+    const char* const CREATORS[] = {"Ann Lee", "ANN LEE", "ann lee", "Bo", "bo", "Press", "PRESS",
+                                    "\xc3\x9c" "ber Verlag", "\xc3\xbc" "ber verlag", ""};
+    const vector<pair<vector<string>, vector<string>>> NAMES = {
+        {{}, {}}, {{"ann lee"}, {}}, {{"ANN lee", "bo"}, {}}, {{}, {"press"}}, {{"Press"}, {}},
+        {{"bo"}, {"PRESS"}}, {{"bo", "BO"}, {}}, {{"nobody"}, {"ann lee"}}, {{""}, {}},
+        {{}, {"\xc3\x9c" "BER VERLAG"}}, {{"Ann Lee "}, {}}, {{"late author"}, {"Late Author"}}};
+    auto folded = [](string text) {
+        for (char& c : text) c = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+        return text;
+    };
+    auto compare = [&](const LibraryManager& lib) {
+        for (const auto& names : NAMES) {
+            for (int type = 0; type < 3; ++type) {
+                for (int borrowed = 0; borrowed < 3; ++borrowed) {
+                    ItemQuery query;
+                    if (type > 0) query.type = type == 1 ? ItemType::Book : ItemType::Journal;
+                    if (borrowed > 0) query.borrowed = borrowed == 1;
+                    query.authors = names.first;
+                    query.publishers = names.second;
+                    vector<int> expected;
+                    for (const auto& [id, entry] : model) {
+                        bool named = !query.namesCreators();
+                        for (const string& name : entry.journal ? query.publishers : query.authors) {
+                            named = named || folded(name) == folded(entry.creator);
+                        }
+                        if (named && (!query.type || (*query.type == ItemType::Journal) == entry.journal) &&
+                            (!query.borrowed || *query.borrowed == entry.borrowed)) {
+                            expected.push_back(id);
+                        }
+                    }
+                    CHECK(hitsOf([&](auto visit) { return lib.filterItems(query, visit); }) == expected);
+                    CHECK(lib.countItems(query) == expected.size());
+                }
+            }
+        }
+    };
+    auto randomEntry = [&] {
+        return FilterEntry{rng() % 2 == 0, CREATORS[rng() % size(CREATORS)], rng() % 3 == 0};
+    };
+    auto itemOf = [](int id, const FilterEntry& entry) -> CatalogItem {
+        CatalogItem item = Book(id, "Book", entry.creator, 1);
+        if (entry.journal) item = Journal(id, "Journal", entry.creator, 1);
+        visit([&entry](auto& concrete) { concrete.setBorrowed(entry.borrowed); }, item);
+        return item;
+    };
+    auto add = [&](LibraryManager& lib, int id) {
+        model[id] = randomEntry();
+        CHECK(lib.addItem(itemOf(id, model[id])) == OpStatus::Ok);
+    };
+    auto randomId = [&] {
+        auto it = model.begin();
+        advance(it, rng() % model.size());
+        return it->first;
+    };
+
+    LibraryManager lib(testOptions());
+    for (int id = 0; id < 2000; ++id) add(lib, id * 3);
+    compare(lib);
+    for (int id = 1; id < 30; id += 3) { // Names first seen after the build
+        model[id] = FilterEntry{id % 2 == 0, id % 4 == 1 ? "Late Author" : "LATE AUTHOR", false};
+        CHECK(lib.addItem(itemOf(id, model[id])) == OpStatus::Ok);
+    }
+    compare(lib);
+
+    // Single changes keep the bitmaps and postings current; removing the
+    // newest item takes the last slot, any other moves it
+    int nextId = 6000;
+    for (int step = 1; step <= 600; ++step) {
+        int op = int(rng() % 4);
+        if (op == 0) {
+            add(lib, nextId++);
+        } else if (op == 1) {
+            int id = step % 5 == 0 ? prev(model.end())->first : randomId();
+            CHECK(lib.removeItem(id) == OpStatus::Ok);
+            model.erase(id);
+            if (step % 3 == 0) add(lib, id); // Same ID, maybe another type or creator
+        } else {
+            int id = randomId();
+            bool now = false;
+            CHECK(lib.toggleBorrow(id, now) == OpStatus::Ok);
+            model[id].borrowed = now;
+        }
+        if (step % 100 == 0) compare(lib);
+    }
+
+    // Batches over 1/INDEX_REBUILD_FRACTION of the catalog drop the index
+    vector<CatalogItem> items;
+    for (int id = 20000; id < 20500; ++id) {
+        model[id] = randomEntry();
+        items.push_back(itemOf(id, model[id]));
+    }
+    lib.addItems(items);
+    compare(lib);
+    vector<int> ids;
+    for (const auto& entry : model) {
+        if (rng() % 5 == 0) ids.push_back(entry.first);
+    }
+    lib.removeItems(ids);
+    for (int id : ids) model.erase(id);
+    compare(lib);
+
+    // An import replaces repeated IDs and drops the index too
+    string csv;
+    for (int i = 0; i < 400; ++i) {
+        int id = i % 2 == 0 ? randomId() : 30000 + i;
+        const FilterEntry& entry = model[id] = randomEntry();
+        csv += string(entry.journal ? "JOURNAL," : "BOOK,") + to_string(id) + ",Imported," +
+               (entry.borrowed ? "1," : "0,") + entry.creator + ",3\n";
+    }
+    writeFile("import.csv", csv);
+    CHECK(lib.importCSV("import.csv"));
+    compare(lib);
+}
+
+// The type bitmaps built by stats() stay current through adds and
+// removes, and a later author filter builds the creator postings from the
+// inventory as it is then
+void testSplitAttributeBuild() {
+    LibraryManager lib(testOptions());
+    for (int id = 0; id < 300; ++id) {
+        if (id % 3 == 0) lib.addItem(Journal(id, "Journal", "Press " + to_string(id % 4), 1));
+        else lib.addItem(Book(id, "Book", "Author " + to_string(id % 5), 1));
+    }
+    CatalogStats before = lib.stats(); // Type bitmaps only
+    CHECK(before.items == 300 && before.books == 200 && before.journals == 100);
+    for (int id = 0; id < 300; id += 7) lib.removeItem(id);
+    for (int id = 300; id < 340; ++id) lib.addItem(Book(id, "Late", id % 2 == 0 ? "Author 1" : "Newcomer", 1));
+    lib.addItem(Journal(0, "Back", "Author 1", 1)); // A publisher, not an author
+    for (int id = 1; id < 340; id += 11) lib.tryBorrow(id);
+
+    auto scan = [&lib](const ItemQuery& query) {
+        vector<int> ids;
+        lib.listAll([&](const ItemView& item) {
+            bool byAuthor = item.type == ItemType::Book &&
+                            find(query.authors.begin(), query.authors.end(), string(item.creator)) != query.authors.end();
+            if (byAuthor && (!query.borrowed || *query.borrowed == item.borrowed)) ids.push_back(item.id);
+        });
+        return ids;
+    };
+    auto compare = [&](ItemQuery query) {
+        vector<int> expected = scan(query);
+        CHECK(!expected.empty());
+        CHECK(hitsOf([&](auto visit) { return lib.filterItems(query, visit); }) == expected);
+        CHECK(lib.countItems(query) == expected.size());
+        query.borrowed = true;
+        expected = scan(query);
+        CHECK(hitsOf([&](auto visit) { return lib.filterItems(query, visit); }) == expected);
+    };
+    ItemQuery query;
+    query.authors = {"Author 1", "Newcomer"};
+    compare(query); // Builds the creator postings
+    for (int id = 2; id < 340; id += 13) lib.removeItem(id);
+    lib.addItem(Book(400, "Later still", "Newcomer", 1));
+    compare(query);
+
+    CatalogStats after = lib.stats();
+    CatalogStats expected;
+    lib.listAll([&expected](const ItemView& item) {
+        ++expected.items;
+        ++(item.type == ItemType::Book ? expected.books : expected.journals);
+        expected.borrowed += item.borrowed;
+    });
+    CHECK(after.items == expected.items && after.books == expected.books);
+    CHECK(after.journals == expected.journals && after.borrowed == expected.borrowed);
+}
+
+// Saves that only changed statuses patch library_data.txt in place, to
+// the bytes a full export writes; after the file changed size or mtime,
+// or items were added or removed, the save writes it whole again
+void testCsvPatch() {
+    const string csv = "library_data.txt";
+    LibraryOptions options = testOptions();
+    options.metrics = true; // Counts the CSV bytes each save writes
+    LibraryManager lib(options);
+    const int items = 20000; // 313 runs of 64 records; a few dirty ones are patched
+    for (int slot = 0; slot < items; ++slot) {
+        int id = (slot + 32) % items; // Each word of slots spans two runs of the export
+        string title = id % 3 == 0 ? "Say \"hi\",\nthen go " + to_string(id) : "Plain " + to_string(id);
+        if (id % 2 == 0) lib.addItem(Book(id, title, "Ann, Lee", id));
+        else lib.addItem(Journal(id, title, "Press", id));
+    }
+    auto csvWritten = [&lib] { return lib.metricsReport().bytesWritten[size_t(IoTarget::Csv)]; };
+    // Bytes the save wrote, or 0 after a failure or a file unlike a fresh export
+    auto save = [&] {
+        uint64_t before = csvWritten();
+        CHECK(lib.saveToFile());
+        uint64_t written = csvWritten() - before;
+        CHECK(lib.exportCSV("fresh.csv"));
+        return readFile(csv) == readFile("fresh.csv") ? written : 0;
+    };
+    auto fileSize = [&csv] { return uint64_t(filesystem::file_size(csv)); };
+    auto patched = [&] { // Written and below a tenth of the file
+        uint64_t written = save();
+        return written > 0 && written < fileSize() / 10;
+    };
+    // Statuses in a few runs, at run boundaries and the ends of the file
+    auto flip = [&lib](int first) {
+        for (int id : {first, first + 63, first + 64, first + 130, items - 1, 0}) {
+            bool now = false;
+            CHECK(lib.toggleBorrow(id, now) == OpStatus::Ok);
+        }
+    };
+
+    CHECK(save() == fileSize()); // No earlier export to patch
+    flip(640);
+    CHECK(patched());
+    flip(640); // Back again
+    lib.tryBorrow(5000);
+    CHECK(patched());
+    CHECK(save() == 0 && readFile(csv) == readFile("fresh.csv")); // Nothing changed
+
+    auto stamp = filesystem::last_write_time(csv);
+    writeFile(csv, readFile(csv) + "\n"); // New size, same mtime
+    filesystem::last_write_time(csv, stamp);
+    flip(1280);
+    CHECK(save() == fileSize());
+    flip(1280);
+    CHECK(patched());
+
+    string edited = readFile(csv); // Same size, new mtime
+    edited[edited.find("Plain")] = 'p';
+    stamp = filesystem::last_write_time(csv);
+    writeFile(csv, edited);
+    filesystem::last_write_time(csv, stamp - chrono::seconds(10));
+    flip(1920);
+    CHECK(save() == fileSize());
+    flip(1920);
+    CHECK(patched());
+
+    lib.addItem(Book(items, "Added", "Bo", 1));
+    flip(2560);
+    CHECK(save() == fileSize());
+    flip(2560);
+    CHECK(patched());
+    lib.removeItem(items);
+    flip(3200);
+    CHECK(save() == fileSize());
+    flip(3200);
+    CHECK(patched());
+
+    for (int id = 0; id < 60 * 320; id += 320) { // Too many runs to patch
+        bool now = false;
+        lib.toggleBorrow(id, now);
+    }
+    CHECK(save() == fileSize());
+}
+
+// A ShardedLibrary answers as one LibraryManager holding the same items:
+// every ID lives on the shard the map names, batches answer in input
+// order, searches, keywords and filters merge into ascending ID order,
+// and stats and counts sum over the shards. For hash and range maps.
+void testShardedLibrary() {
+    mt19937 rng(29);
+    LibraryOptions referenceOptions = testOptions();
+    referenceOptions.dataPath = "reference";
+    LibraryManager reference(referenceOptions);
+    LibraryOptions options = testOptions();
+    options.dataPath = "hashed";
+    ShardedLibrary hashed(ShardMap::hashed(4), options);
+    options.dataPath = "ranged";
+    ShardedLibrary ranged(ShardMap::ranges({-100, 0, 500}), options);
+
+    const int EDGES[] = {-101, -100, -1, 0, 499, 500}; // Either side of each range bound
+    vector<CatalogItem> items;
+    for (int i = 0; i < 1200; ++i) {
+        int id = i < int(size(EDGES)) ? EDGES[i] : int(rng() % 1600) - 600; // Repeats within the batch
+        string title = randomTitle(rng);
+        if (rng() % 2 == 0) items.push_back(Book(id, title, "Author " + to_string(rng() % 5), i));
+        else items.push_back(Journal(id, title, "Press " + to_string(rng() % 3), i));
+    }
+    vector<OpStatus> added = reference.addItems(items);
+    CHECK(hashed.addItems(items) == added);
+    CHECK(ranged.addItems(items) == added);
+    CHECK(count(added.begin(), added.end(), OpStatus::DuplicateId) > 0);
+
+    // Routing
+    auto rangeOf = [](int id) { return id < -100 ? size_t(0) : id < 0 ? size_t(1) : id < 500 ? size_t(2) : size_t(3); };
+    for (ShardedLibrary* lib : {&hashed, &ranged}) {
+        vector<size_t> perShard(lib->shardCount());
+        reference.listAll([&](const ItemView& item) {
+            size_t owner = lib->shardOf(item.id);
+            if (lib == &ranged) CHECK(owner == rangeOf(item.id));
+            for (size_t s = 0; s < lib->shardCount(); ++s) {
+                bool found = lib->shard(s).findItem(item.id, [](const ItemView&) {});
+                CHECK(found == (s == owner));
+            }
+            ++perShard[owner];
+        });
+        for (size_t count : perShard) CHECK(count > 0);
+        CHECK(lib->size() == reference.size());
+    }
+
+    // Batches with repeated and missing IDs, per input position
+    auto randomIds = [&rng](size_t count) {
+        vector<int> ids;
+        for (size_t i = 0; i < count; ++i) ids.push_back(int(rng() % 1700) - 650);
+        return ids;
+    };
+    for (int round = 0; round < 4; ++round) {
+        vector<int> ids = randomIds(300);
+        vector<OpStatus> expected = round % 2 == 0 ? reference.borrowMany(ids) : reference.returnMany(ids);
+        for (ShardedLibrary* lib : {&hashed, &ranged}) {
+            CHECK((round % 2 == 0 ? lib->borrowMany(ids) : lib->returnMany(ids)) == expected);
+        }
+    }
+    vector<int> removed = randomIds(200);
+    vector<OpStatus> expected = reference.removeItems(removed);
+    CHECK(hashed.removeItems(removed) == expected);
+    CHECK(ranged.removeItems(removed) == expected);
+    for (int id : {-100, 0, 42, 500, 9999}) {
+        bool now = false, mirrored = false;
+        OpStatus status = reference.toggleBorrow(id, now);
+        for (ShardedLibrary* lib : {&hashed, &ranged}) CHECK(lib->toggleBorrow(id, mirrored) == status && mirrored == now);
+    }
+
+    // Merged answers, and sums
+    ItemQuery borrowedBooks;
+    borrowedBooks.type = ItemType::Book;
+    borrowedBooks.borrowed = true;
+    ItemQuery byCreator;
+    byCreator.authors = {"author 1", "Author 3"};
+    byCreator.publishers = {"PRESS 2"};
+    for (const ShardedLibrary* lib : {&hashed, &ranged}) {
+        for (const char* keyword : {"Data", "sys", "C++", "x", ""}) {
+            for (bool ignoreCase : {false, true}) {
+                CHECK(hitsOf([&](auto visit) { return lib->searchItem(keyword, visit, ignoreCase); }) ==
+                      hitsOf([&](auto visit) { return reference.searchItem(keyword, visit, ignoreCase); }));
+            }
+            CHECK(hitsOf([&](auto visit) { return lib->searchKeywords(keyword, visit); }) ==
+                  hitsOf([&](auto visit) { return reference.searchKeywords(keyword, visit); }));
+        }
+        for (const ItemQuery& query : {ItemQuery(), borrowedBooks, byCreator}) {
+            CHECK(hitsOf([&](auto visit) { return lib->filterItems(query, visit); }) ==
+                  hitsOf([&](auto visit) { return reference.filterItems(query, visit); }));
+            CHECK(lib->countItems(query) == reference.countItems(query));
+        }
+        CHECK(dump(*lib) == dump(reference));
+        mutex seenMutex;
+        vector<int> seen;
+        lib->listAll([&](const ItemView& item) {
+            lock_guard<mutex> guard(seenMutex);
+            seen.push_back(item.id);
+        }, Execution::Parallel);
+        sort(seen.begin(), seen.end());
+        CHECK(seen == hitsOf([&](auto visit) { reference.listAll(visit); return reference.size(); }));
+        CatalogStats stats = lib->stats(), wanted = reference.stats();
+        CHECK(stats.items == wanted.items && stats.books == wanted.books);
+        CHECK(stats.journals == wanted.journals && stats.borrowed == wanted.borrowed);
+    }
+}
+
+// Packed archives reload to the same catalog, across blocks and with IDs
+// and numbers at the ends of the int range; a damaged block stops the
+// import after the blocks before it
+void testPackRoundTrip() {
+    const int lowest = numeric_limits<int>::min(), highest = numeric_limits<int>::max();
+    string expected;
+    {
+        LibraryManager lib(testOptions());
+        addSampleItems(lib, 5000); // Several blocks
+        for (int id : {lowest, lowest + 1, -1, 0, 1, highest - 1, highest}) {
+            lib.removeItem(id);
+            lib.addItem(Book(id, "Edge " + to_string(id), "Edge", id == 0 ? lowest : id));
+        }
+        lib.addItem(Journal(-101, "", "", highest));
+        lib.tryBorrow(lowest);
+        lib.tryBorrow(highest);
+        CHECK(lib.exportPack("catalog.pack"));
+        expected = dump(lib);
+    }
+    PackReader reader;
+    CHECK(reader.open("catalog.pack"));
+    CHECK(reader.findItem(lowest, [lowest](const ItemView& item) { CHECK(item.borrowed && item.number == lowest); }));
+    CHECK(reader.findItem(highest, [](const ItemView& item) { CHECK(item.title == "Edge 2147483647"); }));
+    CHECK(!reader.findItem(2, [](const ItemView&) {}));
+
+    // Neighbours further apart than an int can hold
+    filesystem::create_directory("extremes");
+    filesystem::current_path("extremes");
+    {
+        const vector<int> ids = {lowest, -7, highest - 1, highest};
+        {
+            LibraryManager lib(testOptions());
+            for (int id : ids) lib.addItem(Journal(id, "Far", "Apart", id / 3));
+            CHECK(lib.exportPack("far.pack"));
+        }
+        PackReader far;
+        CHECK(far.open("far.pack"));
+        vector<int> read;
+        CHECK(far.forEach([&read](const ItemView& item) {
+            CHECK(item.number == item.id / 3);
+            read.push_back(item.id);
+        }));
+        CHECK(read == ids);
+    }
+    filesystem::current_path("..");
+
+    filesystem::create_directory("copy");
+    filesystem::current_path("copy");
+    {
+        LibraryManager lib(testOptions());
+        CHECK(lib.importPack("../catalog.pack"));
+        CHECK(dump(lib) == expected);
+    }
+    CHECK(dump(LibraryManager(testOptions())) == expected); // And it was saved
+
+    string pack = readFile("../catalog.pack");
+    PackHeader header;
+    memcpy(&header, pack.data(), sizeof(header));
+    CHECK(header.blockCount > 2);
+    PackBlockEntry second;
+    memcpy(&second, pack.data() + header.indexOffset + sizeof(PackBlockEntry), sizeof(second));
+    pack[size_t(second.offset) + 3] ^= 0x55;
+    writeFile("damaged.pack", pack);
+    filesystem::current_path("..");
+    filesystem::create_directory("damaged");
+    filesystem::current_path("damaged");
+    {
+        LibraryManager lib(testOptions());
+        CHECK(lib.importPack("../copy/damaged.pack"));
+        size_t items = 0;
+        lib.listAll([&](const ItemView& item) {
+            CHECK(item.id < second.firstId);
+            ++items;
+        });
+        CHECK(items > 0);
+    }
+    filesystem::current_path("..");
+}
+
+#if LIBRARY_POSIX
+// Borrows synced while a checkpoint writes are kept when the process dies
+// between publishing the new state and resetting the journal: the log
+// left behind is replayed from the mark the state stores
+void checkpointCrash(bool fullSnapshot) {
+    LibraryOptions options; // Synced, as for real
+    {
+        LibraryManager lib(options);
+        for (int id = 0; id < 2000; ++id) lib.addItem(Book(id, "Title " + to_string(id), "Author", id));
+        CHECK(lib.saveToFile());
+    }
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        LibraryManager lib(options);
+        for (int id = 0; id < 50; ++id) lib.tryBorrow(id);
+        if (fullSnapshot) lib.addItem(Book(5000, "Added", "Author", 1)); // Slots move: no delta
+        onStateRename = [&](const string& target) {
+            if (target != (fullSnapshot ? "library_data.snap" : "library_data.delta")) _exit(4);
+            bool synced = true;
+            thread borrower([&] {
+                for (int id = 50; id < 100; ++id) synced = lib.tryBorrow(id) && synced;
+                synced = lib.flush().get() && synced; // Reported durable
+            });
+            borrower.join();
+            if (!synced) _exit(5);
+        };
+        lib.saveToFile();
+        _exit(3); // Never renamed
+    }
+    int status = 0;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    for (int reopen = 0; reopen < 2; ++reopen) { // Recovery saves: nothing is replayed twice
+        LibraryManager lib(testOptions());
+        size_t borrowed = 0, others = 0;
+        lib.listAll([&](const ItemView& item) {
+            if (item.borrowed) ++(item.id < 100 ? borrowed : others);
+        });
+        CHECK(borrowed == 100);
+        CHECK(others == 0);
+        CHECK(lib.findItem(5000, [](const ItemView&) {}) == fullSnapshot);
+    }
+}
+
+void testCrashAfterSnapshotRename() { checkpointCrash(true); }
+void testCrashAfterDeltaRename() { checkpointCrash(false); }
+#endif
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+const vector<TestCase> TESTS = {
+    {"shuffled_inserts", testShuffledInserts},
+    {"snapshot_round_trip", testSnapshotRoundTrip},
+    {"corrupt_snapshot_falls_back", testCorruptSnapshotFallsBack},
+    {"snapshot_bounds_checked", testSnapshotBoundsChecked},
+    {"journal_replay", testJournalReplay},
+    {"single_threaded", testSingleThreaded},
+    {"csv_quoting", testCsvQuoting},
+    {"parallel_split", testParallelSplit},
+    {"roaring_bitmap", testRoaringBitmap},
+    {"parallel_scans", testParallelScans},
+    {"keyword_search", testKeywordSearch},
+    {"substring_search", testSubstringSearch},
+    {"borrow_contention", testBorrowContention},
+    {"batch_results", testBatchResults},
+    {"line_protocol", testLineProtocol},
+    {"suggest_ranking", testSuggestRanking},
+    {"filter_scan", testFilterScan},
+    {"split_attribute_build", testSplitAttributeBuild},
+    {"csv_patch", testCsvPatch},
+    {"sharded_library", testShardedLibrary},
+    {"pack_round_trip", testPackRoundTrip},
+#if LIBRARY_POSIX
+    {"crash_after_snapshot_rename", testCrashAfterSnapshotRename},
+    {"crash_after_delta_rename", testCrashAfterDeltaRename},
+#endif
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    filesystem::path home = filesystem::current_path();
+    size_t ran = 0;
+    for (const TestCase& test : TESTS) {
+        if (argc > 1 && find_if(argv + 1, argv + argc, [&](const char* name) { return test.name == string_view(name); }) ==
+                            argv + argc) {
+            continue;
+        }
+        filesystem::path dir = home / "test_data" / test.name;
+        filesystem::remove_all(dir);
+        filesystem::create_directories(dir);
+        filesystem::current_path(dir);
+        size_t before = failures;
+        cout << test.name << "\n";
+        test.run();
+        if (failures != before) cout << "  FAILED\n";
+        filesystem::current_path(home);
+        ++ran;
+    }
+    cout << ran << " test(s), " << (failures == 0 ? "all passed" : to_string(failures) + " failed check(s)") << "\n";
+    return failures == 0 ? 0 : 1;
+}